@@ -0,0 +1,25 @@
+#pragma once
+#include "config.h"
+#include <string>
+namespace Lemon {
+
+// applier的checkpoint文件，固定32字节
+struct ApplierCheckpoint {
+  static constexpr uint32_t MAGIC = 0x4150434B; // "APCK"
+  static constexpr uint32_t VERSION = 1;
+
+  uint32_t magic_;
+  uint32_t version_;
+  lsn_t applied_lsn_; // LSN小于这个值的日志都已经apply并且落盘了
+  uint64_t applied_offset_; // applied_lsn_在redo log中的data offset（去掉了block的头和尾）
+  uint64_t reserved_;
+
+  // 读取checkpoint文件，文件不存在或者内容不对时返回false
+  bool Load(const std::string &path);
+
+  // 先写临时文件并fsync，再rename覆盖旧的checkpoint文件，崩溃时要么是旧的checkpoint，要么是新的
+  bool Store(const std::string &path) const;
+};
+static_assert(sizeof(ApplierCheckpoint) == 32, "ApplierCheckpoint must be 32 bytes");
+
+}
@@ -2,14 +2,23 @@
 #include "config.h"
 #include "bean.h"
 #include <unordered_map>
-#include <list>
+#include <vector>
 #include <string>
 #include <fstream>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include "buffer_pool.h"
+#include "log_index.h"
+#include "scheduler.h"
 namespace Lemon {
 
 class ApplySystem {
 public:
+  // 测试直接往batch中放日志，不经过redo log文件
+  friend class ParallelApplyTest;
+
   ApplySystem(bool save_logs);
   ~ApplySystem();
   lsn_t GetCheckpointLSN() const {
@@ -21,32 +30,256 @@ public:
   uint32_t GetCheckpointOffset() const {
     return checkpoint_offset_;
   }
+  // 解析一批日志，解析完成后交给apply；流水线中没有空闲的batch时会阻塞
   bool PopulateHashMap();
+
+  // apply最早解析好的一批日志，没有可以apply的batch时返回false
   bool ApplyHashLogs();
 
+  // 不断地解析、apply日志直到redo log处理完。流水线深度大于0时，
+  // 解析在单独的线程中进行，第N批日志apply的同时解析第N+1批
+  void Run();
+
+  // 只apply结束位置不超过target_lsn的完整MTR，Run结束时把所有page写回。
+  // 0表示apply所有日志。需要在Run之前调用
+  void SetTargetLSN(lsn_t target_lsn);
+
+  // 每隔seconds秒做一次checkpoint，0表示只在Run结束时做
+  void SetCheckpointInterval(uint32_t seconds) {
+    checkpoint_interval_ = seconds;
+  }
+
+  // 最多有depth批已经解析好但还没有apply完的日志，0表示解析和apply串行执行。只能在Run之前调用
+  void SetPipelineDepth(uint32_t depth);
+
+  // 打印统计信息
+  void ReportStats(std::ostream &os) const;
+
+  // PAGE_SIZE是数据目录的page大小
+  template <size_t PAGE_SIZE>
   static bool ApplyOneLog(Page *page, const LogEntry &log);
 
   void SetSaveLogs(bool save) {
     save_logs_ = save;
   }
 
-  void SaveLogs();
+  // 使用n个线程apply日志，buffer pool也会被分成n个分片，每个线程优先处理自己分片中的page
+  void SetApplyThreads(uint32_t n) {
+    buffer_pool.Partition(n);
+    worker_stats_.assign(n, ApplyStats());
+  }
+
+  // 最多同时有n个预读请求，0表示不预读
+  void SetPrefetchDepth(uint32_t n) {
+    buffer_pool.SetPrefetchDepth(n);
+  }
+
+  // buffer pool的大小，单位是MB，按照chunk向上取整
+  bool SetBufferPoolSize(uint64_t size_mb);
+
+  // apply的过程中每隔一秒检查一次这个文件，里面的数字（单位是MB）变了就调整buffer pool的大小，
+  // 不需要重启就可以跟着机器的内存压力调整
+  void SetBufferPoolSizeFile(const std::string &path) {
+    buffer_pool_size_path_ = path;
+  }
+
+  // 读写表空间文件时绕过page cache
+  void SetDirectIO(bool direct) {
+    buffer_pool.SetDirectIO(direct);
+  }
+
+  // 校验从磁盘读上来的page，校验失败的page上的日志不会被apply
+  void SetPageValidation(bool enabled) {
+    buffer_pool.SetPageValidation(enabled);
+  }
+
+  // 写回脏page时先写doublewrite文件，防止崩溃时表空间文件中的page只写了一半，默认关闭
+  void SetDoublewrite(bool enabled) {
+    buffer_pool.SetDoublewrite(enabled);
+  }
+
+  // 最多同时打开n个表空间文件，0表示不限制
+  void SetOpenFilesLimit(uint32_t n) {
+    buffer_pool.GetSpaceRegistry().SetOpenFilesLimit(n);
+  }
+
+  // 遇到不认识的space_id时用n个线程扫描数据目录
+  void SetSpaceScanThreads(uint32_t n) {
+    buffer_pool.GetSpaceRegistry().SetScanThreads(n);
+  }
+
+  // buffer pool的替换策略，对比不同策略时在同一段redo log上分别运行，比较hit_ratio
+  void SetReplacementPolicy(ReplacementPolicy policy) {
+    buffer_pool.SetReplacementPolicy(policy);
+  }
+
+  // 把buffer pool的内存锁住，不会被换出
+  bool LockBufferPool() {
+    return buffer_pool.LockFrames();
+  }
+
+  // 后台刷脏线程让buffer pool的每个分片至少有n个空闲frame，0表示淘汰在前台同步进行
+  void SetFreeFrames(uint32_t n) {
+    buffer_pool.SetFlusher(n);
+  }
+
+  // 每个apply线程最多挂起n个等待读page的任务，0表示遇到不在buffer pool中的page时直接阻塞。
+  // 需要同时设置预读线程，否则读page仍然是同步的
+  void SetSuspendWindow(uint32_t n) {
+    max_suspended_tasks_ = n;
+  }
+
+  // 打印每个apply线程累计的忙碌时间和偷任务的次数
+  void ReportWorkerStats(std::ostream &os) const;
+
 private:
-  // 在恢复page时使用的哈希表
-  std::unordered_map<space_id_t, std::unordered_map<page_id_t, std::list<LogEntry>>> hash_map_;
+  // 每个apply线程自己的统计信息，线程结束之后再汇总
+  struct ApplyStats {
+    uint64_t logs_applied_ = 0;
+    uint64_t read_file_time_ = 0; // nano seconds
+    uint64_t apply_time_ = 0; // nano seconds
+    uint64_t apply_file_len_ = 0; // bytes
+    uint64_t logs_skipped_by_page_lsn_ = 0;
+    uint64_t busy_time_ = 0; // nano seconds
+    uint64_t n_tasks_ = 0;
+    uint64_t n_steals_ = 0;
+    uint64_t n_suspends_ = 0; // 因为page还没有读上来而被挂起的次数
+  };
+
+  // 第worker个apply线程apply一个page在这一批中的所有日志
+  void ApplyPage(const ApplyTask &task, uint32_t worker, ApplyStats &stats) const;
+
+  // page在第worker个apply线程自己的分片中时只pin不加锁，偷来的page加写锁
+  static PageGuard GuardPage(Page *page, uint32_t worker, const ApplyTask &task);
+
+  // 把日志apply到guard管理的page上（加了写锁，或者在自己的分片中只pin住），修改过的page在guard释放时变成脏页
+  template <size_t PAGE_SIZE>
+  void ApplyLogsToPage(const ApplyTask &task, PageGuard &guard, ApplyStats &stats) const;
+
+  // 挂起模式下的apply线程：page不在buffer pool中时不阻塞，挂起这个任务先做别的page，
+  // 等page读上来之后再恢复
+  void RunSuspendableWorker(WorkStealingScheduler &scheduler, uint32_t worker, ApplyStats &stats) const;
+
+  // 表空间级别的DDL日志（MLOG_FILE_DELETE、MLOG_TRUNCATE）
+  struct SpaceOperation {
+    space_id_t space_id_;
+    lsn_t lsn_;
+    bool is_delete_; // true: MLOG_FILE_DELETE, false: MLOG_TRUNCATE
+  };
+
+  // 解析好的一批日志
+  struct LogBatch {
+    // 在恢复page时使用的哈希表，每个page的日志按照解析顺序追加，因此天然按照LSN有序，可以二分查找
+    std::unordered_map<space_id_t, std::unordered_map<page_id_t, std::vector<LogEntry>>> hash_map_;
+
+    // 这批日志中的表空间DDL，在apply这一批日志之前同步到buffer pool
+    std::vector<SpaceOperation> space_ops_;
+
+    // 这批日志所在的parse buffer，apply完之前不能被覆盖
+    unsigned char *buf_ = nullptr;
+
+    // 这一批最后一条日志之后的LSN和data offset
+    lsn_t end_lsn_ = 0;
+    uint64_t end_offset_ = 0;
+  };
+
+  // 解析出来但还没有加入哈希表的一条日志，所在的MTR完整之后才会加入
+  struct ParsedLog {
+    LOG_TYPE type_;
+    space_id_t space_id_;
+    page_id_t page_id_;
+    lsn_t lsn_;
+    uint32_t len_;
+    byte *rec_ptr_;
+    byte *body_ptr_;
+  };
+
+  // 一条属于完整MTR的日志：加入哈希表，写索引和汇总文件。mtr_end表示它是MTR的最后一条日志
+  void CommitLog(const ParsedLog &log, bool mtr_end);
+
+  // 解析在单独的线程中进行
+  void RunPipelined();
+
+  // 这一批日志解析完了，交给apply线程；剩下没有解析完的日志移动到下一个batch的buffer中。
+  // end_lsn和end_offset是这一批最后一条日志之后的LSN和data offset
+  void FinishBatch(const byte *leftover, uint32_t leftover_len, lsn_t end_lsn, uint64_t end_offset);
+
+  // 写回buffer pool中的所有page并fsync，然后原子地持久化applied_lsn_和applied_offset_
+  void MakeCheckpoint();
+
+  // 把MLOG_FILE_NAME、MLOG_FILE_CREATE2、MLOG_FILE_RENAME2中的文件名加入表空间的映射
+  void RegisterSpaceFile(LOG_TYPE type, space_id_t space_id, const byte *body_ptr);
+
+  // 告诉buffer pool这一批和下一批（流水线模式下已经解析好的话）日志要用到的page，LOG_AWARE策略使用
+  void SetFutureReferences(const WorkStealingScheduler &scheduler);
+
+  // 取出最早解析好的batch，流水线模式下没有时会等待
+  LogBatch *TakeBatch();
+
+  // batch已经apply完了，parse buffer可以被重新使用
+  void ReleaseBatch(LogBatch *batch);
+
+  // 读取buffer_pool_size_path_，大小变了就调整buffer pool
+  void CheckBufferPoolSize();
+
+  // 把一批日志按照表分别保存到文件中
+  void SaveLogs(const LogBatch &batch);
+
+  // 丢弃正在解析和等待apply的batch中某个表空间所有还没有apply的日志，返回丢弃的日志条数
+  size_t DiscardSpaceLogs(space_id_t space_id);
+
+  // 丢弃一个batch的哈希表中某个表空间的日志
+  static size_t DiscardSpaceLogs(LogBatch &batch, space_id_t space_id);
+
+  // 把一条完整的日志加入哈希表，rec_ptr指向日志的开头，body_ptr指向log body
+  void AddLog(LOG_TYPE type, space_id_t space_id, page_id_t page_id,
+              lsn_t lsn, uint32_t len, byte *rec_ptr, byte *body_ptr);
+
+  // 重启之后根据索引里记录的文件偏移量直接读取日志填充哈希表，不需要重新解析
+  bool ReplayIndexedLogs();
+
+  // 从redo log文件中读取data offset开始的len个字节，跳过block的头和尾
+  bool ReadLogData(uint64_t data_offset, uint32_t len, byte *buf);
+
+  // 下一次PopulateHashMap从data offset处开始解析
+  void SeekToDataOffset(uint64_t data_offset);
 
   // parse buffer size in bytes
   uint32_t parse_buf_size_;
 
-  // 左半边与右半边组成一个双buffer，防止某一个buffer中的log还没有被apply就被覆盖了
+  // 被分成batches_.size()段，每一个batch使用其中一段，防止某一个buffer中的log还没有被apply就被覆盖了
   unsigned char *parse_buf_;
 
-  // 存放log block中掐头去尾后的redo日志，这些日志必须是完整的MTR，指向双buffer中的某一个
+  // 存放log block中掐头去尾后的redo日志，这些日志必须是完整的MTR，指向正在解析的batch的buffer
   unsigned char *parse_buf_ptr_;
 
+  // 环形使用的batch，同一时间最多一个正在解析，其余的正在等待apply或者正在apply
+  std::vector<LogBatch> batches_;
+
+  // 正在解析的batch
+  uint32_t parse_batch_idx_;
+
+  // 下面这些成员被pipeline_latch_保护
+  std::mutex pipeline_latch_;
+  std::condition_variable pipeline_cv_;
+  // 已经解析好、等待apply的batch，按照LSN从小到大排列
+  std::deque<LogBatch *> ready_batches_;
+  // 已经解析好但还没有apply完的batch的个数
+  uint32_t n_busy_batches_;
+  // 解析在单独的线程中进行
+  bool pipelined_;
+  // 所有的日志都已经解析完了
+  bool parse_finished_;
+
   // parse buffer中有效日志的长度
   uint32_t parse_buf_content_size_;
 
+  // parse_buf_ptr_[0]在redo log中的data offset（去掉了block的头和尾之后的偏移量）
+  uint64_t parse_buf_data_offset_;
+
+  // 下一次填充parse buffer之后，开头需要跳过的字节数，从某个data offset恢复解析时使用
+  uint32_t parse_skip_len_;
+
   // meta buffer size in bytes
   uint32_t meta_data_buf_size_;
 
@@ -67,7 +300,7 @@ private:
   int next_fetch_block_;
 
   uint32_t log_max_page_id_;
-  // 产生的所有日志都已经apply完了
+  // 已经读到了redo log中最后一个写满的block，不再继续解析
   bool finished_;
 
   // 下一条日志的LSN
@@ -84,6 +317,50 @@ private:
   std::ofstream table_ofs_; // 分别对每张表保存其log文件
   bool save_logs_;
 
+  // 解析过的日志的二进制索引，重启时用来跳过已经解析过的日志，不受save_logs_影响
+  std::string log_index_path_;
+  LogIndex log_index_;
+
+  // 重启之后还需要从索引中重放的日志区间[replay_cursor_, replay_end_)
+  uint64_t replay_cursor_;
+  uint64_t replay_end_;
+
+  // applier的checkpoint文件
+  std::string applier_checkpoint_path_;
+  // LSN小于applied_lsn_的日志都已经apply了，applied_offset_是它在redo log中的data offset
+  lsn_t applied_lsn_;
+  uint64_t applied_offset_;
+  // checkpoint的间隔，单位是秒
+  uint32_t checkpoint_interval_;
+  std::chrono::steady_clock::time_point last_checkpoint_time_;
+
+  // 正在解析的MTR中已经解析出来的日志
+  std::vector<ParsedLog> mtr_logs_;
+
+  // 只apply到这个LSN为止，0表示没有限制
+  lsn_t target_lsn_;
+  // 已经遇到了结束位置超过target_lsn_的MTR，不再继续解析
+  bool target_reached_;
+
+  // 控制buffer pool大小的文件，空表示不检查
+  std::string buffer_pool_size_path_;
+  // 上一次从文件中读到的大小，单位是MB
+  uint64_t buffer_pool_size_mb_;
+  std::chrono::steady_clock::time_point last_size_check_time_;
+
+  // 每个apply线程最多挂起的任务数
+  uint32_t max_suspended_tasks_;
+
+  // 和数据目录的page大小对应的ApplyLogsToPage，启动时选好，apply的过程中page大小都是编译期常量
+  void (ApplySystem::*apply_logs_to_page_)(const ApplyTask &task, PageGuard &guard, ApplyStats &stats) const;
+
+  // 同样按照page大小选好的ParseSingleLogRecord，解析时检查日志中的页内偏移量
+  uint32_t (*parse_single_log_record_)(LOG_TYPE &type, const byte *ptr, const byte *end_ptr,
+                                       space_id_t &space_id, page_id_t &page_id, byte **body);
+
+  // 每个apply线程从启动到现在累计的统计信息
+  std::vector<ApplyStats> worker_stats_{};
+
   // 遇到MLOG_INIT_FILE_PAGE2类型的日志，才可以apply
   std::unordered_map<space_id_t, std::unordered_map<page_id_t, bool>> can_apply_{};
 };
@@ -3,6 +3,9 @@
 #include <vector>
 #include <memory>
 #include <cassert>
+#include <cstring>
+#include <type_traits>
+#include <utility>
 namespace Lemon {
 
 // 一条redo log
@@ -25,6 +28,137 @@ public:
 };
 class RecordInfo;
 
+/**
+ * 每个线程缓存的一组有MAX个元素的数组。SmallArray溢出时从这里拿，析构时放回来，
+ * 一个线程同时用到的溢出数组都分配过一次之后，再拷贝宽的record也不会分配内存
+ */
+template <typename T, uint32_t MAX>
+class SpillCache {
+public:
+  static T *Get() {
+    std::vector<T *> &blocks = Blocks();
+    if (blocks.empty()) {
+      return new T[MAX];
+    }
+    T *block = blocks.back();
+    blocks.pop_back();
+    return block;
+  }
+
+  // 可以放回别的线程拿出来的数组
+  static void Put(T *block) {
+    Blocks().push_back(block);
+  }
+
+private:
+  struct FreeList {
+    std::vector<T *> blocks_;
+    ~FreeList() {
+      for (T *block: blocks_) {
+        delete[] block;
+      }
+    }
+  };
+
+  static std::vector<T *> &Blocks() {
+    static thread_local FreeList free_list;
+    return free_list.blocks_;
+  }
+};
+
+/**
+ * 前N个元素直接存放在对象内部的数组，超过N个时整体搬到SpillCache中有MAX个元素的数组，不会再变大。
+ * 构造、clear和resize都不初始化元素，拷贝时只拷贝用到的前size()个元素，元素很少的时候很便宜。
+ * 只能存放可以直接memcpy的类型
+ */
+template <typename T, uint32_t N, uint32_t MAX>
+class SmallArray {
+  static_assert(N <= MAX, "inline capacity exceeds MAX");
+  static_assert(std::is_trivially_copyable<T>::value, "SmallArray only holds trivially copyable types");
+public:
+  // 用户提供的构造函数，值初始化时也不会把内联的数组清零
+  SmallArray() {}
+
+  SmallArray(const SmallArray &other) {
+    reserve(other.size_);
+    size_ = other.size_;
+    std::memcpy(data_, other.data_, size_ * sizeof(T));
+  }
+
+  SmallArray &operator=(const SmallArray &other) {
+    if (this != &other) {
+      size_ = 0;
+      reserve(other.size_);
+      size_ = other.size_;
+      std::memcpy(data_, other.data_, size_ * sizeof(T));
+    }
+    return *this;
+  }
+
+  ~SmallArray() {
+    if (data_ != inline_) {
+      SpillCache<T, MAX>::Put(data_);
+    }
+  }
+
+  uint32_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  uint32_t capacity() const {
+    return capacity_;
+  }
+
+  void clear() {
+    size_ = 0;
+  }
+
+  // 内联的数组不够时换成SpillCache中的数组，已有的元素搬过去
+  void reserve(uint32_t n) {
+    if (n <= capacity_) {
+      return;
+    }
+    assert(n <= MAX);
+    T *spill = SpillCache<T, MAX>::Get();
+    std::memcpy(spill, data_, size_ * sizeof(T));
+    data_ = spill;
+    capacity_ = MAX;
+  }
+
+  // 新增的元素没有初始化
+  void resize(uint32_t n) {
+    reserve(n);
+    size_ = n;
+  }
+
+  template <typename... Args>
+  void emplace_back(Args &&... args) {
+    if (size_ == capacity_) {
+      reserve(MAX);
+    }
+    data_[size_++] = T(std::forward<Args>(args)...);
+  }
+
+  T &operator[](uint32_t i) {
+    assert(i < size_);
+    return data_[i];
+  }
+
+  const T &operator[](uint32_t i) const {
+    assert(i < size_);
+    return data_[i];
+  }
+private:
+  uint32_t size_ = 0;
+  uint32_t capacity_ = N;
+  T *data_ = inline_; // 指向inline_或者堆上的数组
+  T inline_[N];
+};
+
 
 class FieldInfo {
 public:
@@ -80,13 +214,20 @@ public:
   uint32_t GetNOffset(uint32_t n) const;
 private:
 
+  // 不超过这么多列的record，fields_和offsets_都放在对象内部，更多的列用线程缓存的数组
+  static constexpr uint32_t INLINE_FIELDS = 32;
+  // offsets_的元素：header、列数、每一列，再加上node pointer
+  static constexpr uint32_t INLINE_OFFSETS = REC_OFFS_HEADER_SIZE + 1 + INLINE_FIELDS + 1;
+  static constexpr uint32_t MAX_OFFSETS = REC_OFFS_HEADER_SIZE + 1 + REC_MAX_N_FIELDS + 1;
+
   byte *rec_ptr_ = nullptr; // 这条record的地址
   uint32_t n_fields_{}; // 有多少列，包括系统的隐藏列
   uint32_t n_unique_{};
   uint32_t n_nullable_{}; // 有多少列可以为null
   uint32_t index_type_{}; // index type
-  std::vector<FieldInfo> fields_{};
-  std::vector<uint32_t> offsets_{}; // 每一个column的偏移量
+  // 计算偏移量和拷贝RecordInfo时都不会分配内存，宽的record第一次用到线程缓存的数组时除外
+  SmallArray<FieldInfo, INLINE_FIELDS, REC_MAX_N_FIELDS> fields_;
+  SmallArray<uint32_t, INLINE_OFFSETS, MAX_OFFSETS> offsets_; // 每一个column的偏移量
 };
 
 class UpdateInfo {
@@ -1,7 +1,7 @@
 #pragma once
 #include <cstdint>
 #include <unordered_map>
-#include <list>
+#include <unordered_set>
 #include <memory>
 #include "utility.h"
 #include <string>
@@ -9,34 +9,84 @@
 #include <fstream>
 #include <vector>
 #include <cstring>
+#include <cstdlib>
 #include "config.h"
+#include "frame_arena.h"
+#include "rw_latch.h"
+#include "data_file.h"
+#include "space_registry.h"
+#include "doublewrite.h"
+#include "page_layout.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <map>
+#include <atomic>
 namespace Lemon {
 
-class PageAddress {
+// page在buffer pool中的key，高32位是space_id，低32位是page_id
+using page_key_t = uint64_t;
+
+inline page_key_t MakePageKey(space_id_t space_id, page_id_t page_id) {
+  return (static_cast<page_key_t>(space_id) << 32) | page_id;
+}
+
+// 一个frame的元数据，每个frame独占一个cache line，不同线程访问相邻的frame时不会互相干扰
+class alignas(CACHE_LINE_SIZE) FrameDescriptor {
 public:
-  bool in_lru_; // 该page是否在LRU中
+  page_key_t key_; // frame中page的key
   space_id_t space_id_;
   page_id_t page_id_;
+  uint32_t pin_count_; // 正在使用这个page的线程数，大于0时不能被淘汰
+  uint32_t n_waiters_; // 在io_cv_上等这个frame的I/O完成、还没有pin住它的线程数，大于0时不能被淘汰
+  bool valid_; // frame中有page，不在free list中
+  bool ref_; // CLOCK的引用位，page被访问时置为true，时钟指针扫过时清零
+  bool io_pending_; // 预读还没有完成，page中的数据还不能用
+  bool dirty_; // 读上来之后被修改过，还没有写回
+  lsn_t oldest_modification_; // 变脏之后第一次修改的LSN，干净的page为0
+  lsn_t newest_modification_; // 最近一次修改的LSN，干净的page为0
+  // 保护page中的数据，只有pin住之后才能加锁。持有它的时候不能再去拿分片的锁
+  RWLatch latch_;
+  uint32_t use_epoch_; // 最近一次被使用时的批次编号，LOG_AWARE使用
 };
+static_assert(sizeof(FrameDescriptor) == CACHE_LINE_SIZE, "FrameDescriptor must fill one cache line");
 
-class PageReaderWriter {
+// page key -> frame id的开放寻址哈希表，使用线性探测。
+// 所有的slot放在一段连续的内存里，容量在Init时确定，查找、插入、删除都不会分配内存。
+class PageHashTable {
 public:
-  PageReaderWriter() = default;
-  ~PageReaderWriter() {
-    if (stream_.use_count() == 0 && stream_->is_open()) {
-      stream_->close();
-    }
+  // 最多存放n个page
+  void Init(uint32_t n);
+
+  // 保证能放下n个page，容量不够时重新哈希，已有的元素不变
+  void Reserve(uint32_t n);
+
+  bool Find(page_key_t key, frame_id_t &frame_id) const;
+
+  // key不能已经存在
+  void Insert(page_key_t key, frame_id_t frame_id);
+
+  void Erase(page_key_t key);
+private:
+  static constexpr page_key_t EMPTY_KEY = ~static_cast<page_key_t>(0);
+
+  struct Slot {
+    page_key_t key_;
+    frame_id_t frame_id_;
   };
-  explicit PageReaderWriter(std::string file_name) :
-  file_name_(std::move(file_name)),
-  stream_(std::make_shared<std::fstream>(file_name, std::ios::binary | std::ios::ate | std::ios::out | std::ios::in)) {
+
+  uint64_t Bucket(page_key_t key) const {
+    return (key * 0x9E3779B97F4A7C15ULL) >> shift_;
   }
-  std::shared_ptr<std::fstream> stream_{};
-  std::string file_name_{};
+
+  std::vector<Slot> slots_{};
+  uint64_t mask_ = 0;
+  uint32_t shift_ = 64;
 };
 
 // 前置声明
@@ -51,16 +101,20 @@ public:
     FROM_BUFFER = 1, // 刚从buffer pool中被创建出来
     FROM_DISK = 2, // 从磁盘中读上来的
   };
+  // 不指向任何数据，buffer pool初始化时再指向frame
   Page();
 
-  // Copy Constructor
+  // 指向data处的一个大小为size的page，不负责释放
+  Page(byte *data, size_t size);
+
+  // Copy Constructor，拷贝出来的page有自己的数据
   Page(const Page &other);
   ~Page();
   lsn_t GetLSN() const {
     return mach_read_from_8(data_ + FIL_PAGE_LSN);
   }
   uint32_t GetCheckSum() const {
-    uint32_t checksum1 = mach_read_from_4(data_ + DATA_PAGE_SIZE - FIL_PAGE_END_LSN_OLD_CHKSUM);
+    uint32_t checksum1 = mach_read_from_4(data_ + size_ - FIL_PAGE_END_LSN_OLD_CHKSUM);
     uint32_t checksum2 = mach_read_from_4(data_ + FIL_PAGE_SPACE_OR_CHKSUM);
     assert(checksum1 == checksum2);
     return mach_read_from_4(data_ + FIL_PAGE_SPACE_OR_CHKSUM);
@@ -73,16 +127,20 @@ public:
     return mach_read_from_4(data_ + FIL_PAGE_ARCH_LOG_NO_OR_SPACE_ID);
   }
   void Reset() {
-    std::memset(data_, 0, DATA_PAGE_SIZE);
+    std::memset(data_, 0, size_);
     state_ = State::INVALID;
   }
 
-  // TODO
+  // 把checksum写到头部的FIL_PAGE_SPACE_OR_CHKSUM和尾部的FIL_PAGE_END_LSN_OLD_CHKSUM中，写回之前调用
   void WriteCheckSum(uint32_t checksum);
 
   unsigned char *GetData() const {
     return data_;
   }
+
+  size_t GetSize() const {
+    return size_;
+  }
   State GetState() {
     return state_;
   }
@@ -94,55 +152,446 @@ public:
     // 写page的lsn时，有两处地方需要写
     // 1. 头部的FIL_PAGE_LSN属性
     mach_write_to_8(FIL_PAGE_LSN + data_, lsn);
-    // 2. 尾部的FIL_PAGE_END_LSN_OLD_CHKSUM属性的后4位
-    mach_write_to_8(DATA_PAGE_SIZE
-                    - FIL_PAGE_END_LSN_OLD_CHKSUM
-                    + data_, lsn);
+    // 2. 尾部的FIL_PAGE_END_LSN_OLD_CHKSUM属性的后4位，前4位是checksum
+    mach_write_to_4(size_
+                    - FIL_PAGE_END_LSN_OLD_CHKSUM + 4
+                    + data_, static_cast<uint32_t>(lsn));
   }
 private:
   byte *data_;
+  size_t size_; // 和数据目录的page大小相同
   State state_;
+  // data_是不是自己分配的
+  bool owns_data_;
+  // 在buffer pool中的frame id，只对buffer pool中的page有意义
+  frame_id_t frame_id_;
+};
+
+// buffer pool的替换策略
+enum class ReplacementPolicy {
+  CLOCK = 0, // 只看最近有没有被访问过
+  LOG_AWARE = 1, // 根据还没有apply的日志估计page下一次被使用的时间，淘汰最晚被使用的page
+};
+
+/**
+ * pin住并加了读锁或写锁的page，析构时依次释放锁、标记脏页、unpin。
+ * apply线程处理自己分片中的page时只pin不加锁（latched_为false），仍然可以修改page。
+ * 不能拷贝，可以移动。
+ */
+class PageGuard {
+public:
+  PageGuard() = default;
+  PageGuard(BufferPool *pool, Page *page, bool exclusive, bool latched = true);
+  PageGuard(PageGuard &&other) noexcept;
+  PageGuard &operator=(PageGuard &&other) noexcept;
+  PageGuard(const PageGuard &) = delete;
+  PageGuard &operator=(const PageGuard &) = delete;
+  ~PageGuard() {
+    Release();
+  }
+
+  Page *Get() const {
+    return page_;
+  }
+  Page *operator->() const {
+    return page_;
+  }
+  explicit operator bool() const {
+    return page_ != nullptr;
+  }
+
+  // 记录这次修改的LSN范围，Release时把page标记成脏的。只有写锁才能修改page
+  void MarkDirty(lsn_t oldest_modification, lsn_t newest_modification);
+
+  void Release();
+private:
+  BufferPool *pool_ = nullptr;
+  Page *page_ = nullptr;
+  bool exclusive_ = false;
+  bool latched_ = false;
+  lsn_t oldest_modification_ = 0;
+  lsn_t newest_modification_ = 0;
 };
 
 class BufferPool {
 public:
+  friend class PageGuard;
+
+  // 构造时不读数据目录，也不分配frame，用之前必须先调用Init
   BufferPool();
   ~BufferPool();
+
+  // 从数据目录中读出page大小，用doublewrite文件修复写坏了的page，再分配size_mb大小的frame，
+  // size_mb为0时使用默认的BUFFER_POOL_SIZE个page。main解析完参数之后调用一次
+  bool Init(uint64_t size_mb);
+
+  // size_mb大小的buffer pool需要多少个chunk，向上取整，至少一个。需要在Init之后调用
+  uint64_t ChunksForSize(uint64_t size_mb) const;
+
+  // 把buffer pool平均分成n_shards个分片，每个分片有自己的时钟指针、free list、哈希表和锁。
+  // 不同分片之间互不干扰，一个分片平时只被一个apply线程访问，锁基本没有竞争。
+  // 只能在buffer pool中还没有page的时候调用。
+  void Partition(uint32_t n_shards);
+
+  // 把buffer pool调整成n_chunks个chunk，可以在apply的过程中调用。
+  // 变大时新的chunk平均分给所有分片；变小时从最后一个chunk开始，一个chunk一个chunk地
+  // 写回脏page并淘汰，被pin住的page要等它用完。
+  bool Resize(uint32_t n_chunks);
+
+  uint32_t GetChunkCount() const {
+    return n_chunks_;
+  }
+
+  // 数据目录的page大小，在Init时从系统表空间中读出来，之后不会再变
+  size_t GetPageSize() const {
+    return page_size_;
+  }
+
+  uint32_t GetShardCount() const {
+    return static_cast<uint32_t>(shards_.size());
+  }
+
+  // page属于哪个分片
+  uint32_t GetShardId(space_id_t space_id, page_id_t page_id) const {
+    uint64_t key = MakePageKey(space_id, page_id);
+    key *= 0x9E3779B97F4A7C15ULL;
+    return static_cast<uint32_t>((key >> 32) % shards_.size());
+  }
+
+  // 一次预读最多合并的page个数
+  static constexpr uint32_t PREFETCH_MAX_PAGES_PER_READ = 16;
+
   // 在buffer pool中新建一个page
   Page *NewPage(space_id_t space_id, page_id_t page_id);
 
-  // 从buffer pool中获取一个page，不存在的话从磁盘获取
+  // 从buffer pool中获取一个page，不存在的话从磁盘获取。
+  // 返回的page没有pin住，随时可能被其他线程淘汰，只能在单线程中使用
   Page *GetPage(space_id_t space_id, page_id_t page_id);
+
+  // 和GetPage一样，但是返回的page会被pin住，用完之后必须调用UnpinPage。
+  // 多个线程访问同一个分片时，被pin住的page不会被其他线程淘汰。
+  Page *FetchPage(space_id_t space_id, page_id_t page_id);
+  void UnpinPage(Page *page);
+
+  // pin住page并加读锁或写锁，guard析构时自动释放。多个线程同时访问buffer pool时使用这两个接口
+  PageGuard FetchPageRead(space_id_t space_id, page_id_t page_id);
+  PageGuard FetchPageWrite(space_id_t space_id, page_id_t page_id);
+
+  // 给已经pin住的page（比如TryFetchPage返回的page）加锁，交给guard管理
+  PageGuard LatchPage(Page *page, bool exclusive);
+
+  // 把已经pin住的page不加锁地交给guard管理，guard可以修改page。调用者必须保证没有别的线程同时读写这个page：
+  // 同一批日志中一个page只属于一个apply任务；写回只会挑没有被pin住的page，并且写的期间标记成io_pending_，
+  // 要用的线程会等它写完；FlushAll和Resize只在两批日志之间进行
+  PageGuard OwnPage(Page *page);
+
+  // page被修改过了，oldest和newest是这次修改的LSN范围。调用者需要pin住这个page
+  void MarkDirty(Page *page, lsn_t oldest_modification, lsn_t newest_modification);
+
+  // 不阻塞的FetchPage：page还在读或者需要读的时候发起异步读，设置pending并返回nullptr，
+  // 调用者稍后再来取。没有预读线程时退化成同步读。
+  Page *TryFetchPage(space_id_t space_id, page_id_t page_id, bool &pending);
+
+  // page是脏的时候写回
   bool WriteBack(space_id_t space_id, page_id_t page_id);
 
-  std::string GetFilename(space_id_t space_id) const {
-    try {
-      return space_id_2_file_name_.at(space_id).file_name_;
-    } catch (std::exception &e) {
-      return "";
-    }
+  // 把buffer pool中所有的脏page写回并fsync
+  void FlushAll();
+
+  // 写回脏page时是否先写doublewrite文件，关闭之后page可能被写坏（torn page）
+  void SetDoublewrite(bool enabled);
+
+  // 启动n_readers个预读线程，最多同时有n_readers个读请求在进行，0表示不预读
+  void SetPrefetchDepth(uint32_t n_readers);
+
+  // 异步地把不在buffer pool中的page读上来，立即返回。
+  // page按照(文件, 偏移量)排序，相邻的page合并成一次preadv；
+  // 还在读的page已经在哈希表中了，GetPage/FetchPage会等它读完。
+  void Prefetch(std::vector<std::pair<space_id_t, page_id_t>> pages);
+
+  // 把所有frame锁在物理内存中
+  bool LockFrames();
+
+  // LOG_AWARE策略每次淘汰时最多比较的frame个数
+  static constexpr uint32_t LOG_AWARE_SAMPLE_SIZE = 32;
+
+  void SetReplacementPolicy(ReplacementPolicy policy) {
+    policy_ = policy;
+  }
+
+  ReplacementPolicy GetReplacementPolicy() const {
+    return policy_;
+  }
+
+  // GetPage/FetchPage的次数和从磁盘读上来的page个数（同步读和预读），每一次读都算一次miss
+  uint64_t GetPageRequests() const {
+    return page_requests_;
+  }
+  uint64_t GetPageReads() const {
+    return sync_reads_ + prefetch_pages_;
+  }
+
+  // 每一批日志apply之前告诉buffer pool接下来会用到哪些page：current是这一批要用到的page和预计的使用顺序，
+  // next是下一批要用到的page。这一批中已经用过的page下一次使用就是在下一批了。不能和apply线程同时调用
+  void SetFutureReferences(std::unordered_map<page_key_t, uint32_t> current, std::unordered_set<page_key_t> next);
+
+  // 校验从磁盘读上来的page（checksum、头尾LSN、space_id和page_id），预读的page在预读线程中校验，
+  // 和apply重叠进行。校验失败的page被记录下来，不会放进buffer pool，也不会在上面apply日志
+  void SetPageValidation(bool enabled) {
+    validate_pages_ = enabled;
+  }
+
+  // 校验失败的page和原因
+  std::map<page_key_t, PageCheck> GetCorruptPages() const;
+
+  // 启动后台刷脏线程，让每个分片至少有free_frames个空闲frame，0表示不启动，淘汰在前台同步进行
+  void SetFlusher(uint32_t free_frames);
+
+  // 打印预读和淘汰的统计信息
+  void ReportStats(std::ostream &os) const;
+
+  // 丢弃某个表空间在buffer pool中的所有page（不写回），remove_file为true时同时删除space_id到文件的映射
+  void DropSpace(space_id_t space_id, bool remove_file);
+
+  // 重新打开所有的表空间文件，direct为true时使用O_DIRECT。需要在apply之前调用
+  void SetDirectIO(bool direct);
+
+  std::string GetFilename(space_id_t space_id) {
+    return spaces_.GetFileName(space_id);
+  }
+
+  // space_id -> 表空间文件的映射和打开的文件
+  SpaceRegistry &GetSpaceRegistry() {
+    return spaces_;
   }
 private:
-  std::list<frame_id_t> lru_list_;
+  // buffer pool的一个分片
+  class Shard {
+  public:
+    // 保护这个分片的时钟指针、free list、哈希表以及frame的元数据
+    std::mutex latch_;
+
+    // 这个分片拥有的frame，从小到大排列。每个chunk在每个分片中都有连续的一段，
+    // 后分配的chunk排在后面
+    std::vector<frame_id_t> frames_;
+
+    // CLOCK的时钟指针，指向下一个要检查的frame在frames_中的下标
+    uint32_t clock_hand_ = 0;
+
+    // page key -> frame id
+    PageHashTable page_table_;
+
+    // 空闲的frame，当作栈使用
+    std::vector<frame_id_t> free_frames_;
+
+    // 预读完成时通知等待这个分片中page的线程
+    std::condition_variable io_cv_;
+  };
+
+  // 一次合并之后的预读：从文件的page_id_开始连续读frames_.size()个page
+  struct ReadRequest {
+    space_id_t space_id_;
+    page_id_t page_id_;
+    // 读的过程中表空间被删除了，文件也要等读完才关闭
+    std::shared_ptr<DataFile> file_;
+    std::vector<frame_id_t> frames_;
+  };
+
+  // buffer pool按照chunk分配内存，frame id是chunk_id * BUFFER_POOL_CHUNK_SIZE加上在chunk中的下标
+  struct Chunk {
+    // chunk中所有frame的数据
+    FrameArena arena_;
+    // pages_[i]指向arena_中的第i个frame
+    std::unique_ptr<Page[]> pages_;
+    // frame的元数据，frames_[i]描述pages_[i]，按照cache line对齐
+    FrameDescriptor *frames_ = nullptr;
+
+    ~Chunk() {
+      std::free(frames_);
+    }
+  };
+
+  Shard &GetShard(space_id_t space_id, page_id_t page_id) {
+    return *shards_[GetShardId(space_id, page_id)];
+  }
+
+  FrameDescriptor &FrameAt(frame_id_t frame_id) const {
+    return chunks_[frame_id / BUFFER_POOL_CHUNK_SIZE]->frames_[frame_id % BUFFER_POOL_CHUNK_SIZE];
+  }
+
+  Page *PageAt(frame_id_t frame_id) const {
+    return &chunks_[frame_id / BUFFER_POOL_CHUNK_SIZE]->pages_[frame_id % BUFFER_POOL_CHUNK_SIZE];
+  }
+
+  // 释放LatchPage加的锁，由PageGuard调用
+  void UnlatchPage(Page *page, bool exclusive);
+
+  // 分配第chunk_id个chunk的内存
+  bool AllocChunk(uint32_t chunk_id);
+
+  // 把chunk中的frame平均分给所有分片，放进free list
+  void AttachChunk(uint32_t chunk_id);
+
+  // 把chunk中的frame从所有分片中拿掉，里面的page写回之后淘汰。chunk必须是每个分片中最后的一段
+  void DetachChunk(uint32_t chunk_id);
+
+  // 调用者需要持有shard.latch_，page还在读时会释放锁等待，不在buffer pool中时会释放锁同步读
+  Page *GetPageLocked(Shard &shard, std::unique_lock<std::mutex> &lock, space_id_t space_id, page_id_t page_id);
+
+  // 为预读分配一个frame并放进哈希表，page已经在buffer pool中或者没有空闲frame时返回false。
+  // 分配frame时可能释放锁
+  bool ReservePageLocked(Shard &shard, std::unique_lock<std::mutex> &lock,
+                         space_id_t space_id, page_id_t page_id, frame_id_t &frame_id);
+
+  // 从free list中取一个frame，空闲frame不够时叫醒后台刷脏线程
+  bool PopFreeFrameLocked(Shard &shard, frame_id_t &frame_id);
+
+  // 从free list中取一个frame，没有的话按照替换策略淘汰一个，所有frame都被pin住时返回false。
+  // 需要写回脏page时会释放锁，返回之后调用者要重新检查哈希表
+  bool AllocFrameLocked(Shard &shard, std::unique_lock<std::mutex> &lock, frame_id_t &frame_id);
+
+  // 按照替换策略挑一个frame淘汰。CLOCK：时钟指针往前扫，跳过被pin住的frame，引用位为true的清零，
+  // 第一个引用位为false的干净page被淘汰。只有脏page可以淘汰时，把扫过的脏page攒成一批写回，再淘汰其中一个
+  bool EvictLocked(Shard &shard, std::unique_lock<std::mutex> &lock, frame_id_t &frame_id);
+
+  // LOG_AWARE：从时钟指针开始看LOG_AWARE_SAMPLE_SIZE个没有被pin住的frame，遇到不会再被使用的page直接淘汰，
+  // 否则淘汰其中下一次使用最晚的page，近似Belady的最优替换。选中的page是脏的时候，
+  // 优先换成样本中这一批不会再用到的干净page，没有的话和样本中这一批不会再用到的脏page一起写回
+  bool EvictLogAwareLocked(Shard &shard, std::unique_lock<std::mutex> &lock, frame_id_t &frame_id);
+
+  // 没有可以淘汰的frame时，如果有frame正在读写就等它完成之后重试，否则所有frame都被pin住了，返回false
+  bool WaitForIOLocked(Shard &shard, std::unique_lock<std::mutex> &lock, bool io_pending);
+
+  // 把干净的page从哈希表中拿掉，frame直接给调用者使用
+  void EvictFrameLocked(Shard &shard, frame_id_t frame_id);
+
+  // 写回之前pin住脏page并标记成io_pending_，写完之前不能被使用；写完之后unpin，写失败的page重新标记成脏的
+  void BeginFlushLocked(frame_id_t frame_id);
+  void EndFlushLocked(frame_id_t frame_id, bool ok);
+
+  // 前台淘汰：释放分片的锁，把同一个分片中的一批脏page经过doublewrite文件写回，其中还没有人用的page都淘汰掉，
+  // 一个给调用者，其余的放进free list。一个都没有写成功时返回false；写成功了但是都被别的线程用上了时
+  // frame_id为INVALID_FRAME_ID
+  bool FlushAndEvictLocked(Shard &shard, std::unique_lock<std::mutex> &lock,
+                           std::vector<frame_id_t> &frames, frame_id_t &frame_id);
+
+  static constexpr frame_id_t INVALID_FRAME_ID = ~static_cast<frame_id_t>(0);
+
+  // 没有日志要apply的page
+  static constexpr uint64_t NO_REFERENCE = ~static_cast<uint64_t>(0);
+  // 下一批才会用到的page，比这一批中的任何page都晚
+  static constexpr uint64_t NEXT_BATCH_REFERENCE = static_cast<uint64_t>(1) << 32;
+
+  // 估计frame中的page下一次被使用的时间，越大越晚
+  uint64_t NextUse(const FrameDescriptor &frame) const;
+
+  // 把page放进frame
+  void InstallFrameLocked(Shard &shard, frame_id_t frame_id, space_id_t space_id, page_id_t page_id);
+
+  // 把frame从哈希表中拿掉，归还free list（不写回）
+  void RemoveFrameLocked(Shard &shard, frame_id_t frame_id);
+
+  // 把frame中的page写到文件中，写完之后frame变成干净的
+  bool WriteFrame(frame_id_t frame_id);
+
+  // 后台刷脏线程的主循环
+  void FlusherLoop();
+
+  // 按照CLOCK挑出每个分片中需要淘汰的page，直到空闲frame达到free_frames_target_：
+  // 干净的page直接淘汰，脏page按照(文件, 偏移量)排序之后经过doublewrite文件写回再淘汰
+  void FlushForFreeFrames();
+
+  // 把一组按照(space_id, page_id)排好序的脏page每Doublewrite::BATCH_PAGES个一批写回：
+  // 加读锁拷贝到线程私有的缓冲区，在副本上算checksum再写。
+  // ok[i]表示frames[i]是否写成功，不修改frame的元数据。返回原地写的pwritev次数
+  uint32_t WriteFrames(const std::vector<frame_id_t> &frames, std::vector<bool> &ok);
+
+  void StopFlusher();
+
+  // 把读请求交给预读线程
+  void SubmitReads(std::vector<ReadRequest> &requests);
+
+  // 预读线程的主循环
+  void ReaderLoop();
+
+  // 读请求完成，ok[i]为true的page可以被使用了，其他的page从buffer pool中拿掉
+  void CompleteRead(const ReadRequest &request, const std::vector<bool> &ok);
+
+  // 打开了校验时检查读上来的page，校验失败时记录下来并返回false
+  bool ValidatePage(space_id_t space_id, page_id_t page_id, const byte *data);
+
+  // page之前校验失败过，不再去读它
+  bool IsCorruptPage(page_key_t key) const;
+
+  void StopReaders();
+
+  // space_id -> 表空间文件，文件按需打开
+  SpaceRegistry spaces_;
+  size_t page_size_;
+  // 写回脏page之前先写到这里，防止崩溃时page只写了一半
+  Doublewrite doublewrite_;
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  // 一开始就有BUFFER_POOL_MAX_CHUNKS个位置，之后不会再扩容，前n_chunks_个chunk正在使用。
+  // 其他线程通过frame id访问chunk时不需要加锁
+  std::vector<std::unique_ptr<Chunk>> chunks_;
+  std::atomic<uint32_t> n_chunks_{0};
+  // 新分配的chunk也要锁在物理内存中
+  bool lock_frames_ = false;
+
+  // 下面这些成员被prefetch_latch_保护
+  std::mutex prefetch_latch_;
+  std::condition_variable prefetch_cv_;
+  std::deque<ReadRequest> read_queue_;
+  bool stop_readers_ = false;
+  std::vector<std::thread> readers_;
+
+  std::atomic<uint64_t> prefetch_pages_{0}; // 预读的page个数
+  std::atomic<uint64_t> prefetch_reads_{0}; // 合并之后的读请求个数
+  std::atomic<uint64_t> prefetch_failed_reads_{0};
+  std::atomic<uint64_t> prefetch_wait_time_{0}; // nano seconds，GetPage等待预读完成的时间
+  std::atomic<uint64_t> prefetch_waits_{0};
+
+  bool validate_pages_ = false;
+  // 校验失败的page，可以在持有分片的锁时加锁
+  mutable std::mutex corrupt_latch_;
+  std::map<page_key_t, PageCheck> corrupt_pages_;
+  std::atomic<uint64_t> pages_validated_{0};
+  std::atomic<uint64_t> validation_time_{0}; // nano seconds
 
-  // [space_id, page_id] -> iterator 快速定位1个page在 LRU 中的位置
-  std::unordered_map<space_id_t, std::unordered_map<page_id_t, std::list<frame_id_t>::iterator>> hash_map_;
-  Page *buffer_;
-  // 数据目录的path
-  std::string data_path_;
-  // space_id -> file name的映射表
-  std::unordered_map<uint32_t, PageReaderWriter> space_id_2_file_name_;
+  // 后台刷脏线程，flush_latch_保证刷脏过程中FlushAll、DropSpace、Resize不会同时进行
+  std::mutex flush_latch_;
+  std::mutex flusher_latch_;
+  std::condition_variable flusher_cv_;
+  bool stop_flusher_ = false;
+  std::thread flusher_;
+  uint32_t free_frames_target_ = 0;
 
-  // 指示buffer_中哪个frame是可以用的
-  std::list<frame_id_t> free_list_;
+  std::atomic<uint64_t> flusher_pages_{0}; // 后台线程写回的page个数
+  std::atomic<uint64_t> flusher_writes_{0}; // 后台线程的pwritev次数
+  std::atomic<uint64_t> flusher_time_{0}; // nano seconds，后台线程写回的时间
+  std::atomic<uint64_t> free_frame_stalls_{0}; // 前台没有空闲frame，只能自己淘汰的次数
+  std::atomic<uint64_t> foreground_flushes_{0}; // 前台淘汰时没有干净的page，自己写回一批脏page的次数
+  std::atomic<uint64_t> foreground_flush_pages_{0}; // 前台淘汰写回的page个数
+  std::atomic<uint64_t> foreground_flush_writes_{0}; // 前台淘汰的pwritev次数
 
-  std::vector<PageAddress> frame_id_2_page_address_;
-  // 按照LRU规则淘汰一些页面
-  void Evict(int n);
+  ReplacementPolicy policy_ = ReplacementPolicy::CLOCK;
+  // 下面三个成员只在apply线程都没有运行的时候修改
+  std::unordered_map<page_key_t, uint32_t> current_refs_;
+  std::unordered_set<page_key_t> next_refs_;
+  uint32_t ref_epoch_ = 0;
 
-  Page *ReadPageFromDisk(space_id_t space_id, page_id_t page_id);
+  std::atomic<uint64_t> page_requests_{0}; // GetPage/FetchPage的次数
+  std::atomic<uint64_t> sync_reads_{0}; // 同步读的page个数
 
+  std::atomic<uint64_t> clean_evictions_{0}; // 淘汰时直接丢弃的page个数
+  std::atomic<uint64_t> dirty_evictions_{0}; // 淘汰时需要写回的page个数
+  std::atomic<uint64_t> pages_written_{0}; // 写回的page个数，包括淘汰和checkpoint
 
+  // 同步读一个page，调用者需要持有shard.latch_，读的过程中会释放锁。
+  // 读完之后page在哈希表中，调用者需要重新查找；读失败或者校验失败时返回false
+  bool ReadPageFromDisk(Shard &shard, std::unique_lock<std::mutex> &lock, space_id_t space_id, page_id_t page_id);
 };
 
 extern BufferPool buffer_pool;
@@ -13,8 +13,13 @@ using roll_ptr_t = uint64_t;
 // log block size in bytes
 static constexpr size_t LOG_BLOCK_SIZE = 512;
 
-// data page size in bytes
-static constexpr size_t DATA_PAGE_SIZE = 16 * 1024; // 16KB
+// data page size in bytes，由innodb_page_size决定，启动时从系统表空间的FSP header中读出来
+static constexpr size_t UNIV_PAGE_SIZE_MIN = 4 * 1024; // 4KB
+static constexpr size_t UNIV_PAGE_SIZE_MAX = 64 * 1024; // 64KB
+static constexpr size_t UNIV_PAGE_SIZE_DEF = 16 * 1024; // 16KB，读不到FSP header时使用
+
+// 读取redo log文件时的单位，和data page size无关
+static constexpr size_t LOG_FILE_PAGE_SIZE = 16 * 1024; // 16KB
 
 static constexpr space_id_t REDO_LOG_SPACE_ID = 0xFFFFFFF0UL;
 
@@ -28,9 +33,17 @@ static constexpr lsn_t LOG_START_LSN = 8716;
 
 static constexpr uint32_t PER_LOG_FILE_SIZE = 48 * 1024 * 1204; // 48M
 
-static constexpr uint32_t N_BLOCKS_IN_A_PAGE = DATA_PAGE_SIZE / LOG_BLOCK_SIZE; // 48M
+static constexpr uint32_t N_BLOCKS_IN_A_PAGE = LOG_FILE_PAGE_SIZE / LOG_BLOCK_SIZE;
+
+static constexpr uint32_t BUFFER_POOL_SIZE = 8 * 1024; // 默认的buffer pool size in data_page_size
+
+// buffer pool按照chunk分配内存、调整大小，一个chunk有这么多个frame（128MB）
+static constexpr uint32_t BUFFER_POOL_CHUNK_SIZE = 8 * 1024;
+
+// buffer pool最多有这么多个chunk（512GB）
+static constexpr uint32_t BUFFER_POOL_MAX_CHUNKS = 4 * 1024;
 
-static constexpr uint32_t BUFFER_POOL_SIZE = 8 * 1024; // buffer pool size in data_page_size
+static constexpr size_t CACHE_LINE_SIZE = 64;
 
 enum LOG_TYPE : uint8_t {
   /** if the mtr contains only one log record for one page,
@@ -229,6 +242,8 @@ static constexpr uint32_t LOG_BLOCK_CHECKPOINT_NO	= 8;
 static constexpr uint32_t LOG_BLOCK_HDR_SIZE = 12;
 static constexpr uint32_t LOG_BLOCK_CHECKSUM = 4;
 static constexpr uint32_t	LOG_BLOCK_TRL_SIZE = 4;
+// 每个log block中真正用来存放日志的字节数
+static constexpr uint32_t LOG_BLOCK_DATA_SIZE = LOG_BLOCK_SIZE - LOG_BLOCK_HDR_SIZE - LOG_BLOCK_TRL_SIZE;
 static constexpr uint32_t LOG_CHECKPOINT_NO = 0;
 static constexpr uint32_t LOG_CHECKPOINT_LSN = 8;
 static constexpr uint32_t LOG_CHECKPOINT_OFFSET	= 16;
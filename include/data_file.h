@@ -0,0 +1,80 @@
+#pragma once
+#include "config.h"
+#include <string>
+#include <sys/types.h>
+#include <atomic>
+namespace Lemon {
+
+/**
+ * 一个表空间文件，所有的读写都是按照page的偏移量进行的pread/pwrite，没有文件指针，
+ * 多个线程可以同时读写同一个文件。偏移量使用64位计算，超过4GB的表空间也没有问题。
+ * 打开时可以选择O_DIRECT，这时读写的buffer必须按照4KB对齐（buffer pool的frame都是对齐的）。
+ * page的大小在打开时指定，一个实例中所有表空间的page大小相同。
+ */
+class DataFile {
+public:
+  DataFile() = default;
+  ~DataFile();
+  DataFile(const DataFile &) = delete;
+  DataFile &operator=(const DataFile &) = delete;
+
+  // 以读写方式打开page大小为page_size的文件，direct为true时使用O_DIRECT，文件系统不支持时退回普通的读写
+  bool Open(const std::string &file_name, bool direct, size_t page_size);
+
+  // 写过但还没有fsync的文件在关闭之前会fsync
+  void Close();
+
+  bool IsOpen() const {
+    return fd_ != -1;
+  }
+
+  bool IsDirect() const {
+    return direct_;
+  }
+
+  const std::string &GetFileName() const {
+    return file_name_;
+  }
+
+  size_t GetPageSize() const {
+    return page_size_;
+  }
+
+  // page在文件中的偏移量
+  off_t PageOffset(page_id_t page_id) const {
+    return static_cast<off_t>(static_cast<uint64_t>(page_id) * page_size_);
+  }
+
+  // 从page_id开始连续读n个page，第i个page读到bufs[i]中，n不能超过IOV_MAX。
+  // 读不满（比如超出了文件末尾）或者出错时打印错误并返回false
+  bool ReadPages(page_id_t page_id, byte *const *bufs, uint32_t n) const;
+
+  // 从page_id开始连续写n个page，第i个page的数据在bufs[i]中
+  bool WritePages(page_id_t page_id, byte *const *bufs, uint32_t n) const;
+
+  bool ReadPage(page_id_t page_id, byte *buf) const {
+    return ReadPages(page_id, &buf, 1);
+  }
+
+  bool WritePage(page_id_t page_id, byte *buf) const {
+    return WritePages(page_id, &buf, 1);
+  }
+
+  bool Sync() const;
+
+  // 有还没有fsync的写入
+  bool IsUnsynced() const {
+    return unsynced_.load(std::memory_order_relaxed);
+  }
+private:
+  // 读写都会遇到被信号打断和只读写了一部分的情况，一直重试直到全部完成
+  bool DoIO(bool write, page_id_t page_id, byte *const *bufs, uint32_t n) const;
+
+  std::string file_name_{};
+  int fd_ = -1;
+  bool direct_ = false;
+  size_t page_size_ = UNIV_PAGE_SIZE_DEF;
+  mutable std::atomic<bool> unsynced_{false};
+};
+
+}
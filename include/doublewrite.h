@@ -0,0 +1,93 @@
+#pragma once
+#include "config.h"
+#include "data_file.h"
+#include "space_registry.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <iostream>
+namespace Lemon {
+
+/**
+ * 防止page只写了一半（torn page）的doublewrite文件。
+ * 文件分成N_SLOTS个slot，每个slot的第一个page是header，记录这一批是哪些page，后面依次是这些page的内容。
+ * 一批脏page先按顺序一次写到下一个slot中并fsync，再原地写回各自的表空间文件。
+ * 表空间文件不是每一批都fsync，轮完一圈、slot要被覆盖之前才把这一圈写过的文件一起fsync，
+ * 所以没有落盘的原地写在doublewrite文件中一定有完整的副本。
+ * 启动时检查所有slot中记录的page，同一个page有多个副本时用LSN最大的那个修复表空间文件中写坏了的page。
+ */
+class Doublewrite {
+public:
+  // 一批最多有这么多个page，一次顺序写换掉最多这么多次随机写
+  static constexpr uint32_t BATCH_PAGES = 128;
+  // 表空间文件每N_SLOTS批才fsync一次
+  static constexpr uint32_t N_SLOTS = 8;
+
+  struct Entry {
+    space_id_t space_id_;
+    page_id_t page_id_;
+    std::shared_ptr<DataFile> file_;
+    byte *data_;
+    bool ok_; // 已经写回表空间文件
+  };
+
+  explicit Doublewrite(std::string path);
+  ~Doublewrite();
+  Doublewrite(const Doublewrite &) = delete;
+  Doublewrite &operator=(const Doublewrite &) = delete;
+
+  // 打开doublewrite文件，不存在时创建
+  bool Open(size_t page_size);
+
+  // 默认关闭，直接原地写。打开之后每一批多一次顺序写和fsync，并且表空间文件每N_SLOTS批要fsync一次，
+  // 原地写不能再全部留在page cache中，比不做保护慢一截
+  void SetEnabled(bool enabled) {
+    enabled_ = enabled;
+  }
+
+  // 用doublewrite文件中的副本修复表空间文件中写坏了的page，返回修复的page个数
+  uint32_t Recover(SpaceRegistry &spaces);
+
+  // 写回一批（不超过BATCH_PAGES个）按照(space_id, page_id)排好序的page，文件中相邻的page合并成一次pwritev。
+  // 写的过程中page的内容不能变，返回原地写的次数。entry的ok_表示已经写到了表空间文件中，
+  // 这时不一定已经fsync，但是在fsync之前副本不会被覆盖
+  uint32_t Write(std::vector<Entry> &entries);
+
+  void ReportStats(std::ostream &os) const;
+private:
+  static constexpr uint32_t MAGIC = 0x44574231; // "DWB1"
+  // header中各个字段的偏移量
+  static constexpr uint32_t HEADER_MAGIC = 0;
+  static constexpr uint32_t HEADER_N_PAGES = 4;
+  static constexpr uint32_t HEADER_PAGE_SIZE = 8;
+  static constexpr uint32_t HEADER_ENTRIES = 16; // 每个page占8个字节：space_id, page_id
+  // 一个slot占的page个数
+  static constexpr uint32_t SLOT_PAGES = 1 + BATCH_PAGES;
+
+  // fsync上一圈原地写过的表空间文件，之后所有的slot都可以被覆盖
+  bool SyncDataFiles();
+
+  std::string path_;
+  size_t page_size_ = 0;
+  DataFile file_;
+  // header page，按照4KB对齐
+  byte *header_ = nullptr;
+  bool enabled_ = false;
+
+  // 一次只有一批在写，下面两个成员被latch_保护
+  std::mutex latch_;
+  // 下一批写到哪个slot
+  uint32_t next_slot_ = 0;
+  // 这一圈原地写过、还没有fsync的表空间文件
+  std::vector<std::shared_ptr<DataFile>> unsynced_files_;
+
+  std::atomic<uint64_t> n_batches_{0};
+  std::atomic<uint64_t> n_pages_{0};
+  std::atomic<uint64_t> stage_time_{0}; // 写doublewrite文件并fsync的时间，nano seconds
+  std::atomic<uint64_t> write_time_{0}; // 原地写并fsync的时间，nano seconds
+  std::atomic<uint64_t> n_data_syncs_{0}; // 表空间文件fsync的次数
+};
+
+}
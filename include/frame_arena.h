@@ -0,0 +1,43 @@
+#pragma once
+#include "config.h"
+namespace Lemon {
+
+/**
+ * buffer pool中所有frame使用的一整块连续内存。
+ * 使用mmap分配，起始地址至少按照4KB对齐，每个frame也是4KB对齐的，可以直接用于O_DIRECT；
+ * 优先使用MAP_HUGETLB的大页，系统没有预留大页时退回普通的匿名映射，并通过madvise请求透明大页。
+ */
+class FrameArena {
+public:
+  FrameArena() = default;
+  ~FrameArena();
+  FrameArena(const FrameArena &) = delete;
+  FrameArena &operator=(const FrameArena &) = delete;
+
+  // 分配n_frames个frame_size大小的frame，失败时返回false
+  bool Allocate(size_t n_frames, size_t frame_size);
+
+  // 把整块内存锁在物理内存中，不会被换出
+  bool Lock();
+
+  byte *GetFrame(frame_id_t frame_id) const {
+    return addr_ + static_cast<size_t>(frame_id) * frame_size_;
+  }
+
+  bool IsHugeTLB() const {
+    return huge_tlb_;
+  }
+  bool IsLocked() const {
+    return locked_;
+  }
+private:
+  void Release();
+
+  byte *addr_ = nullptr;
+  size_t len_ = 0;
+  size_t frame_size_ = 0;
+  bool huge_tlb_ = false;
+  bool locked_ = false;
+};
+
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include "config.h"
+#include <string>
+#include <vector>
+namespace Lemon {
+
+// 索引文件的头部，放在文件的最开始，固定64字节
+struct LogIndexHeader {
+  uint32_t magic_;
+  uint32_t version_;
+  uint64_t n_entries_; // 文件中有效的entry个数
+  lsn_t parsed_lsn_; // 已经建立索引的日志的下一条日志的LSN
+  uint64_t parsed_offset_; // 下一条没有解析的日志在redo log中的data offset（去掉了block的头和尾）
+  lsn_t applied_lsn_; // LSN小于这个值的日志都已经apply并且落盘了
+  uint64_t reserved_[3];
+};
+static_assert(sizeof(LogIndexHeader) == 64, "LogIndexHeader must be 64 bytes");
+
+// 一条被解析过的redo log，固定32字节，可以直接mmap之后当成数组访问
+struct LogIndexEntry {
+  lsn_t lsn_;
+  uint64_t file_offset_; // 这条日志第一个字节在redo log文件中的偏移量
+  space_id_t space_id_;
+  page_id_t page_id_;
+  uint32_t len_; // 整条日志的长度（包括log header）
+  uint8_t type_;
+  uint8_t body_offset_; // log body相对于日志开头的偏移量，log body为空时为0
+  uint8_t flags_;
+  uint8_t reserved_;
+
+  // 这条日志是一个MTR的最后一条日志
+  static constexpr uint8_t FLAG_MTR_END = 1;
+};
+static_assert(sizeof(LogIndexEntry) == 32, "LogIndexEntry must be 32 bytes");
+
+/**
+ * 解析过的日志的二进制索引文件。
+ * 文件布局：LogIndexHeader + LogIndexEntry[n_entries_]，全部是定长的，
+ * 重启之后的applier或者分析工具可以直接mmap这个文件，不需要再次解析redo log。
+ */
+class LogIndex {
+public:
+  static constexpr uint32_t MAGIC = 0x4C494458; // "LIDX"
+  static constexpr uint32_t VERSION = 2; // 2: LogIndexEntry增加了flags_，只记录完整的MTR
+
+  LogIndex() = default;
+  ~LogIndex();
+  LogIndex(const LogIndex &) = delete;
+  LogIndex &operator=(const LogIndex &) = delete;
+
+  // 以只读方式mmap一个已有的索引文件
+  bool Load(const std::string &path);
+
+  // 打开（不存在或者损坏时重新创建）索引文件用于追加，打开时已有的entry可以通过Entries()访问
+  bool OpenForAppend(const std::string &path);
+
+  // 先缓存在内存里，Commit的时候一次性写入文件
+  void Append(const LogIndexEntry &entry) {
+    pending_.push_back(entry);
+  }
+
+  // 把缓存的entry写到文件末尾并fdatasync，然后更新头部
+  bool Commit(lsn_t parsed_lsn, uint64_t parsed_offset);
+
+  bool SetAppliedLSN(lsn_t lsn);
+
+  const LogIndexHeader &Header() const {
+    return header_;
+  }
+
+  // mmap进来的entry，只包含Load/OpenForAppend时文件中已有的部分
+  const LogIndexEntry *Entries() const {
+    return entries_;
+  }
+  uint64_t Size() const {
+    return n_mapped_;
+  }
+
+  // 第一条LSN >= lsn的entry的下标
+  uint64_t LowerBound(lsn_t lsn) const;
+
+  bool IsOpen() const {
+    return fd_ != -1;
+  }
+
+  // redo log中去掉block头尾之后的偏移量和文件偏移量之间的转换
+  static uint64_t DataOffsetToFileOffset(uint64_t data_offset);
+  static uint64_t FileOffsetToDataOffset(uint64_t file_offset);
+private:
+  bool Map(uint64_t n_entries);
+  void Close();
+  bool WriteHeader();
+
+  int fd_ = -1;
+  LogIndexHeader header_{};
+  void *map_addr_ = nullptr;
+  size_t map_len_ = 0;
+  const LogIndexEntry *entries_ = nullptr;
+  uint64_t n_mapped_ = 0;
+  std::vector<LogIndexEntry> pending_{};
+};
+
+}
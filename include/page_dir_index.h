@@ -0,0 +1,149 @@
+#pragma once
+#include "config.h"
+#include "utility.h"
+#include "record.h"
+#include <vector>
+namespace Lemon {
+
+/**
+ * 一个page的page directory的临时索引，只在apply一个page的日志时使用，每个apply线程一个。
+ * 1. 记录offset -> 拥有它的slot：page_dir_find_owner_slot原来要从最后一个slot开始线性查找，
+ *    记录很多的page上每插入/删除一条记录都是O(n)。同一个page上查找的次数达到BUILD_THRESHOLD之后才建索引，
+ *    只有一两条日志的page不需要付出建索引的代价。
+ * 2. 前驱缓存：记住某条记录的前一条记录，顺序插入（每次都插在supremum前面）和连续删除时不需要再从slot开始往后找。
+ * 索引里的内容只是提示，每次使用前都会和page上的实际内容核对，核对不上时重建或者退回原来的查找方法，
+ * 所以page被淘汰、frame被其他page复用、或者有没有维护到的修改时都不会出错。
+ * slot的增删（page_dir_split_slot、page_dir_balance_slot）会调用Renumber/Update同步修改，避免重建。
+ */
+class PageDirIndex {
+public:
+  // 同一个page上查找owner slot的次数达到这么多次之后才建索引
+  static constexpr uint32_t BUILD_THRESHOLD = 4;
+
+  // 当前线程的索引
+  static PageDirIndex &Local() {
+    static thread_local PageDirIndex index;
+    return index;
+  }
+
+  // 查找拥有offs处记录的slot，offs处的记录必须是某个slot的owner（n_owned != 0）。
+  // 还没有建索引或者page上没有这条记录时返回false，由调用者线性查找
+  template <size_t PAGE_SIZE>
+  bool FindOwnerSlot(const byte *page, uint32_t offs, uint32_t &slot_no) {
+    Switch(page);
+    if (!built_) {
+      if (++n_lookups_ < BUILD_THRESHOLD) {
+        return false;
+      }
+      Build<PAGE_SIZE>(page);
+    }
+    if (Check<PAGE_SIZE>(page, offs, slot_of_[offs])) {
+      slot_no = slot_of_[offs];
+      return true;
+    }
+    // 有没有维护到的修改（比如page被重新初始化了），重建一次
+    Build<PAGE_SIZE>(page);
+    if (Check<PAGE_SIZE>(page, offs, slot_of_[offs])) {
+      slot_no = slot_of_[offs];
+      return true;
+    }
+    return false;
+  }
+
+  // slot_no以及之后的slot都变了（插入或者删除了slot），重新记录它们拥有的记录
+  template <size_t PAGE_SIZE>
+  void Renumber(const byte *page, uint32_t slot_no) {
+    if (page != page_ || !built_) {
+      return;
+    }
+    uint32_t n_slots = GetNSlots(page);
+    for (uint32_t i = slot_no; i < n_slots; ++i) {
+      slot_of_[GetSlotRec<PAGE_SIZE>(page, i)] = static_cast<uint16_t>(i);
+    }
+  }
+
+  // slot_no指向了另一条记录
+  template <size_t PAGE_SIZE>
+  void Update(const byte *page, uint32_t slot_no) {
+    if (page != page_ || !built_) {
+      return;
+    }
+    slot_of_[GetSlotRec<PAGE_SIZE>(page, slot_no)] = static_cast<uint16_t>(slot_no);
+  }
+
+  // 查找offs处记录的前一条记录，没有缓存或者缓存已经失效时返回false
+  template <size_t PAGE_SIZE>
+  bool FindPrev(const byte *page, uint32_t offs, uint32_t &prev_offs) {
+    if (page != page_ || prev_of_ != offs || prev_offs_ == 0
+        || rec_get_next_offs<PAGE_SIZE>(page, page + prev_offs_) != offs) {
+      return false;
+    }
+    prev_offs = prev_offs_;
+    return true;
+  }
+
+  // 丢掉所有内容。开始apply一个page的日志之前，以及page被重新初始化或者一段记录被整体删除时调用
+  void Invalidate() {
+    Switch(nullptr);
+  }
+
+  // 记住offs处记录的前一条记录是prev_offs处的记录
+  void RememberPrev(const byte *page, uint32_t offs, uint32_t prev_offs) {
+    Switch(page);
+    prev_of_ = offs;
+    prev_offs_ = prev_offs;
+  }
+private:
+  // 换了一个page，之前的内容都不能用了
+  void Switch(const byte *page) {
+    if (page == page_) {
+      return;
+    }
+    page_ = page;
+    built_ = false;
+    n_lookups_ = 0;
+    prev_of_ = 0;
+    prev_offs_ = 0;
+  }
+
+  static uint32_t GetNSlots(const byte *page) {
+    return mach_read_from_2(page + PAGE_HEADER + PAGE_N_DIR_SLOTS);
+  }
+
+  template <size_t PAGE_SIZE>
+  static uint32_t GetSlotRec(const byte *page, uint32_t slot_no) {
+    return mach_read_from_2(page + PAGE_SIZE - PAGE_DIR - (slot_no + 1) * PAGE_DIR_SLOT_SIZE);
+  }
+
+  // 第slot_no个slot是不是指向offs处的记录
+  template <size_t PAGE_SIZE>
+  static bool Check(const byte *page, uint32_t offs, uint32_t slot_no) {
+    return slot_no < GetNSlots(page) && GetSlotRec<PAGE_SIZE>(page, slot_no) == offs;
+  }
+
+  template <size_t PAGE_SIZE>
+  void Build(const byte *page) {
+    if (slot_of_.size() < PAGE_SIZE) {
+      slot_of_.resize(UNIV_PAGE_SIZE_MAX);
+    }
+    uint32_t n_slots = GetNSlots(page);
+    for (uint32_t i = 0; i < n_slots; ++i) {
+      uint32_t offs = GetSlotRec<PAGE_SIZE>(page, i);
+      if (offs < PAGE_SIZE) {
+        slot_of_[offs] = static_cast<uint16_t>(i);
+      }
+    }
+    built_ = true;
+  }
+
+  const byte *page_ = nullptr;
+  bool built_ = false;
+  uint32_t n_lookups_ = 0;
+  // 记录的页内偏移量 -> 拥有它的slot，只有slot指向的记录的位置有意义
+  std::vector<uint16_t> slot_of_;
+  // 前驱缓存：prev_of_处记录的前一条记录在prev_offs_处，0表示没有
+  uint32_t prev_of_ = 0;
+  uint32_t prev_offs_ = 0;
+};
+
+}
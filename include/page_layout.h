@@ -1,7 +1,60 @@
 #pragma once
-
+#include "config.h"
+#include <string>
 namespace Lemon {
 
+// 对InnoDB支持的每一种page大小展开一次M，用来实例化和分发按照page大小特化的模板
+#define FOR_EACH_PAGE_SIZE(M) M(4 * 1024) M(8 * 1024) M(16 * 1024) M(32 * 1024) M(64 * 1024)
+
+// FIL header中flush LSN的偏移量，只有系统表空间的第一个page使用，不参与checksum的计算
+static constexpr uint32_t FIL_PAGE_FILE_FLUSH_LSN = 26;
+
+// 表空间第一个page中FSP header的位置，以及其中flags的偏移量
+static constexpr uint32_t FSP_HEADER_OFFSET = FIL_PAGE_DATA;
+static constexpr uint32_t FSP_SPACE_FLAGS = 16;
+
+// flags中page大小（PAGE_SSIZE）的位置和宽度
+static constexpr uint32_t FSP_FLAGS_POS_PAGE_SSIZE = 6;
+static constexpr uint32_t FSP_FLAGS_MASK_PAGE_SSIZE = 0xFU << FSP_FLAGS_POS_PAGE_SSIZE;
+
+/**
+ * 从FSP header的flags中解析出page大小。PAGE_SSIZE为0表示16KB，否则page大小为512 << PAGE_SSIZE。
+ * 不是支持的page大小时返回0
+ */
+size_t PageSizeFromFspFlags(uint32_t flags);
+
+/**
+ * 读取表空间文件第一个page中的FSP flags，得到这个表空间的page大小。
+ * 一个实例中所有表空间的page大小都是innodb_page_size，读系统表空间就可以了
+ */
+bool ReadPageSize(const std::string &file_name, size_t &page_size);
+
+/**
+ * page是不是只写了一半：头部FIL_PAGE_LSN的低4字节和尾部FIL_PAGE_END_LSN_OLD_CHKSUM中的LSN不一致
+ */
+bool PageIsTorn(const byte *page, size_t page_size);
+
+/**
+ * 按照innodb_checksum_algorithm=crc32计算page的checksum，和InnoDB的buf_calc_page_crc32相同：
+ * [FIL_PAGE_OFFSET, FIL_PAGE_FILE_FLUSH_LSN)和[FIL_PAGE_DATA, page_size - FIL_PAGE_END_LSN_OLD_CHKSUM)
+ * 两段的CRC-32C异或在一起
+ */
+uint32_t PageCalcChecksumCrc32(const byte *page, size_t page_size);
+
+// 从磁盘读上来的page的校验结果
+enum class PageCheck {
+  OK = 0,
+  BAD_CHECKSUM = 1, // 头部的checksum既不是crc32也不是BUF_NO_CHECKSUM_MAGIC
+  LSN_MISMATCH = 2, // 头部和尾部的LSN不一致，page只写了一半
+  ID_MISMATCH = 3, // page中的space_id或page_id和读的位置不一致
+};
+
+const char *PageCheckString(PageCheck check);
 
+/**
+ * 校验从(space_id, page_id)读上来的page：头尾的LSN一致，checksum正确，space_id和page_id和读的位置相同。
+ * 全0的page是还没有初始化过的page，认为是正确的
+ */
+PageCheck CheckPage(const byte *page, size_t page_size, space_id_t space_id, page_id_t page_id);
 
 }
@@ -5,6 +5,8 @@
 extern unsigned long long parse_body_time;
 namespace Lemon {
 
+// 下面修改page的函数都按照page大小特化，PAGE_SIZE是编译期常量，在parse.cpp中对每一种page大小实例化
+
 /** Tries to parse a single log record.
 @param[out]	type		log record type
 @param[in]	ptr		pointer to a buffer
@@ -13,6 +15,7 @@ namespace Lemon {
 @param[out]	page_no		page number
 @param[out]	body		start of log record body
 @return length of the record, or 0 if the record was not complete */
+template <size_t PAGE_SIZE>
 uint32_t
 ParseSingleLogRecord(
     LOG_TYPE &type,
@@ -32,6 +35,7 @@ ParseSingleLogRecord(
  * @param page
  * @return
  */
+template <size_t PAGE_SIZE>
 byte* ParseOrApplyNBytes(LOG_TYPE type, const byte* log_body_start_ptr, const byte*	log_body_end_ptr, byte *page);
 
 /**
@@ -41,12 +45,14 @@ byte* ParseOrApplyNBytes(LOG_TYPE type, const byte* log_body_start_ptr, const by
  * @param page 要恢复的page
  * @return
  */
+template <size_t PAGE_SIZE>
 byte* ParseOrApplyString(byte* log_body_start_ptr, const byte* log_body_end_ptr, byte* page);
 
 /**
  * Apply MLOG_COMP_PAGE_CREATE log.
  * @param page The page you want to apply.
  */
+template <size_t PAGE_SIZE>
 byte* ApplyCompPageCreate(byte* page);
 
 /**
@@ -54,6 +60,7 @@ byte* ApplyCompPageCreate(byte* page);
  * @param log
  * @param page
  */
+template <size_t PAGE_SIZE>
 bool ApplyInitFilePage2(const LogEntry &log, Page *page);
 
 /**
@@ -61,6 +68,7 @@ bool ApplyInitFilePage2(const LogEntry &log, Page *page);
  * @param log
  * @param page
  */
+template <size_t PAGE_SIZE>
 bool ApplyCompRecInsert(const LogEntry &log, Page *page);
 
 /**
@@ -68,9 +76,11 @@ bool ApplyCompRecInsert(const LogEntry &log, Page *page);
  * @param log
  * @param page
  */
+template <size_t PAGE_SIZE>
 bool ApplyCompRecClusterDeleteMark(const LogEntry &log, Page *page);
 
 
+template <size_t PAGE_SIZE>
 bool ApplyRecSecondDeleteMark(const LogEntry &log, Page *page);
 
 
@@ -79,18 +89,25 @@ bool ApplyRecSecondDeleteMark(const LogEntry &log, Page *page);
  * @param log
  * @param page
  */
+template <size_t PAGE_SIZE>
 bool ApplyCompRecUpdateInPlace(const LogEntry &log, Page *page);
 
 
+template <size_t PAGE_SIZE>
 bool ApplyCompRecSecondDeleteMark(const LogEntry &log, Page *page);
 
+template <size_t PAGE_SIZE>
 bool ApplyCompRecDelete(const LogEntry &log, Page *page);
 
+template <size_t PAGE_SIZE>
 bool ApplyCompListEndCopyCreated(const LogEntry &log, Page *page);
 
+template <size_t PAGE_SIZE>
 bool ApplyCompPageReorganize(const LogEntry &log, Page *page);
 
+template <size_t PAGE_SIZE>
 bool ApplyCompListDelete(const LogEntry &log, Page *page);
 
+template <size_t PAGE_SIZE>
 bool ApplyIBufBitmapInit(const LogEntry &log, Page *page);
 }
@@ -47,9 +47,12 @@ of a new-style record in the heap of the index page.
 uint32_t rec_get_heap_no_new(const byte*	rec);
 
 
+// 下面几个函数按照page大小特化，在record.cpp中对每一种page大小实例化
+template <size_t PAGE_SIZE>
 const byte*
 rec_get_next_ptr_const(const byte *page, const byte* rec);
 
+template <size_t PAGE_SIZE>
 byte*
 rec_get_next_ptr(const byte *page, byte* rec);
 
@@ -59,8 +62,10 @@ rec_copy(
     const RecordInfo &rec_info);
 
 // 拿到next_ptr相对于page的偏移量
+template <size_t PAGE_SIZE>
 uint32_t rec_get_next_offs(const byte* page, const byte *rec);
 
+template <size_t PAGE_SIZE>
 void
 rec_set_next_offs_new(
 /*==================*/
@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <thread>
+namespace Lemon {
+
+/**
+ * 只占4个字节的读写锁，放在frame的元数据中保护page的数据。
+ * 持有时间只有apply一个page的长度，所以拿不到锁时让出CPU重试，不会睡眠。
+ * 写者先占住写标记阻止新的读者进来，再等已有的读者退出，写者不会饿死。
+ */
+class RWLatch {
+public:
+  void RLock() {
+    while (true) {
+      uint32_t state = state_.load(std::memory_order_relaxed);
+      if ((state & WRITER) == 0
+          && state_.compare_exchange_weak(state, state + 1, std::memory_order_acquire)) {
+        return;
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  void RUnlock() {
+    state_.fetch_sub(1, std::memory_order_release);
+  }
+
+  void WLock() {
+    while (true) {
+      uint32_t state = state_.load(std::memory_order_relaxed);
+      if ((state & WRITER) == 0
+          && state_.compare_exchange_weak(state, state | WRITER, std::memory_order_acquire)) {
+        break;
+      }
+      std::this_thread::yield();
+    }
+    while (state_.load(std::memory_order_acquire) != WRITER) {
+      std::this_thread::yield();
+    }
+  }
+
+  void WUnlock() {
+    state_.store(0, std::memory_order_release);
+  }
+private:
+  static constexpr uint32_t WRITER = 1U << 31;
+
+  // 最高位是写标记，低31位是读者的个数
+  std::atomic<uint32_t> state_{0};
+};
+
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "config.h"
+#include "bean.h"
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+namespace Lemon {
+
+// 一个apply任务：一个page在这一批日志中需要apply的所有日志
+struct ApplyTask {
+  space_id_t space_id_;
+  page_id_t page_id_;
+  const std::vector<LogEntry> *logs_;
+  uint64_t cost_; // 估计的apply代价，由日志条数和日志字节数决定
+};
+
+/**
+ * apply阶段的work-stealing调度器。
+ * 每个worker有自己的任务队列，队列中的任务按照cost从大到小排序，worker总是先做最重的任务；
+ * 自己的队列空了之后，从剩余cost最大的worker那里偷最重的任务，避免一个热点page拖慢整个批次。
+ */
+class WorkStealingScheduler {
+public:
+  // 每条日志额外的固定代价，单位和日志字节数相同
+  static constexpr uint64_t COST_PER_LOG = 64;
+
+  explicit WorkStealingScheduler(uint32_t n_workers);
+
+  static uint64_t EstimateCost(const std::vector<LogEntry> &logs);
+
+  // 在Start之前把任务交给某个worker
+  void Push(uint32_t worker, const ApplyTask &task);
+
+  // 对每个worker的任务排序，之后才能调用Next
+  void Start();
+
+  // 在Start之后、worker开始取任务之前，按照每个worker队列中的顺序遍历所有任务，position是任务在队列中的下标
+  void VisitTasks(const std::function<void(uint32_t position, const ApplyTask &task)> &visit) const;
+
+  // 取下一个任务，没有任务可做时返回false；stolen表示这个任务是不是从别的worker偷来的
+  bool Next(uint32_t worker, ApplyTask &task, bool &stolen);
+
+  uint32_t GetWorkerCount() const {
+    return static_cast<uint32_t>(queues_.size());
+  }
+private:
+  class TaskQueue {
+  public:
+    std::mutex latch_;
+    std::deque<ApplyTask> tasks_;
+    std::atomic<uint64_t> remaining_cost_{0};
+  };
+
+  bool PopFront(TaskQueue &queue, ApplyTask &task);
+
+  std::vector<std::unique_ptr<TaskQueue>> queues_;
+};
+
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include "config.h"
+#include "data_file.h"
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+namespace Lemon {
+
+/**
+ * space_id -> 表空间文件的映射，以及打开的文件的LRU缓存。
+ * 映射有三个来源：上一次运行保存下来的缓存文件、redo log中的MLOG_FILE_NAME等日志、
+ * 扫描数据目录。前两个是第一次查找时加载或者解析日志时加入的，只有遇到不认识的space_id时
+ * 才会用多个线程并行扫描一次数据目录。
+ * 文件在使用时才打开，同时打开的文件数超过上限时关闭最久没有使用的文件，正在读写的文件等读写完才真正关闭。
+ */
+class SpaceRegistry {
+public:
+  SpaceRegistry(std::string data_path, std::string cache_path);
+  ~SpaceRegistry() = default;
+  SpaceRegistry(const SpaceRegistry &) = delete;
+  SpaceRegistry &operator=(const SpaceRegistry &) = delete;
+
+  // 最多同时打开n个文件，0表示不限制
+  void SetOpenFilesLimit(uint32_t n);
+
+  // 扫描数据目录时的线程数
+  void SetScanThreads(uint32_t n) {
+    scan_threads_ = n == 0 ? 1 : n;
+  }
+
+  // 之后打开的文件是否使用O_DIRECT，已经打开的文件会被关闭
+  void SetDirectIO(bool direct);
+
+  // 从系统表空间（ibdata1）的FSP header中读出page大小，没有系统表空间时读第一个能找到的表空间。
+  // 都读不到时返回0
+  size_t DetectPageSize();
+
+  // 打开的文件按照page_size读写，只能在打开任何文件之前调用
+  void SetPageSize(size_t page_size) {
+    page_size_ = page_size;
+  }
+
+  // 日志中出现的表空间文件，file_name是相对于数据目录的路径（比如./test/t1.ibd）或者绝对路径
+  void Register(space_id_t space_id, const std::string &file_name);
+
+  // 表空间被删除了
+  void Remove(space_id_t space_id);
+
+  // 表空间文件的路径，不认识的space_id返回空字符串
+  std::string GetFileName(space_id_t space_id);
+
+  // 打开表空间文件，已经打开的直接返回，找不到文件时返回nullptr
+  std::shared_ptr<DataFile> Open(space_id_t space_id);
+
+  // fsync所有打开的、写过的文件
+  void SyncAll();
+
+  // 映射有变化时原子地写回缓存文件
+  bool SaveCache();
+
+  void ReportStats(std::ostream &os) const;
+private:
+  struct OpenFile {
+    std::shared_ptr<DataFile> file_;
+    std::list<space_id_t>::iterator lru_iter_;
+  };
+
+  // 找到space_id对应的文件路径，第一次调用时加载缓存文件，不认识的space_id会触发一次目录扫描
+  bool LookupLocked(space_id_t space_id, std::string &file_name);
+
+  void LoadCacheLocked();
+
+  // 用scan_threads_个线程读取数据目录中所有还不在映射中的.ibd文件的space_id
+  void ScanLocked();
+
+  // 关闭最久没有使用的文件，直到打开的文件数小于上限
+  void EvictLocked();
+
+  void CloseLocked(space_id_t space_id);
+
+  std::string data_path_;
+  std::string cache_path_;
+
+  // 保护下面所有的成员
+  mutable std::mutex latch_;
+  std::unordered_map<space_id_t, std::string> file_names_;
+  // 从缓存文件加载的映射可能已经过时了，第一次打开时要确认文件中的space_id
+  std::unordered_set<space_id_t> unverified_;
+  bool cache_loaded_ = false;
+  bool scanned_ = false;
+  // 映射和缓存文件不一致
+  bool changed_ = false;
+
+  // 打开的文件，lru_的开头是最近使用的
+  std::unordered_map<space_id_t, OpenFile> open_files_;
+  std::list<space_id_t> lru_;
+  uint32_t open_files_limit_ = 1024;
+  uint32_t scan_threads_ = 8;
+  bool direct_ = false;
+  size_t page_size_ = UNIV_PAGE_SIZE_DEF;
+
+  std::atomic<uint64_t> n_opens_{0};
+  std::atomic<uint64_t> n_closes_{0}; // 因为超过上限而关闭的次数
+  std::atomic<uint64_t> n_scanned_files_{0};
+  std::atomic<uint64_t> scan_time_{0}; // nano seconds
+};
+
+}
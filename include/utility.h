@@ -9,6 +9,10 @@ bool TravelDirectory(const std::string &dir_path, const std::string &suffix, std
 
 const char* GetLogString(LOG_TYPE type);
 
+// 数据目录、redo log和解析结果都在这个目录下，默认是/home/lemon/mysql，可以用环境变量LEMON_MYSQL_HOME指定。
+// 测试用它把所有文件放到临时目录中
+const std::string &MysqlHome();
+
 inline uint8_t mach_read_from_1(const byte*	b) {
   return static_cast<uint8_t>(b[0]);
 }
@@ -162,4 +166,8 @@ mach_read_from_7(
 }
 
 lsn_t recv_calc_lsn_on_data_add(lsn_t lsn, uint64_t len);
+
+/** 计算buf中len个字节的CRC-32C（Castagnoli多项式），和InnoDB的ut_crc32相同。
+CPU支持SSE4.2时使用crc32指令，否则查表计算 */
+uint32_t ut_crc32(const byte *buf, size_t len);
 }
\ No newline at end of file
@@ -0,0 +1,50 @@
+#include "applier_checkpoint.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+namespace Lemon {
+
+bool ApplierCheckpoint::Load(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  bool ok = pread(fd, this, sizeof(*this), 0) == static_cast<ssize_t>(sizeof(*this))
+            && magic_ == MAGIC && version_ == VERSION;
+  close(fd);
+  if (!ok) {
+    std::cerr << "invalid applier checkpoint " << path << std::endl;
+  }
+  return ok;
+}
+
+bool ApplierCheckpoint::Store(const std::string &path) const {
+  std::string tmp_path = path + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    std::cerr << "open " << tmp_path << " failed: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  bool ok = pwrite(fd, this, sizeof(*this), 0) == static_cast<ssize_t>(sizeof(*this))
+            && fsync(fd) == 0;
+  close(fd);
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    std::cerr << "write applier checkpoint " << path << " failed: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+
+  // rename之后还要fsync所在的目录，否则崩溃之后可能还是旧的文件
+  std::string dir = path.substr(0, path.rfind('/') + 1);
+  int dir_fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+  if (dir_fd != -1) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+  return true;
+}
+
+}
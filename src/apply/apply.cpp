@@ -1,26 +1,48 @@
 #include <iostream>
 #include <thread>
 #include <cstring>
+#include <algorithm>
+#include <vector>
+#include <atomic>
 #include "apply.h"
 #include "utility.h"
 #include "buffer_pool.h"
 #include "chrono"
 #include "parse.h"
+#include "applier_checkpoint.h"
+#include "page_layout.h"
+#include "page_dir_index.h"
 namespace Lemon {
 static int logs_applied = 0;
 static unsigned long long read_file_time_in_parse = 0; // nano seconds
 static unsigned long long read_file_time_in_apply = 0; // nano seconds
 static unsigned long long apply_time = 0; // nano seconds
 static unsigned long long parse_time = 0; // nano seconds
-static unsigned long long total_time = 0; // nano seconds
+static std::atomic<unsigned long long> total_time{0}; // nano seconds，解析线程和apply线程都会累加
+static unsigned long long parse_stall_time = 0; // nano seconds，解析线程等待空闲batch的时间
+static unsigned long long apply_stall_time = 0; // nano seconds，apply线程等待解析好的batch的时间
+static unsigned long long checkpoint_time = 0; // nano seconds，做checkpoint的时间，包括写回page
+static unsigned long long n_checkpoints = 0;
 static unsigned long long apply_file_len = 0; // bytes
 static unsigned long long parse_file_len = 0; // bytes
+static unsigned long long logs_discarded_by_ddl = 0; // 因为表空间被删除或者truncate而丢弃的日志条数
+static unsigned long long logs_skipped_by_checkpoint = 0; // 解析时发现LSN不大于checkpoint_lsn而没有加入哈希表的日志条数
+static unsigned long long logs_skipped_by_page_lsn = 0; // apply时因为page更新而被二分查找跳过的日志条数
 ApplySystem::ApplySystem(bool save_logs) :
-    hash_map_(),
     parse_buf_size_(10 * 1024 * 1024), // 10M
-    parse_buf_(new unsigned char[parse_buf_size_ * 2]),
-    parse_buf_ptr_(parse_buf_),
+    parse_buf_(nullptr),
+    parse_buf_ptr_(nullptr),
+    batches_(),
+    parse_batch_idx_(0),
+    pipeline_latch_(),
+    pipeline_cv_(),
+    ready_batches_(),
+    n_busy_batches_(0),
+    pipelined_(false),
+    parse_finished_(false),
     parse_buf_content_size_(0),
+    parse_buf_data_offset_(0),
+    parse_skip_len_(0),
     meta_data_buf_size_(LOG_BLOCK_SIZE * N_LOG_METADATA_BLOCKS), // 4 blocks
     meta_data_buf_(new unsigned char[meta_data_buf_size_]),
     checkpoint_lsn_(0),
@@ -29,15 +51,50 @@ ApplySystem::ApplySystem(bool save_logs) :
     log_file_size_(static_cast<uint64_t>(1) * 1024 * 1024 * 1024), // 1GB
     next_fetch_page_id_(0),
     next_fetch_block_(-1),
-    log_max_page_id_(log_file_size_ / DATA_PAGE_SIZE),
+    log_max_page_id_(log_file_size_ / LOG_FILE_PAGE_SIZE),
     finished_(false),
     next_lsn_(LOG_START_LSN),
-    log_file_path_("/home/lemon/mysql/data/ib_logfile0"),
+    log_file_path_(MysqlHome() + "/data/ib_logfile0"),
     log_stream_(log_file_path_, std::ios::in | std::ios::binary),
     summary_ofs_(),
     table_ofs_(),
-    save_logs_(save_logs)
+    save_logs_(save_logs),
+    log_index_path_(MysqlHome() + "/parsed_logs/log_index.bin"),
+    log_index_(),
+    replay_cursor_(0),
+    replay_end_(0),
+    applier_checkpoint_path_(MysqlHome() + "/parsed_logs/applier_checkpoint"),
+    applied_lsn_(0),
+    applied_offset_(0),
+    checkpoint_interval_(60),
+    last_checkpoint_time_(std::chrono::steady_clock::now()),
+    mtr_logs_(),
+    target_lsn_(0),
+    target_reached_(false),
+    buffer_pool_size_path_(),
+    buffer_pool_size_mb_(0),
+    last_size_check_time_(std::chrono::steady_clock::now()),
+    max_suspended_tasks_(0),
+    apply_logs_to_page_(nullptr),
+    parse_single_log_record_(nullptr)
 {
+  // 默认解析和apply串行执行，仍然是双buffer
+  SetPipelineDepth(0);
+
+  // buffer pool已经从数据目录中读出了page大小，选择对应的实例
+  switch (buffer_pool.GetPageSize()) {
+#define SELECT_PAGE_SIZE(PAGE_SIZE) \
+    case PAGE_SIZE: \
+      apply_logs_to_page_ = &ApplySystem::ApplyLogsToPage<PAGE_SIZE>; \
+      parse_single_log_record_ = &ParseSingleLogRecord<PAGE_SIZE>; \
+      break;
+    FOR_EACH_PAGE_SIZE(SELECT_PAGE_SIZE)
+#undef SELECT_PAGE_SIZE
+    default:
+      std::cerr << "unsupported page size " << buffer_pool.GetPageSize() << std::endl;
+      exit(1);
+  }
+
   // 1.填充meta_data_buf
   log_stream_.read(reinterpret_cast<char *>(meta_data_buf_), meta_data_buf_size_);
 
@@ -53,9 +110,34 @@ ApplySystem::ApplySystem(bool save_logs) :
     checkpoint_lsn_ = mach_read_from_8(meta_data_buf_ + 3 * LOG_BLOCK_SIZE + LOG_CHECKPOINT_LSN);
     checkpoint_offset_ = mach_read_from_8(meta_data_buf_ + 3 * LOG_BLOCK_SIZE + LOG_CHECKPOINT_OFFSET);
   }
+  // 3.上次运行留下的checkpoint之前的日志都已经apply并且落盘了，从checkpoint开始解析
+  ApplierCheckpoint applier_checkpoint{};
+  if (applier_checkpoint.Load(applier_checkpoint_path_) && applier_checkpoint.applied_lsn_ > next_lsn_) {
+    applied_lsn_ = applier_checkpoint.applied_lsn_;
+    applied_offset_ = applier_checkpoint.applied_offset_;
+    next_lsn_ = applied_lsn_;
+    SeekToDataOffset(applied_offset_);
+    std::cout << "resume from applier checkpoint: parse from lsn " << next_lsn_ << std::endl;
+  }
+
   // 打开日志文件
   if (save_logs_) {
-    summary_ofs_.open("/home/lemon/mysql/parsed_logs/log_summary.txt");
+    summary_ofs_.open(MysqlHome() + "/parsed_logs/log_summary.txt");
+  }
+
+  // 4.如果上次运行留下了索引，已经建立索引的日志不需要再解析。
+  // 每次运行都会从applier checkpoint恢复，所以不管是否保存日志都要维护索引
+  if (log_index_.OpenForAppend(log_index_path_) && log_index_.Size() > 0) {
+    const LogIndexHeader &header = log_index_.Header();
+    lsn_t start_lsn = std::max({header.applied_lsn_, applied_lsn_, checkpoint_lsn_ + 1});
+    replay_cursor_ = log_index_.LowerBound(start_lsn);
+    replay_end_ = log_index_.Size();
+    if (header.parsed_lsn_ > next_lsn_) {
+      next_lsn_ = header.parsed_lsn_;
+      SeekToDataOffset(header.parsed_offset_);
+    }
+    std::cout << "resume from log index: " << replay_end_ - replay_cursor_
+              << " indexed logs to replay, parse from lsn " << next_lsn_ << std::endl;
   }
 }
 
@@ -70,30 +152,40 @@ bool ApplySystem::PopulateHashMap() {
 
   auto t1 = std::chrono::steady_clock::now();
 
+  if (replay_cursor_ < replay_end_) {
+    return ReplayIndexedLogs();
+  }
+
+  if (target_reached_) {
+    std::cerr << "we have parsed all redo log up to target lsn " << target_lsn_ << "." << std::endl;
+    return false;
+  }
+
+  if (finished_) {
+    std::cerr << "we have parsed all redo log written so far." << std::endl;
+    return false;
+  }
+
   if (next_fetch_page_id_ > log_max_page_id_) {
     std::cerr << "we have processed all redo log."
               << std::endl;
     return false;
   }
 
-  unsigned char buf[DATA_PAGE_SIZE];
-
-  if (!save_logs_) {
-    hash_map_.clear();
-  }
+  unsigned char buf[LOG_FILE_PAGE_SIZE];
 
   // 1.填充parse buffer
-  uint32_t end_page_id = next_fetch_page_id_ + (parse_buf_size_ - parse_buf_content_size_) / DATA_PAGE_SIZE;
-  for (; next_fetch_page_id_ < end_page_id; ++next_fetch_page_id_) {
+  uint32_t end_page_id = next_fetch_page_id_ + (parse_buf_size_ - parse_buf_content_size_) / LOG_FILE_PAGE_SIZE;
+  for (; next_fetch_page_id_ < end_page_id && !finished_; ++next_fetch_page_id_) {
 //    std::cout << "next_fetch_page_id_:" << next_fetch_page_id_ << std::endl;
     auto t2 = std::chrono::steady_clock::now();
-    log_stream_.seekg(static_cast<std::streamoff>(next_fetch_page_id_ * DATA_PAGE_SIZE));
+    log_stream_.seekg(static_cast<std::streamoff>(next_fetch_page_id_ * LOG_FILE_PAGE_SIZE));
     // 读一个Page放到buf里面去
-    log_stream_.read(reinterpret_cast<char *>(buf), DATA_PAGE_SIZE);
+    log_stream_.read(reinterpret_cast<char *>(buf), LOG_FILE_PAGE_SIZE);
     auto t3 = std::chrono::steady_clock::now();
     read_file_time_in_parse += (t3 - t2).count();
 
-    for (int block = 0; block < static_cast<int>((DATA_PAGE_SIZE / LOG_BLOCK_SIZE)); ++block) {
+    for (int block = 0; block < static_cast<int>((LOG_FILE_PAGE_SIZE / LOG_BLOCK_SIZE)) && !finished_; ++block) {
 //      std::cout << "block:" << block << std::endl;
       if (next_fetch_page_id_ == 0 && block < 4) continue; // 跳过前面4个block
       auto hdr_no = ~LOG_BLOCK_FLUSH_BIT_MASK & mach_read_from_4(buf + block * LOG_BLOCK_SIZE);
@@ -101,34 +193,13 @@ bool ApplySystem::PopulateHashMap() {
       auto first_rec = mach_read_from_2(buf + block * LOG_BLOCK_SIZE + LOG_BLOCK_FIRST_REC_GROUP);
       auto checkpoint_no = mach_read_from_4(buf + block * LOG_BLOCK_SIZE + LOG_BLOCK_CHECKPOINT_NO);
       auto checksum = mach_read_from_4(buf + block * LOG_BLOCK_SIZE + LOG_BLOCK_CHECKSUM);
-      // 这个block还没装满，不断轮询这个page的这个block，直到它被装满
+      // 这个block还没装满，已经读到了redo log的末尾，解析完已经读上来的日志之后就停下来
       if (data_len != 512) {
-        std::cout << "waiting for (page_id = "
+        std::cout << "reached the end of redo log at (page_id = "
                   << next_fetch_page_id_ << ", block = "
-                  << block << ") be filled." << std::endl;
-        std::cout << "logs_applied: " << logs_applied << std::endl;
-        std::cout << "read_file_time_in_parse: " << read_file_time_in_parse << std::endl;
-        std::cout << "read_file_time_in_apply: " << read_file_time_in_apply << std::endl;
-        std::cout << "parse_time: " << parse_time << std::endl;
-        std::cout << "parse_body_time: " << parse_body_time << std::endl;
-        std::cout << "apply_time: " << apply_time << std::endl;
-        std::cout << "total_time: " << total_time << std::endl;
-        std::cout << "parse_file_len: " << parse_file_len << std::endl;
-        std::cout << "apply_file_len: " << apply_file_len << std::endl;
-        exit(0);
-        SaveLogs();
-        unsigned char tmp_buf[DATA_PAGE_SIZE];
-        while (data_len != 512) {
-          using namespace std::chrono_literals;
-          std::this_thread::sleep_for(1s);
-
-          log_stream_.seekg(static_cast<std::streamoff>(next_fetch_page_id_ * DATA_PAGE_SIZE));
-          log_stream_.read(reinterpret_cast<char *>(tmp_buf), DATA_PAGE_SIZE);
-          data_len = mach_read_from_2(tmp_buf + block * LOG_BLOCK_SIZE + LOG_BLOCK_HDR_DATA_LEN);
-        }
-        std::cout << "(page_id = "
-                  << next_fetch_page_id_ << ", block = "
-                  << block << ") was filled." << std::endl;
+                  << block << ")." << std::endl;
+        finished_ = true;
+        break;
       }
       // 每个block的日志掐头去尾放到parse buffer中
       uint32_t len = data_len - LOG_BLOCK_HDR_SIZE - LOG_BLOCK_TRL_SIZE;
@@ -142,54 +213,506 @@ bool ApplySystem::PopulateHashMap() {
     }
   }
 
-  // 2.从parse buffer中循环解析日志，放到哈希表中
+  // 2.从parse buffer中循环解析日志，一个MTR的日志全部解析完之后才放到哈希表中
   unsigned char *end_ptr = parse_buf_ptr_ + parse_buf_content_size_;
-  unsigned char *start_ptr = parse_buf_ptr_;
+  unsigned char *start_ptr = parse_buf_ptr_ + parse_skip_len_;
+  unsigned char *parse_start_ptr = start_ptr;
+  parse_skip_len_ = 0;
+  // 当前MTR的第一条日志的位置和LSN，MTR不完整时从这里重新解析
+  unsigned char *mtr_start_ptr = start_ptr;
+  lsn_t mtr_start_lsn = next_lsn_;
+  mtr_logs_.clear();
   while (start_ptr < end_ptr) {
     uint32_t len = 0, space_id, page_id;
     LOG_TYPE	type;
     byte *log_body_ptr = nullptr;
     auto t4 = std::chrono::steady_clock::now();
-    len = ParseSingleLogRecord(type, start_ptr, end_ptr, space_id, page_id, &log_body_ptr);
+    len = parse_single_log_record_(type, start_ptr, end_ptr, space_id, page_id, &log_body_ptr);
     auto t5 = std::chrono::steady_clock::now();
     parse_time += (t5 - t4).count();
     if (len == 0) {
       break;
     }
-    // 加入哈希表
-    hash_map_[space_id][page_id].emplace_back(type, space_id, page_id,
-                                              next_lsn_, len, log_body_ptr,
-                                              start_ptr + len);
 
+    mtr_logs_.push_back({type, space_id, page_id, next_lsn_, len, start_ptr, log_body_ptr});
+    start_ptr += len;
+    next_lsn_ = recv_calc_lsn_on_data_add(next_lsn_, len);
+
+    // MLOG_SINGLE_REC_FLAG、MLOG_DUMMY_RECORD、MLOG_CHECKPOINT自己就是一个MTR，多条日志的MTR以MLOG_MULTI_REC_END结尾
+    byte first_byte = *mtr_logs_.front().rec_ptr_;
+    bool mtr_end = type == MLOG_MULTI_REC_END
+        || (mtr_logs_.size() == 1
+            && ((first_byte & MLOG_SINGLE_REC_FLAG) || type == MLOG_DUMMY_RECORD || type == MLOG_CHECKPOINT));
+    if (!mtr_end) {
+      continue;
+    }
 
-    if (save_logs_) {
-      summary_ofs_ << "lsn = " << next_lsn_ << ", type = " << GetLogString(type)
-                   << ", space_id = " << space_id << ", page_id = "
-                   << page_id << ", data_len = " << len << std::endl;
+    // 这个MTR结束的位置超过了目标LSN，这个MTR以及之后的日志都不需要了
+    if (target_lsn_ != 0 && next_lsn_ > target_lsn_) {
+      target_reached_ = true;
+      break;
     }
+    for (size_t i = 0; i < mtr_logs_.size(); ++i) {
+      CommitLog(mtr_logs_[i], i + 1 == mtr_logs_.size());
+    }
+    mtr_logs_.clear();
+    mtr_start_ptr = start_ptr;
+    mtr_start_lsn = next_lsn_;
+  }
 
+  // 没有解析完的MTR留到下一次和后面的日志一起解析
+  start_ptr = mtr_start_ptr;
+  next_lsn_ = mtr_start_lsn;
 
-    start_ptr += len;
-    parse_file_len += len;
-    next_lsn_ = recv_calc_lsn_on_data_add(next_lsn_, len);
+  // 一个MTR比整个parse buffer还大：一条都没有解析完，buffer也装不下更多的日志了，再解析一次也还是这样
+  if (start_ptr == parse_start_ptr && !finished_ && !target_reached_
+      && parse_buf_size_ - parse_buf_content_size_ < LOG_FILE_PAGE_SIZE) {
+    std::cerr << "mtr at lsn " << next_lsn_ << " is larger than the parse buffer ("
+              << parse_buf_size_ << " bytes)." << std::endl;
+    finished_ = true;
+    return false;
   }
 
+  parse_buf_data_offset_ += start_ptr - parse_buf_ptr_;
+  if (log_index_.IsOpen()) {
+    log_index_.Commit(next_lsn_, parse_buf_data_offset_);
+  }
 
-  // 把没有解析完成的日志移动到另一个缓冲区
-  parse_buf_content_size_ = end_ptr - start_ptr;
-  // 双buffer切换
-  parse_buf_ptr_ = parse_buf_ + (parse_buf_ptr_ - parse_buf_ + parse_buf_size_) % (parse_buf_size_ * 2);
-  std::memcpy(parse_buf_ptr_, start_ptr, parse_buf_content_size_);
+  // 3.把没有解析完成的日志移动到下一个batch的buffer，这一批交给apply
+  FinishBatch(start_ptr, end_ptr - start_ptr, next_lsn_, parse_buf_data_offset_);
 
   auto t4 = std::chrono::steady_clock::now();
   total_time += (t4 - t1).count();
   parse_time += (t4 - t1).count();
   return true;
 }
+
+void ApplySystem::SetPipelineDepth(uint32_t depth) {
+  assert(ready_batches_.empty() && n_busy_batches_ == 0);
+  // 一个batch正在解析，最多depth个batch等待apply或者正在apply
+  uint32_t n_batches = std::max<uint32_t>(depth, 1) + 1;
+  delete[] parse_buf_;
+  parse_buf_ = new unsigned char[static_cast<size_t>(parse_buf_size_) * n_batches];
+  batches_.clear();
+  batches_.resize(n_batches);
+  for (uint32_t i = 0; i < n_batches; ++i) {
+    batches_[i].buf_ = parse_buf_ + static_cast<size_t>(parse_buf_size_) * i;
+  }
+  parse_batch_idx_ = 0;
+  parse_buf_ptr_ = batches_[0].buf_;
+  parse_buf_content_size_ = 0;
+  pipelined_ = depth > 0;
+}
+
+void ApplySystem::FinishBatch(const byte *leftover, uint32_t leftover_len, lsn_t end_lsn, uint64_t end_offset) {
+  uint32_t next_idx = (parse_batch_idx_ + 1) % batches_.size();
+  {
+    // 等待下一个batch空闲，也就是它上一轮的日志已经apply完了
+    std::unique_lock<std::mutex> lock(pipeline_latch_);
+    auto t1 = std::chrono::steady_clock::now();
+    pipeline_cv_.wait(lock, [this]() {
+      return n_busy_batches_ + 1 < batches_.size();
+    });
+    auto t2 = std::chrono::steady_clock::now();
+    parse_stall_time += (t2 - t1).count();
+  }
+
+  LogBatch &next = batches_[next_idx];
+  next.hash_map_.clear();
+  next.space_ops_.clear();
+  std::memcpy(next.buf_, leftover, leftover_len);
+
+  // apply完这一批之后，LSN小于end_lsn_的日志都apply完了
+  LogBatch &batch = batches_[parse_batch_idx_];
+  batch.end_lsn_ = end_lsn;
+  batch.end_offset_ = end_offset;
+
+  {
+    std::lock_guard<std::mutex> guard(pipeline_latch_);
+    ready_batches_.push_back(&batch);
+    n_busy_batches_++;
+  }
+  pipeline_cv_.notify_all();
+
+  parse_batch_idx_ = next_idx;
+  parse_buf_ptr_ = next.buf_;
+  parse_buf_content_size_ = leftover_len;
+}
+
+ApplySystem::LogBatch *ApplySystem::TakeBatch() {
+  std::unique_lock<std::mutex> lock(pipeline_latch_);
+  auto t1 = std::chrono::steady_clock::now();
+  pipeline_cv_.wait(lock, [this]() {
+    return !ready_batches_.empty() || !pipelined_ || parse_finished_;
+  });
+  auto t2 = std::chrono::steady_clock::now();
+  apply_stall_time += (t2 - t1).count();
+  if (ready_batches_.empty()) {
+    return nullptr;
+  }
+  LogBatch *batch = ready_batches_.front();
+  ready_batches_.pop_front();
+  return batch;
+}
+
+void ApplySystem::SetFutureReferences(const WorkStealingScheduler &scheduler) {
+  // 每个worker按照队列的顺序apply，page在队列中的下标就是它大约什么时候被用到
+  std::unordered_map<page_key_t, uint32_t> current;
+  scheduler.VisitTasks([&current](uint32_t position, const ApplyTask &task) {
+    current.emplace(MakePageKey(task.space_id_, task.page_id_), position);
+  });
+
+  // 下一批已经解析好了的话，它用到的page比这一批的都晚
+  std::unordered_set<page_key_t> next;
+  {
+    std::lock_guard<std::mutex> guard(pipeline_latch_);
+    if (!ready_batches_.empty()) {
+      for (const auto &spaces_logs: ready_batches_.front()->hash_map_) {
+        for (const auto &pages_logs: spaces_logs.second) {
+          next.insert(MakePageKey(spaces_logs.first, pages_logs.first));
+        }
+      }
+    }
+  }
+  buffer_pool.SetFutureReferences(std::move(current), std::move(next));
+}
+
+void ApplySystem::ReleaseBatch(LogBatch *) {
+  {
+    std::lock_guard<std::mutex> guard(pipeline_latch_);
+    assert(n_busy_batches_ > 0);
+    n_busy_batches_--;
+  }
+  pipeline_cv_.notify_all();
+}
+
+void ApplySystem::SetTargetLSN(lsn_t target_lsn) {
+  target_lsn_ = target_lsn;
+  // 上次运行已经解析过目标LSN了
+  if (target_lsn_ != 0 && next_lsn_ > target_lsn_) {
+    target_reached_ = true;
+  }
+  if (replay_cursor_ >= replay_end_) {
+    return;
+  }
+  // 索引中的日志也只重放到最后一个结束位置不超过目标LSN的MTR
+  const LogIndexEntry *entries = log_index_.Entries();
+  uint64_t end = replay_cursor_;
+  for (uint64_t i = replay_cursor_; i < replay_end_; ++i) {
+    if (!(entries[i].flags_ & LogIndexEntry::FLAG_MTR_END)) {
+      continue;
+    }
+    if (recv_calc_lsn_on_data_add(entries[i].lsn_, entries[i].len_) > target_lsn_) {
+      target_reached_ = true;
+      break;
+    }
+    end = i + 1;
+  }
+  replay_end_ = end;
+}
+
+void ApplySystem::Run() {
+  if (!pipelined_) {
+    while (PopulateHashMap()) {
+      ApplyHashLogs();
+    }
+  } else {
+    RunPipelined();
+  }
+
+  // 退出之前把所有page写回，下次从这里继续。指定了目标LSN时，数据目录就是目标LSN时的状态
+  MakeCheckpoint();
+  if (target_lsn_ != 0) {
+    std::cout << "applied up to lsn " << applied_lsn_ << " (target lsn " << target_lsn_ << ")" << std::endl;
+  }
+}
+
+void ApplySystem::MakeCheckpoint() {
+  auto t1 = std::chrono::steady_clock::now();
+
+  // 1.apply线程此时没有在修改page，buffer pool中所有的修改都来自LSN小于applied_lsn_的日志
+  buffer_pool.FlushAll();
+  buffer_pool.GetSpaceRegistry().SaveCache();
+
+  // 2.page都落盘之后才能持久化applied_lsn_
+  ApplierCheckpoint applier_checkpoint{};
+  applier_checkpoint.magic_ = ApplierCheckpoint::MAGIC;
+  applier_checkpoint.version_ = ApplierCheckpoint::VERSION;
+  applier_checkpoint.applied_lsn_ = applied_lsn_;
+  applier_checkpoint.applied_offset_ = applied_offset_;
+  if (applier_checkpoint.Store(applier_checkpoint_path_)) {
+    n_checkpoints++;
+  }
+  if (log_index_.IsOpen()) {
+    log_index_.SetAppliedLSN(applied_lsn_);
+  }
+
+  auto t2 = std::chrono::steady_clock::now();
+  checkpoint_time += (t2 - t1).count();
+  last_checkpoint_time_ = t2;
+}
+
+void ApplySystem::RunPipelined() {
+  // 解析线程一直往前解析，直到流水线被填满
+  std::thread parser([this]() {
+    while (PopulateHashMap()) {
+    }
+    {
+      std::lock_guard<std::mutex> guard(pipeline_latch_);
+      parse_finished_ = true;
+    }
+    pipeline_cv_.notify_all();
+  });
+  while (ApplyHashLogs()) {
+  }
+  parser.join();
+}
+
+bool ApplySystem::SetBufferPoolSize(uint64_t size_mb) {
+  uint64_t n_chunks = buffer_pool.ChunksForSize(size_mb);
+  if (n_chunks > BUFFER_POOL_MAX_CHUNKS) {
+    std::cerr << "buffer pool size " << size_mb << "MB is too large" << std::endl;
+    return false;
+  }
+  if (n_chunks == buffer_pool.GetChunkCount()) {
+    return true;
+  }
+  std::cout << "resize buffer pool from " << buffer_pool.GetChunkCount()
+            << " to " << n_chunks << " chunks" << std::endl;
+  return buffer_pool.Resize(static_cast<uint32_t>(n_chunks));
+}
+
+void ApplySystem::CheckBufferPoolSize() {
+  std::ifstream ifs(buffer_pool_size_path_);
+  uint64_t size_mb = 0;
+  if (!(ifs >> size_mb) || size_mb == buffer_pool_size_mb_) {
+    return;
+  }
+  buffer_pool_size_mb_ = size_mb;
+  SetBufferPoolSize(size_mb);
+}
+
+void ApplySystem::ReportStats(std::ostream &os) const {
+  if (target_lsn_ != 0) {
+    os << "target_lsn: " << target_lsn_ << std::endl;
+    os << "target_reached: " << target_reached_ << std::endl;
+  }
+  os << "parsed_lsn: " << next_lsn_ << std::endl;
+  os << "applied_lsn: " << applied_lsn_ << std::endl;
+  os << "n_checkpoints: " << n_checkpoints << std::endl;
+  os << "checkpoint_time: " << checkpoint_time << std::endl;
+  os << "logs_applied: " << logs_applied << std::endl;
+  os << "read_file_time_in_parse: " << read_file_time_in_parse << std::endl;
+  os << "read_file_time_in_apply: " << read_file_time_in_apply << std::endl;
+  os << "parse_time: " << parse_time << std::endl;
+  os << "parse_body_time: " << parse_body_time << std::endl;
+  os << "apply_time: " << apply_time << std::endl;
+  os << "total_time: " << total_time << std::endl;
+  os << "parse_stall_time: " << parse_stall_time << std::endl;
+  os << "apply_stall_time: " << apply_stall_time << std::endl;
+  os << "parse_file_len: " << parse_file_len << std::endl;
+  os << "apply_file_len: " << apply_file_len << std::endl;
+  os << "logs_discarded_by_ddl: " << logs_discarded_by_ddl << std::endl;
+  os << "logs_skipped_by_checkpoint: " << logs_skipped_by_checkpoint << std::endl;
+  os << "logs_skipped_by_page_lsn: " << logs_skipped_by_page_lsn << std::endl;
+  ReportWorkerStats(os);
+  buffer_pool.ReportStats(os);
+}
+
+void ApplySystem::CommitLog(const ParsedLog &log, bool mtr_end) {
+  AddLog(log.type_, log.space_id_, log.page_id_, log.lsn_, log.len_, log.rec_ptr_, log.body_ptr_);
+
+  if (log_index_.IsOpen()) {
+    LogIndexEntry entry{};
+    entry.lsn_ = log.lsn_;
+    entry.file_offset_ = LogIndex::DataOffsetToFileOffset(parse_buf_data_offset_ + (log.rec_ptr_ - parse_buf_ptr_));
+    entry.space_id_ = log.space_id_;
+    entry.page_id_ = log.page_id_;
+    entry.len_ = log.len_;
+    entry.type_ = log.type_;
+    entry.body_offset_ = log.body_ptr_ == nullptr ? 0 : static_cast<uint8_t>(log.body_ptr_ - log.rec_ptr_);
+    entry.flags_ = mtr_end ? LogIndexEntry::FLAG_MTR_END : 0;
+    log_index_.Append(entry);
+  }
+
+  if (save_logs_) {
+    summary_ofs_ << "lsn = " << log.lsn_ << ", type = " << GetLogString(log.type_)
+                 << ", space_id = " << log.space_id_ << ", page_id = "
+                 << log.page_id_ << ", data_len = " << log.len_ << '\n';
+  }
+
+  parse_file_len += log.len_;
+}
+
+void ApplySystem::AddLog(LOG_TYPE type, space_id_t space_id, page_id_t page_id,
+                         lsn_t lsn, uint32_t len, byte *rec_ptr, byte *body_ptr) {
+  LogBatch &batch = batches_[parse_batch_idx_];
+  if ((type == MLOG_FILE_NAME || type == MLOG_FILE_CREATE2 || type == MLOG_FILE_RENAME2)
+      && body_ptr != nullptr) {
+    // 不管是否在checkpoint之前，日志中的文件名都比缓存文件和扫描的结果可靠
+    RegisterSpaceFile(type, space_id, body_ptr);
+  }
+  if (type == MLOG_FILE_DELETE || type == MLOG_TRUNCATE) {
+    // 表空间马上就要被删除或者truncate了，之前排队的日志都不需要再apply
+    logs_discarded_by_ddl += DiscardSpaceLogs(space_id);
+    batch.space_ops_.push_back({space_id, lsn, type == MLOG_FILE_DELETE});
+  } else if (lsn <= checkpoint_lsn_) {
+    // checkpoint之前的日志对应的修改已经落盘了，不需要加入哈希表
+    logs_skipped_by_checkpoint++;
+  } else {
+    // 加入哈希表
+    batch.hash_map_[space_id][page_id].emplace_back(type, space_id, page_id,
+                                                    lsn, len, body_ptr,
+                                                    rec_ptr + len);
+  }
+}
+
+void ApplySystem::RegisterSpaceFile(LOG_TYPE type, space_id_t space_id, const byte *body_ptr) {
+  // 日志的格式在解析时已经检查过了：[4 bytes flags（只有CREATE2有）][2 bytes len][name]，
+  // RENAME2的旧文件名后面还有[2 bytes len][new name]，文件名的长度包含结尾的'\0'
+  if (type == MLOG_FILE_CREATE2) {
+    body_ptr += 4;
+  }
+  uint16_t len = mach_read_from_2(body_ptr);
+  body_ptr += 2;
+  if (type == MLOG_FILE_RENAME2) {
+    body_ptr += len;
+    len = mach_read_from_2(body_ptr);
+    body_ptr += 2;
+  }
+  const char *name = reinterpret_cast<const char *>(body_ptr);
+  std::string file_name(name, strnlen(name, len));
+  if (!file_name.empty()) {
+    buffer_pool.GetSpaceRegistry().Register(space_id, file_name);
+  }
+}
+
+bool ApplySystem::ReadLogData(uint64_t data_offset, uint32_t len, byte *buf) {
+  // 一次把日志跨越的所有block都读上来，再去掉每个block的头和尾
+  uint64_t first_block = LogIndex::DataOffsetToFileOffset(data_offset) / LOG_BLOCK_SIZE;
+  uint64_t last_block = LogIndex::DataOffsetToFileOffset(data_offset + len - 1) / LOG_BLOCK_SIZE;
+  std::vector<byte> blocks((last_block - first_block + 1) * LOG_BLOCK_SIZE);
+  log_stream_.clear();
+  log_stream_.seekg(static_cast<std::streamoff>(first_block * LOG_BLOCK_SIZE));
+  log_stream_.read(reinterpret_cast<char *>(blocks.data()), static_cast<std::streamsize>(blocks.size()));
+  if (!log_stream_) {
+    std::cerr << "read indexed log at data offset " << data_offset << " failed." << std::endl;
+    return false;
+  }
+  uint32_t copied = 0;
+  uint32_t offset_in_block = data_offset % LOG_BLOCK_DATA_SIZE;
+  for (uint64_t block = 0; copied < len; ++block) {
+    uint32_t n = std::min(LOG_BLOCK_DATA_SIZE - offset_in_block, len - copied);
+    std::memcpy(buf + copied, blocks.data() + block * LOG_BLOCK_SIZE + LOG_BLOCK_HDR_SIZE + offset_in_block, n);
+    copied += n;
+    offset_in_block = 0;
+  }
+  return true;
+}
+
+bool ApplySystem::ReplayIndexedLogs() {
+  auto t1 = std::chrono::steady_clock::now();
+
+  // 一次最多重放一个parse buffer大小的日志，和正常解析一样使用batch的buffer
+  const LogIndexEntry *entries = log_index_.Entries();
+  uint32_t used = 0;
+  lsn_t end_lsn = applied_lsn_;
+  uint64_t end_offset = applied_offset_;
+  while (replay_cursor_ < replay_end_) {
+    const LogIndexEntry &entry = entries[replay_cursor_];
+    if (used + entry.len_ > parse_buf_size_) {
+      // 一条日志比整个parse buffer还大，下一批也放不下，不能一直交出空的batch
+      if (used == 0) {
+        std::cerr << "indexed log at lsn " << entry.lsn_ << " (len = " << entry.len_
+                  << ") is larger than the parse buffer (" << parse_buf_size_ << " bytes)." << std::endl;
+        replay_cursor_ = replay_end_;
+        return false;
+      }
+      break;
+    }
+    byte *rec_ptr = parse_buf_ptr_ + used;
+    if (!ReadLogData(LogIndex::FileOffsetToDataOffset(entry.file_offset_), entry.len_, rec_ptr)) {
+      replay_cursor_ = replay_end_;
+      return false;
+    }
+    byte *body_ptr = entry.body_offset_ == 0 ? nullptr : rec_ptr + entry.body_offset_;
+    AddLog(static_cast<LOG_TYPE>(entry.type_), entry.space_id_, entry.page_id_,
+           entry.lsn_, entry.len_, rec_ptr, body_ptr);
+    used += entry.len_;
+    ++replay_cursor_;
+    end_lsn = recv_calc_lsn_on_data_add(entry.lsn_, entry.len_);
+    end_offset = LogIndex::FileOffsetToDataOffset(entry.file_offset_) + entry.len_;
+  }
+
+  // 这一批交给apply，正常解析时从下一个batch的buffer开始
+  FinishBatch(nullptr, 0, end_lsn, end_offset);
+
+  auto t2 = std::chrono::steady_clock::now();
+  total_time += (t2 - t1).count();
+  return true;
+}
+
+void ApplySystem::SeekToDataOffset(uint64_t data_offset) {
+  // 从data offset所在的page开始读，page开头多读进来的部分在解析时跳过
+  next_fetch_page_id_ = LogIndex::DataOffsetToFileOffset(data_offset) / LOG_FILE_PAGE_SIZE;
+  uint64_t first_block = std::max<uint64_t>(static_cast<uint64_t>(next_fetch_page_id_) * N_BLOCKS_IN_A_PAGE,
+                                            N_LOG_METADATA_BLOCKS);
+  parse_buf_data_offset_ = (first_block - N_LOG_METADATA_BLOCKS) * LOG_BLOCK_DATA_SIZE;
+  parse_skip_len_ = data_offset - parse_buf_data_offset_;
+  parse_buf_content_size_ = 0;
+}
+
+size_t ApplySystem::DiscardSpaceLogs(space_id_t space_id) {
+  // 流水线模式下，已经解析好、还没有被apply线程取走的batch里也可能有这个表空间的日志，
+  // 它们的LSN都比DDL小，一起丢掉。已经被取走的batch正在apply，不能再修改它的哈希表，
+  // 它apply完之后才会轮到DDL所在的batch
+  std::lock_guard<std::mutex> guard(pipeline_latch_);
+  size_t n_discarded = DiscardSpaceLogs(batches_[parse_batch_idx_], space_id);
+  for (LogBatch *batch: ready_batches_) {
+    n_discarded += DiscardSpaceLogs(*batch, space_id);
+  }
+  return n_discarded;
+}
+
+size_t ApplySystem::DiscardSpaceLogs(LogBatch &batch, space_id_t space_id) {
+  auto &hash_map = batch.hash_map_;
+  auto iter = hash_map.find(space_id);
+  if (iter == hash_map.end()) {
+    return 0;
+  }
+  size_t n_discarded = 0;
+  for (const auto &pages_logs: iter->second) {
+    n_discarded += pages_logs.second.size();
+  }
+  hash_map.erase(iter);
+  return n_discarded;
+}
+
 bool ApplySystem::ApplyHashLogs() {
+  LogBatch *batch = TakeBatch();
+  if (batch == nullptr) return false;
+
   auto t1 = std::chrono::steady_clock::now();
-  if (hash_map_.empty()) return false;
-  for (const auto &spaces_logs: hash_map_) {
+
+  // 先把表空间的删除和truncate同步到buffer pool，被丢弃的页面不需要写回。
+  // 虽然在batch开始时执行，效果和在DDL的LSN处执行是一样的：
+  // 1.之前的batch已经全部apply完了，buffer pool中这个表空间的page只包含DDL之前的修改；
+  // 2.这一批和之前还没有apply的batch中，DDL之前的日志在解析时已经被DiscardSpaceLogs丢掉了，
+  //   留在哈希表中的这个表空间的日志都在DDL之后，apply到删除或者重建之后的表空间上；
+  // 3.MySQL 5.7不会重用space id，被删除的表空间不会再有MLOG_FILE_NAME、MLOG_FILE_CREATE2，
+  //   提前从表空间映射中删除不会误删后面新注册的文件。
+  // MLOG_TRUNCATE的log body是truncate时的LSN，5.7的TRUNCATE TABLE按照这个LSN把整个表空间重建
+  // （文件截断到初始大小，索引重新创建），之后用到的page都会先被重新初始化，
+  // 所以这个表空间原来所有page上的修改都作废了，整个表空间丢弃而不写回是正确的，不需要只处理某个范围
+  for (const auto &op: batch->space_ops_) {
+    buffer_pool.DropSpace(op.space_id_, op.is_delete_);
+  }
+
+  // 每个page是一个任务，先交给page所在分片对应的线程，线程空闲时再去偷别人的任务
+  uint32_t n_workers = buffer_pool.GetShardCount();
+  WorkStealingScheduler scheduler(n_workers);
+  std::vector<std::pair<space_id_t, page_id_t>> pages;
+  for (const auto &spaces_logs: batch->hash_map_) {
 
     auto space_id = spaces_logs.first;
 
@@ -198,107 +721,222 @@ bool ApplySystem::ApplyHashLogs() {
     }
 
     for (const auto &pages_logs: spaces_logs.second) {
-
       auto page_id = pages_logs.first;
+      scheduler.Push(buffer_pool.GetShardId(space_id, page_id),
+                     {space_id, page_id, &pages_logs.second,
+                      WorkStealingScheduler::EstimateCost(pages_logs.second)});
+      pages.emplace_back(space_id, page_id);
+    }
+  }
+  scheduler.Start();
+  if (buffer_pool.GetReplacementPolicy() == ReplacementPolicy::LOG_AWARE) {
+    SetFutureReferences(scheduler);
+  }
 
-//      if (!(space_id == 40 && page_id == 36)) {
-//        continue;
-//      }
+  // 整批需要的page一次性交给预读线程，apply线程用到还没读完的page时会等待
+  buffer_pool.Prefetch(std::move(pages));
 
-      // 获取需要的page
+  std::vector<ApplyStats> stats(n_workers);
+  auto worker_func = [this, &scheduler, &stats](uint32_t i) {
+    if (max_suspended_tasks_ > 0) {
+      RunSuspendableWorker(scheduler, i, stats[i]);
+      return;
+    }
+    ApplyTask task{};
+    bool stolen = false;
+    while (scheduler.Next(i, task, stolen)) {
       auto t2 = std::chrono::steady_clock::now();
-      Page *page = buffer_pool.GetPage(space_id, page_id);
+      ApplyPage(task, i, stats[i]);
       auto t3 = std::chrono::steady_clock::now();
-      read_file_time_in_apply += (t3 - t2).count();
-
-      if (page == nullptr) continue;
-
-      lsn_t page_lsn = page->GetLSN();
-//      std::cout << "space_id = " << page->GetSpaceId() << ", page_id = " << page->GetPageId() << ", page_lsn = " << page_lsn << std::endl;
-
-      for (const auto &log: pages_logs.second) {
-        lsn_t log_lsn = log.log_start_lsn_;
-//        if (log_lsn == 101831414) {
-//          int x = 0;
-//        }
-//        if (log.type_ == MLOG_INIT_FILE_PAGE2) {
-//          can_apply_[space_id][page_id] = true;
-//        } else if (log.type_ == MLOG_COMP_REC_DELETE) {
-//          can_apply_[space_id][page_id] = false;
-//        } else if (log.type_ == MLOG_COMP_LIST_START_DELETE) {
-//          can_apply_[space_id][page_id] = false;
-//        } else if (log.type_ == MLOG_INDEX_LOAD) {
-//          can_apply_[space_id][page_id] = false;
-//        } else if (log.type_ == MLOG_COMP_LIST_END_DELETE) {
-//          can_apply_[space_id][page_id] = false;
-//        } else {
-//
-//        }
-//        if (!can_apply_[space_id][page_id]) {
-//          continue;
-//        }
-        if (log_lsn <= checkpoint_lsn_) {
-          continue;
-        }
-        // skip!
-        if (page_lsn > log_lsn) {
-//          std::cout << "This page(space_id = " << space_id << ", page_id = "
-//                    << page_id << ", lsn = " << page_lsn <<") is newer than log, skip apply phase." << std::endl;
-          continue;
-        }
+      stats[i].busy_time_ += (t3 - t2).count();
+      stats[i].n_tasks_++;
+      stats[i].n_steals_ += stolen;
+    }
+  };
+  if (n_workers == 1) {
+    worker_func(0);
+  } else {
+    std::vector<std::thread> workers;
+    workers.reserve(n_workers);
+    for (uint32_t i = 0; i < n_workers; ++i) {
+      workers.emplace_back(worker_func, i);
+    }
+    for (auto &worker: workers) {
+      worker.join();
+    }
+  }
 
-//        if (log.type_ == MLOG_MULTI_REC_END) {
-//          continue;
-//        }
-//        std::cout << "Appling log(lsn = " << log_lsn <<  ", type = " << GetLogString(log.type_) << ", space_id = "
-//                  << log.space_id_ << ", page_id = " << log.page_id_ <<") to page." << std::endl;
-        auto t4 = std::chrono::steady_clock::now();
-
-        if (ApplyOneLog(page, log)) {
-          apply_file_len += log.log_len_;
-          page->WritePageLSN(log_lsn + log.log_len_);
-          page->WriteCheckSum(BUF_NO_CHECKSUM_MAGIC);
-          auto t5 = std::chrono::steady_clock::now();
-          apply_time += (t5 - t4).count();
-//          static std::ofstream ofs("/home/lemon/mysql/debug_data/redo_applier_debug", std::ios::binary | std::ios::out);
-//          ofs.write((const char *) page->GetData(), DATA_PAGE_SIZE);
-//          int fd = open("/home/lemon/fifo_redo_applier", O_WRONLY);
-//          if (fd == -1) {
-//            std::cout << "open fifo_redo_applier failed." << std::endl;
-//            exit(1);
-//          }
-//          long written = 0;
-//          while (written != DATA_PAGE_SIZE) {
-//            long ret = write(fd, page->GetData() + written, DATA_PAGE_SIZE - written);
-//            if (ret == -1) {
-//              std::cout << "write to fifo_redo_applier failed." << std::endl;
-//              exit(1);
-//            }
-//            written += ret;
-//          }
-//          close(fd);
-//          std::cout << "Success." << std::endl;
-          logs_applied++;
-        } else {
-//          std::cout << "Skip." << std::endl;
-        }
+  worker_stats_.resize(n_workers);
+  for (uint32_t i = 0; i < n_workers; ++i) {
+    const auto &worker_stats = stats[i];
+    logs_applied += worker_stats.logs_applied_;
+    read_file_time_in_apply += worker_stats.read_file_time_;
+    apply_time += worker_stats.apply_time_;
+    apply_file_len += worker_stats.apply_file_len_;
+    logs_skipped_by_page_lsn += worker_stats.logs_skipped_by_page_lsn_;
+    worker_stats_[i].busy_time_ += worker_stats.busy_time_;
+    worker_stats_[i].n_tasks_ += worker_stats.n_tasks_;
+    worker_stats_[i].n_steals_ += worker_stats.n_steals_;
+    worker_stats_[i].n_suspends_ += worker_stats.n_suspends_;
+  }
 
-//        if (log_lsn == 31203747) {
-//          buffer_pool.WriteBack(space_id, page_id);
-//        }
-//        buffer_pool.WriteBack(space_id, page_id);
+  if (save_logs_) {
+    SaveLogs(*batch);
+  }
 
-//        ofs << "type = " << GetLogString(log.index_type_)
-//            << ", space_id = " << log.space_id_ << ", page_id = "
-//            << log.page_id_ << ", data_len = " << log.log_body_len_ << ", lsn = " << log.log_start_lsn_ << std::endl;
-      }
-    }
+  // 这一批之前的日志都apply完了，到时间了就做一次checkpoint
+  applied_lsn_ = batch->end_lsn_;
+  applied_offset_ = batch->end_offset_;
+  ReleaseBatch(batch);
+  auto now = std::chrono::steady_clock::now();
+  if (checkpoint_interval_ > 0 && now - last_checkpoint_time_ >= std::chrono::seconds(checkpoint_interval_)) {
+    MakeCheckpoint();
+  }
+  if (!buffer_pool_size_path_.empty() && now - last_size_check_time_ >= std::chrono::seconds(1)) {
+    last_size_check_time_ = now;
+    CheckBufferPoolSize();
   }
+
   auto t6 = std::chrono::steady_clock::now();
   total_time += (t6 - t1).count();
   return true;
 }
 
+void ApplySystem::RunSuspendableWorker(WorkStealingScheduler &scheduler, uint32_t worker, ApplyStats &stats) const {
+  // 被挂起的任务，按照挂起的先后顺序排列，越早挂起的page越可能已经读完了
+  std::deque<ApplyTask> suspended;
+  auto run = [&stats, worker, this](const ApplyTask &task, Page *page) {
+    auto t1 = std::chrono::steady_clock::now();
+    if (page != nullptr) {
+      PageGuard guard = GuardPage(page, worker, task);
+      (this->*apply_logs_to_page_)(task, guard, stats);
+    }
+    auto t2 = std::chrono::steady_clock::now();
+    stats.busy_time_ += (t2 - t1).count();
+    stats.n_tasks_++;
+  };
+
+  ApplyTask task{};
+  bool stolen = false;
+  bool pending = false;
+  while (true) {
+    // 1.挂起的任务还不多的时候，继续取新任务，page不在buffer pool中就挂起，去做下一个
+    if (suspended.size() < max_suspended_tasks_ && scheduler.Next(worker, task, stolen)) {
+      stats.n_steals_ += stolen;
+      Page *page = buffer_pool.TryFetchPage(task.space_id_, task.page_id_, pending);
+      if (pending) {
+        suspended.push_back(task);
+        stats.n_suspends_++;
+      } else {
+        run(task, page);
+      }
+      continue;
+    }
+    if (suspended.empty()) {
+      break;
+    }
+
+    // 2.恢复所有page已经读完的任务
+    bool resumed = false;
+    for (auto iter = suspended.begin(); iter != suspended.end();) {
+      Page *page = buffer_pool.TryFetchPage(iter->space_id_, iter->page_id_, pending);
+      if (pending) {
+        ++iter;
+        continue;
+      }
+      run(*iter, page);
+      iter = suspended.erase(iter);
+      resumed = true;
+    }
+
+    // 3.一个都没有读完，只能等最早挂起的那个
+    if (!resumed) {
+      task = suspended.front();
+      suspended.pop_front();
+      auto t1 = std::chrono::steady_clock::now();
+      Page *page = buffer_pool.FetchPage(task.space_id_, task.page_id_);
+      auto t2 = std::chrono::steady_clock::now();
+      stats.read_file_time_ += (t2 - t1).count();
+      run(task, page);
+    }
+  }
+}
+
+PageGuard ApplySystem::GuardPage(Page *page, uint32_t worker, const ApplyTask &task) {
+  // 同一批日志中一个page只属于一个任务，写回的线程也不会碰被pin住的page，
+  // 所以自己分片中的page不需要加锁。偷来的page在别的线程的分片中，和其他访问这个分片的线程一样加写锁
+  if (buffer_pool.GetShardId(task.space_id_, task.page_id_) == worker) {
+    return buffer_pool.OwnPage(page);
+  }
+  return buffer_pool.LatchPage(page, true);
+}
+
+void ApplySystem::ApplyPage(const ApplyTask &task, uint32_t worker, ApplyStats &stats) const {
+  // 获取需要的page，其他线程可能同时在访问同一个分片，所以要pin住，不让它被淘汰
+  auto t2 = std::chrono::steady_clock::now();
+  Page *page = buffer_pool.FetchPage(task.space_id_, task.page_id_);
+  auto t3 = std::chrono::steady_clock::now();
+  stats.read_file_time_ += (t3 - t2).count();
+
+  if (page == nullptr) return;
+
+  PageGuard guard = GuardPage(page, worker, task);
+
+  (this->*apply_logs_to_page_)(task, guard, stats);
+}
+
+template <size_t PAGE_SIZE>
+void ApplySystem::ApplyLogsToPage(const ApplyTask &task, PageGuard &guard, ApplyStats &stats) const {
+  Page *page = guard.Get();
+  lsn_t page_lsn = page->GetLSN();
+  // page directory的临时索引只在这个page的这一批日志中有效
+  PageDirIndex::Local().Invalidate();
+
+  // 每个page的日志按LSN有序，直接跳到第一条LSN >= max(page_lsn, checkpoint_lsn_ + 1)的日志
+  const auto &logs = *task.logs_;
+  lsn_t start_lsn = std::max(page_lsn, checkpoint_lsn_ + 1);
+  auto first = std::lower_bound(logs.begin(), logs.end(), start_lsn,
+                                [](const LogEntry &log, lsn_t lsn) {
+                                  return log.log_start_lsn_ < lsn;
+                                });
+  stats.logs_skipped_by_page_lsn_ += first - logs.begin();
+
+  // 这一批中第一次和最后一次修改这个page之后的page LSN
+  lsn_t oldest_modification = 0;
+  lsn_t newest_modification = 0;
+  for (auto iter = first; iter != logs.end(); ++iter) {
+    const auto &log = *iter;
+    lsn_t log_lsn = log.log_start_lsn_;
+    auto t4 = std::chrono::steady_clock::now();
+
+    if (ApplyOneLog<PAGE_SIZE>(page, log)) {
+      stats.apply_file_len_ += log.log_len_;
+      if (oldest_modification == 0) {
+        oldest_modification = log_lsn + log.log_len_;
+      }
+      newest_modification = log_lsn + log.log_len_;
+      auto t5 = std::chrono::steady_clock::now();
+      stats.apply_time_ += (t5 - t4).count();
+      stats.logs_applied_++;
+    }
+  }
+  // 没有被修改过的page被淘汰时不需要写回。page LSN在这一批的最后写一次就够了，checksum在写回时才计算
+  if (newest_modification != 0) {
+    page->WritePageLSN(newest_modification);
+    guard.MarkDirty(oldest_modification, newest_modification);
+  }
+}
+
+void ApplySystem::ReportWorkerStats(std::ostream &os) const {
+  for (uint32_t i = 0; i < worker_stats_.size(); ++i) {
+    os << "apply worker " << i << ": busy_time = " << worker_stats_[i].busy_time_
+       << ", tasks = " << worker_stats_[i].n_tasks_
+       << ", steals = " << worker_stats_[i].n_steals_
+       << ", suspends = " << worker_stats_[i].n_suspends_ << std::endl;
+  }
+}
+
+template <size_t PAGE_SIZE>
 bool ApplySystem::ApplyOneLog(Page *page, const LogEntry &log) {
   byte *ret;
   switch (log.type_) {
@@ -306,37 +944,37 @@ bool ApplySystem::ApplyOneLog(Page *page, const LogEntry &log) {
     case MLOG_2BYTES:
     case MLOG_4BYTES:
     case MLOG_8BYTES:
-      ret = ParseOrApplyNBytes(log.type_, log.log_body_start_ptr_, log.log_body_end_ptr_, page->GetData());
+      ret = ParseOrApplyNBytes<PAGE_SIZE>(log.type_, log.log_body_start_ptr_, log.log_body_end_ptr_, page->GetData());
       return ret != nullptr;
     case MLOG_WRITE_STRING:
-      ret = ParseOrApplyString(log.log_body_start_ptr_, log.log_body_end_ptr_, page->GetData());
+      ret = ParseOrApplyString<PAGE_SIZE>(log.log_body_start_ptr_, log.log_body_end_ptr_, page->GetData());
       return ret != nullptr;
     case MLOG_COMP_PAGE_CREATE:
-      ret = ApplyCompPageCreate(page->GetData());
+      ret = ApplyCompPageCreate<PAGE_SIZE>(page->GetData());
       return ret != nullptr;
     case MLOG_INIT_FILE_PAGE2:
-      return ApplyInitFilePage2(log, page);
+      return ApplyInitFilePage2<PAGE_SIZE>(log, page);
     case MLOG_COMP_REC_INSERT:
-      return ApplyCompRecInsert(log, page);
+      return ApplyCompRecInsert<PAGE_SIZE>(log, page);
     case MLOG_COMP_REC_CLUST_DELETE_MARK:
-      return ApplyCompRecClusterDeleteMark(log, page);
+      return ApplyCompRecClusterDeleteMark<PAGE_SIZE>(log, page);
     case MLOG_REC_SEC_DELETE_MARK:
-      return ApplyRecSecondDeleteMark(log, page);
+      return ApplyRecSecondDeleteMark<PAGE_SIZE>(log, page);
     case MLOG_COMP_REC_SEC_DELETE_MARK:
-      return ApplyCompRecSecondDeleteMark(log, page);
+      return ApplyCompRecSecondDeleteMark<PAGE_SIZE>(log, page);
     case MLOG_COMP_REC_UPDATE_IN_PLACE:
-      return ApplyCompRecUpdateInPlace(log, page);
+      return ApplyCompRecUpdateInPlace<PAGE_SIZE>(log, page);
     case MLOG_COMP_REC_DELETE:
-      return ApplyCompRecDelete(log, page);
+      return ApplyCompRecDelete<PAGE_SIZE>(log, page);
     case MLOG_COMP_LIST_END_COPY_CREATED:
-      return ApplyCompListEndCopyCreated(log, page);
+      return ApplyCompListEndCopyCreated<PAGE_SIZE>(log, page);
     case MLOG_COMP_PAGE_REORGANIZE:
-      return ApplyCompPageReorganize(log, page);
+      return ApplyCompPageReorganize<PAGE_SIZE>(log, page);
     case MLOG_COMP_LIST_START_DELETE:
     case MLOG_COMP_LIST_END_DELETE:
-      return ApplyCompListDelete(log, page);
+      return ApplyCompListDelete<PAGE_SIZE>(log, page);
     case MLOG_IBUF_BITMAP_INIT:
-      return ApplyIBufBitmapInit(log, page);
+      return ApplyIBufBitmapInit<PAGE_SIZE>(log, page);
     default:
       // skip
 //      std::cout << "We can not apply " << GetLogString(log.type_) << ", just skipped." << std::endl;
@@ -345,13 +983,13 @@ bool ApplySystem::ApplyOneLog(Page *page, const LogEntry &log) {
   return true;
 }
 
-void ApplySystem::SaveLogs() {
+void ApplySystem::SaveLogs(const LogBatch &batch) {
   static std::unordered_map<std::string, int> open_times; // 记录文件被打开的次数
   if (save_logs_) {
-    for (const auto &spaces_logs: hash_map_) {
+    for (const auto &spaces_logs: batch.hash_map_) {
       // 打开文件
       space_id_t space_id = spaces_logs.first;
-      std::string output_file_name("/home/lemon/mysql/parsed_logs/");
+      std::string output_file_name(MysqlHome() + "/parsed_logs/");
       std::string table_name = buffer_pool.GetFilename(space_id);
       table_name = table_name.substr(table_name.rfind('/') + 1);
       table_name = table_name.substr(0, table_name.size() - 4);
@@ -371,7 +1009,7 @@ void ApplySystem::SaveLogs() {
         for (const auto &log: pages_logs.second) {
           table_ofs_ << "lsn = " << log.log_start_lsn_ << ", type = " << GetLogString(log.type_)
                      << ", space_id = " << space_id << ", page_id = "
-                     << page_id << ", data_len = " << log.log_len_ << std::endl;
+                     << page_id << ", data_len = " << log.log_len_ << '\n';
         }
       }
       // 关闭文件
@@ -0,0 +1,152 @@
+#include "log_index.h"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+namespace Lemon {
+
+LogIndex::~LogIndex() {
+  Close();
+}
+
+void LogIndex::Close() {
+  if (map_addr_ != nullptr) {
+    munmap(map_addr_, map_len_);
+    map_addr_ = nullptr;
+  }
+  entries_ = nullptr;
+  n_mapped_ = 0;
+  if (fd_ != -1) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool LogIndex::Map(uint64_t n_entries) {
+  n_mapped_ = n_entries;
+  if (n_entries == 0) {
+    return true;
+  }
+  map_len_ = sizeof(LogIndexHeader) + n_entries * sizeof(LogIndexEntry);
+  map_addr_ = mmap(nullptr, map_len_, PROT_READ, MAP_SHARED, fd_, 0);
+  if (map_addr_ == MAP_FAILED) {
+    std::cerr << "mmap log index failed: " << std::strerror(errno) << std::endl;
+    map_addr_ = nullptr;
+    n_mapped_ = 0;
+    return false;
+  }
+  entries_ = reinterpret_cast<const LogIndexEntry *>(static_cast<const byte *>(map_addr_) + sizeof(LogIndexHeader));
+  return true;
+}
+
+bool LogIndex::Load(const std::string &path) {
+  Close();
+  fd_ = open(path.c_str(), O_RDONLY);
+  if (fd_ == -1) {
+    std::cerr << "open log index " << path << " failed: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  struct stat st{};
+  if (fstat(fd_, &st) != 0
+      || pread(fd_, &header_, sizeof(header_), 0) != static_cast<ssize_t>(sizeof(header_))
+      || header_.magic_ != MAGIC || header_.version_ != VERSION
+      || static_cast<uint64_t>(st.st_size) < sizeof(LogIndexHeader) + header_.n_entries_ * sizeof(LogIndexEntry)) {
+    std::cerr << "invalid log index " << path << std::endl;
+    Close();
+    return false;
+  }
+  return Map(header_.n_entries_);
+}
+
+bool LogIndex::OpenForAppend(const std::string &path) {
+  Close();
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd_ == -1) {
+    std::cerr << "open log index " << path << " failed: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  struct stat st{};
+  fstat(fd_, &st);
+  bool valid = pread(fd_, &header_, sizeof(header_), 0) == static_cast<ssize_t>(sizeof(header_))
+               && header_.magic_ == MAGIC && header_.version_ == VERSION
+               && static_cast<uint64_t>(st.st_size) >= sizeof(LogIndexHeader) + header_.n_entries_ * sizeof(LogIndexEntry);
+  if (!valid) {
+    // 新文件或者文件已经损坏，从头开始
+    std::memset(&header_, 0, sizeof(header_));
+    header_.magic_ = MAGIC;
+    header_.version_ = VERSION;
+  }
+  // 上次崩溃时可能写了一半的entry，截断掉
+  if (ftruncate(fd_, static_cast<off_t>(sizeof(LogIndexHeader) + header_.n_entries_ * sizeof(LogIndexEntry))) != 0
+      || !WriteHeader()) {
+    std::cerr << "initialize log index " << path << " failed: " << std::strerror(errno) << std::endl;
+    Close();
+    return false;
+  }
+  return Map(header_.n_entries_);
+}
+
+bool LogIndex::WriteHeader() {
+  return pwrite(fd_, &header_, sizeof(header_), 0) == static_cast<ssize_t>(sizeof(header_));
+}
+
+bool LogIndex::Commit(lsn_t parsed_lsn, uint64_t parsed_offset) {
+  if (fd_ == -1) {
+    return false;
+  }
+  // 先写entry再写头部，崩溃时头部中的n_entries_总是指向完整的entry
+  if (!pending_.empty()) {
+    size_t len = pending_.size() * sizeof(LogIndexEntry);
+    auto offset = static_cast<off_t>(sizeof(LogIndexHeader) + header_.n_entries_ * sizeof(LogIndexEntry));
+    if (pwrite(fd_, pending_.data(), len, offset) != static_cast<ssize_t>(len)) {
+      std::cerr << "write log index failed: " << std::strerror(errno) << std::endl;
+      return false;
+    }
+    // 头部可能比entry先落盘，写头部之前必须保证entry已经持久化了
+    if (fdatasync(fd_) != 0) {
+      std::cerr << "sync log index failed: " << std::strerror(errno) << std::endl;
+      return false;
+    }
+    header_.n_entries_ += pending_.size();
+    pending_.clear();
+  }
+  header_.parsed_lsn_ = parsed_lsn;
+  header_.parsed_offset_ = parsed_offset;
+  return WriteHeader();
+}
+
+bool LogIndex::SetAppliedLSN(lsn_t lsn) {
+  if (fd_ == -1) {
+    return false;
+  }
+  header_.applied_lsn_ = lsn;
+  return WriteHeader();
+}
+
+uint64_t LogIndex::LowerBound(lsn_t lsn) const {
+  auto iter = std::lower_bound(entries_, entries_ + n_mapped_, lsn,
+                               [](const LogIndexEntry &entry, lsn_t lsn) {
+                                 return entry.lsn_ < lsn;
+                               });
+  return iter - entries_;
+}
+
+uint64_t LogIndex::DataOffsetToFileOffset(uint64_t data_offset) {
+  uint64_t block = N_LOG_METADATA_BLOCKS + data_offset / LOG_BLOCK_DATA_SIZE;
+  return block * LOG_BLOCK_SIZE + LOG_BLOCK_HDR_SIZE + data_offset % LOG_BLOCK_DATA_SIZE;
+}
+
+uint64_t LogIndex::FileOffsetToDataOffset(uint64_t file_offset) {
+  uint64_t block = file_offset / LOG_BLOCK_SIZE;
+  assert(block >= N_LOG_METADATA_BLOCKS);
+  assert(file_offset % LOG_BLOCK_SIZE >= LOG_BLOCK_HDR_SIZE);
+  return (block - N_LOG_METADATA_BLOCKS) * LOG_BLOCK_DATA_SIZE + file_offset % LOG_BLOCK_SIZE - LOG_BLOCK_HDR_SIZE;
+}
+
+}
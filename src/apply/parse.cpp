@@ -5,6 +5,8 @@
 #include "bean.h"
 #include "timer.h"
 #include "record.h"
+#include "page_layout.h"
+#include "page_dir_index.h"
 #include <cassert>
 #include <cstring>
 #include <iostream>
@@ -95,6 +97,7 @@ static byte* PARSE_MLOG_TRUNCATE(byte* start_ptr, const byte*	end_ptr, space_id_
 /**
 Parses a MLOG_*BYTES log record.
 @return parsed record end, nullptr if not a complete record or a corrupt record */
+template <size_t PAGE_SIZE>
 byte* ParseOrApplyNBytes(LOG_TYPE type, const byte* log_body_start_ptr, const byte*	log_body_end_ptr, byte *page) {
   uint16_t offset;
   uint32_t val;
@@ -107,7 +110,7 @@ byte* ParseOrApplyNBytes(LOG_TYPE type, const byte* log_body_start_ptr, const by
   offset = mach_read_from_2(log_body_start_ptr);
   log_body_start_ptr += 2;
 
-  if (offset >= DATA_PAGE_SIZE) {
+  if (offset >= PAGE_SIZE) {
     return nullptr;
   }
 
@@ -216,6 +219,7 @@ row_upd_parse_sys_vals(
 /**
 Parses a MLOG_REC_SEC_DELETE_MARK or MLOG_COMP_REC_SEC_DELETE_MARK redo log record.
 @return end of log record or NULL */
+template <size_t PAGE_SIZE>
 static byte*PARSE_MLOG_REC_SEC_DELETE_MARK(byte* ptr, const byte* end_ptr) {
   if (end_ptr < ptr + 3) {
     return nullptr;
@@ -223,7 +227,7 @@ static byte*PARSE_MLOG_REC_SEC_DELETE_MARK(byte* ptr, const byte* end_ptr) {
   ptr++;
   uint16_t offset = mach_read_from_2(ptr);
   ptr += 2;
-  assert(offset <= DATA_PAGE_SIZE);
+  assert(offset <= PAGE_SIZE);
   return(ptr);
 }
 
@@ -292,6 +296,7 @@ row_upd_index_parse(const byte*	ptr, const byte* end_ptr, UpdateInfo *update_inf
 /**
 Parses a PARSE_MLOG_REC_UPDATE_IN_PLACE or PARSE_MLOG_COMP_REC_UPDATE_IN_PLACE redo log record.
 @return end of log record or NULL */
+template <size_t PAGE_SIZE>
 byte*
 PARSE_MLOG_REC_UPDATE_IN_PLACE(byte* ptr, const byte* end_ptr) {
   if (end_ptr < ptr + 1) {
@@ -310,7 +315,7 @@ PARSE_MLOG_REC_UPDATE_IN_PLACE(byte* ptr, const byte* end_ptr) {
   uint16_t rec_offset = mach_read_from_2(ptr);
   ptr += 2;
 
-  assert(rec_offset <= DATA_PAGE_SIZE);
+  assert(rec_offset <= PAGE_SIZE);
 
   ptr = row_upd_index_parse(ptr, end_ptr, nullptr);
 
@@ -321,6 +326,7 @@ PARSE_MLOG_REC_UPDATE_IN_PLACE(byte* ptr, const byte* end_ptr) {
 /**
 Parses a MLOG_REC_INSERT or MLOG_REC_COM_INSERT log record.
 @return end of log record or nullptr */
+template <size_t PAGE_SIZE>
 static byte*
 PARSE_MLOG_REC_INSERT(
     bool 		is_short,/*!< in: TRUE if short inserts */
@@ -339,7 +345,7 @@ PARSE_MLOG_REC_INSERT(
     // 解析出上一条记录的偏移量
     offset = mach_read_from_2(ptr);
     ptr += 2;
-    if (offset >= DATA_PAGE_SIZE) {
+    if (offset >= PAGE_SIZE) {
       return nullptr;
     }
   }
@@ -350,7 +356,7 @@ PARSE_MLOG_REC_INSERT(
     return nullptr;
   }
 
-  if (end_seg_len >= DATA_PAGE_SIZE << 1) {
+  if (end_seg_len >= PAGE_SIZE << 1) {
     return nullptr;
   }
 
@@ -363,12 +369,12 @@ PARSE_MLOG_REC_INSERT(
     if (ptr == nullptr) {
       return nullptr;
     }
-    assert(origin_offset < DATA_PAGE_SIZE);
+    assert(origin_offset < PAGE_SIZE);
     mismatch_index = mach_parse_compressed(&ptr, end_ptr);
     if (ptr == nullptr) {
       return nullptr;
     }
-    assert(mismatch_index < DATA_PAGE_SIZE);
+    assert(mismatch_index < PAGE_SIZE);
   }
   if (end_ptr < ptr + (end_seg_len >> 1)) {
     return nullptr;
@@ -379,6 +385,7 @@ PARSE_MLOG_REC_INSERT(
 /**
 Parses a MLOG_REC_CLUST_DELETE_MARK or MLOG_COMP_REC_CLUST_DELETE_MARK redo log record.
 @return end of log record or nullptr */
+template <size_t PAGE_SIZE>
 static byte* PARSE_MLOG_REC_CLUST_DELETE_MARK(
     byte*		ptr,	/*!< in: buffer */
     const byte*	end_ptr/*!< in: buffer end */) {
@@ -402,7 +409,7 @@ static byte* PARSE_MLOG_REC_CLUST_DELETE_MARK(
   uint16_t offset = mach_read_from_2(ptr);
   ptr += 2;
 
-  assert(offset <= DATA_PAGE_SIZE);
+  assert(offset <= PAGE_SIZE);
   return ptr;
 }
 
@@ -521,6 +528,7 @@ static byte* PARSE_OR_APPLY_ADD_UNDO_REC(
 /**
 Parses or apply a redo log record of erasing of an undo page end.
 @return end of log record or nullptr */
+template <size_t PAGE_SIZE>
 static byte* PARSE_OR_APPLY_UNDO_ERASE_PAGE_END(byte* ptr, const byte* end_ptr, byte* page) {
   if (page == nullptr) {
     return ptr;
@@ -530,7 +538,7 @@ static byte* PARSE_OR_APPLY_UNDO_ERASE_PAGE_END(byte* ptr, const byte* end_ptr,
   uint16_t first_free = mach_read_from_2(page + TRX_UNDO_PAGE_HDR
                                 + TRX_UNDO_PAGE_FREE);
   memset(page + first_free, 0xff,
-         (DATA_PAGE_SIZE - FIL_PAGE_DATA_END) - first_free);
+         (PAGE_SIZE - FIL_PAGE_DATA_END) - first_free);
 
   return ptr;
 }
@@ -589,6 +597,7 @@ static byte* ParseOrApplyTrxUndoDiscardLatest(byte* ptr, const byte*	end_ptr, by
   return(ptr);
 }
 
+template <size_t PAGE_SIZE>
 static byte*
 ParseOrApplyTrxUndoPageHeader(LOG_TYPE type,
                               const byte* ptr,
@@ -606,7 +615,7 @@ ParseOrApplyTrxUndoPageHeader(LOG_TYPE type,
       byte *log_hdr = page + free;
       uint32_t new_free = free + TRX_UNDO_LOG_OLD_HDR_SIZE;
 
-      assert(free + TRX_UNDO_LOG_XA_HDR_SIZE < DATA_PAGE_SIZE - 100);
+      assert(free + TRX_UNDO_LOG_XA_HDR_SIZE < PAGE_SIZE - 100);
 
       mach_write_to_2(page_hdr + TRX_UNDO_PAGE_START, new_free);
 
@@ -642,7 +651,7 @@ ParseOrApplyTrxUndoPageHeader(LOG_TYPE type,
 
       uint32_t free = TRX_UNDO_SEG_HDR + TRX_UNDO_SEG_HDR_SIZE;
 
-      assert(free + TRX_UNDO_LOG_XA_HDR_SIZE < DATA_PAGE_SIZE - 100);
+      assert(free + TRX_UNDO_LOG_XA_HDR_SIZE < PAGE_SIZE - 100);
 
       byte *log_hdr = page + free;
 
@@ -711,10 +720,11 @@ page_dir_get_n_slots(const byte* page) {
 }
 
 
+template <size_t PAGE_SIZE>
 static inline byte*
 page_dir_get_nth_slot(const byte*	page, uint32_t n) {
   assert(page_dir_get_n_slots(page) > n);
-  return((byte*)page + DATA_PAGE_SIZE - PAGE_DIR - (n + 1) * PAGE_DIR_SLOT_SIZE);
+  return((byte*)page + PAGE_SIZE - PAGE_DIR - (n + 1) * PAGE_DIR_SLOT_SIZE);
 }
 static inline uint32_t
 rec_get_n_owned_new(const byte*	rec) {
@@ -736,6 +746,7 @@ page_get_page_no(
 /***************************************************************//**
 Looks for the directory slot which owns the given record.
 @return the directory slot number */
+template <size_t PAGE_SIZE>
 static uint32_t
 page_dir_find_owner_slot(
 /*=====================*/
@@ -747,13 +758,19 @@ page_dir_find_owner_slot(
   const byte*	first_slot;
   const byte* r = rec;
   // TODO 可能有问题的地方
-  first_slot = page_dir_get_nth_slot(page, 0);
-  slot = page_dir_get_nth_slot(page, page_dir_get_n_slots(page) - 1);
+  first_slot = page_dir_get_nth_slot<PAGE_SIZE>(page, 0);
+  slot = page_dir_get_nth_slot<PAGE_SIZE>(page, page_dir_get_n_slots(page) - 1);
 
   while (rec_get_n_owned_new(r) == 0) {
-    r = rec_get_next_ptr_const(page, r);
+    r = rec_get_next_ptr_const<PAGE_SIZE>(page, r);
     assert(r >= page + PAGE_NEW_SUPREMUM);
-    assert(r < page + (DATA_PAGE_SIZE - PAGE_DIR));
+    assert(r < page + (PAGE_SIZE - PAGE_DIR));
+  }
+
+  // 同一个page上查找多次时使用临时索引，不需要线性查找
+  uint32_t slot_no;
+  if (PageDirIndex::Local().FindOwnerSlot<PAGE_SIZE>(page, r - page, slot_no)) {
+    return slot_no;
   }
 
   rec_offs_bytes = mach_encode_2(r - page);
@@ -804,6 +821,7 @@ static const byte* page_dir_slot_get_rec(const byte *page, const byte *slot) {
 
 
 
+template <size_t PAGE_SIZE>
 static byte* ParseDeleteRec(byte*	ptr, const byte* end_ptr, byte*	page) {
   if (end_ptr < ptr + 2) {
     return nullptr;
@@ -811,7 +829,7 @@ static byte* ParseDeleteRec(byte*	ptr, const byte* end_ptr, byte*	page) {
 
   uint16_t offset = mach_read_from_2(ptr);
   ptr += 2;
-  assert(offset <= DATA_PAGE_SIZE);
+  assert(offset <= PAGE_SIZE);
 
   return(ptr);
 }
@@ -820,7 +838,10 @@ static inline byte* ParseIbufBitmapInit(byte* ptr, const byte* end_ptr, byte* pa
   return(ptr);
 }
 
+template <size_t PAGE_SIZE>
 static byte* page_create_low(byte* page) {
+  // 所有的slot和记录都重新初始化了
+  PageDirIndex::Local().Invalidate();
   // 设置page的种类
   fil_page_set_type(page, FIL_PAGE_INDEX);
 
@@ -835,10 +856,10 @@ static byte* page_create_low(byte* page) {
   std::memcpy(page + PAGE_DATA, infimum_supremum_compact,
               sizeof infimum_supremum_compact);
   std::memset(page + PAGE_NEW_SUPREMUM_END, 0,
-              DATA_PAGE_SIZE - PAGE_DIR - PAGE_NEW_SUPREMUM_END);
-  page[DATA_PAGE_SIZE - PAGE_DIR - PAGE_DIR_SLOT_SIZE * 2 + 1]
+              PAGE_SIZE - PAGE_DIR - PAGE_NEW_SUPREMUM_END);
+  page[PAGE_SIZE - PAGE_DIR - PAGE_DIR_SLOT_SIZE * 2 + 1]
       = PAGE_NEW_SUPREMUM;
-  page[DATA_PAGE_SIZE - PAGE_DIR - PAGE_DIR_SLOT_SIZE + 1]
+  page[PAGE_SIZE - PAGE_DIR - PAGE_DIR_SLOT_SIZE + 1]
       = PAGE_NEW_INFIMUM;
   return page;
 }
@@ -846,24 +867,26 @@ static byte* page_create_low(byte* page) {
 /**
  * Apply MLOG_COMP_PAGE_CREATE
  */
+template <size_t PAGE_SIZE>
 byte* ApplyCompPageCreate(byte* page) {
   if (page == nullptr) {
     return nullptr;
   }
 
-  return page_create_low(page);
+  return page_create_low<PAGE_SIZE>(page);
 
 }
 
 /**
  * Apply MLOG_INIT_FILE_PAGE2
  */
+template <size_t PAGE_SIZE>
 bool ApplyInitFilePage2(const LogEntry &log, Page *page) {
   if (page == nullptr || page->GetData()) {
     return false;
   }
   byte *page_data = page->GetData();
-  std::memset(page_data, 0, DATA_PAGE_SIZE);
+  std::memset(page_data, 0, PAGE_SIZE);
   // 写入page id
   mach_write_to_4(page_data + FIL_PAGE_OFFSET, log.page_id_);
   // 写入space id
@@ -897,7 +920,7 @@ static byte* ParseRecInfoFromLog(const byte *ptr, const byte *end_ptr, RecordInf
 
 
     assert(n_uniq <= n);
-    if (end_ptr < ptr + n * 2) {
+    if (n > REC_MAX_N_FIELDS || end_ptr < ptr + n * 2) {
       return nullptr;
     }
   } else {
@@ -991,11 +1014,12 @@ page_dir_calc_reserved_space(
 /*************************************************************//**
 Calculates free space if a page is emptied.
 @return free space */
+template <size_t PAGE_SIZE>
 static
 uint32_t
 page_get_free_space_of_empty() {
 
-  return((uint32_t)(DATA_PAGE_SIZE - PAGE_NEW_SUPREMUM_END - PAGE_DIR - 2 * PAGE_DIR_SLOT_SIZE));
+  return((uint32_t)(PAGE_SIZE - PAGE_NEW_SUPREMUM_END - PAGE_DIR - 2 * PAGE_DIR_SLOT_SIZE));
 }
 
 
@@ -1016,6 +1040,7 @@ value of page_get_free_space_of_empty, the insert is impossible, otherwise
 it is allowed. This function returns the maximum combined size of records
 which can be inserted on top of the record heap.
 @return maximum combined size for inserted records */
+template <size_t PAGE_SIZE>
 static
 uint32_t
 page_get_max_insert_size(
@@ -1031,7 +1056,7 @@ page_get_max_insert_size(
              + page_dir_calc_reserved_space(
       n_recs + page_dir_get_n_heap(page) - 2);
 
-  free_space = page_get_free_space_of_empty();
+  free_space = page_get_free_space_of_empty<PAGE_SIZE>();
 
   /* Above the 'n_recs +' part reserves directory space for the new
   inserted records; the '- 2' excludes page infimum and supremum
@@ -1062,6 +1087,7 @@ page_dir_set_n_heap(
 /************************************************************//**
 Allocates a block of memory from the heap of an index page.
 @return pointer to start of allocated buffer, or NULL if allocation fails */
+template <size_t PAGE_SIZE>
 static byte*
 page_mem_alloc_heap(
 /*================*/
@@ -1076,7 +1102,7 @@ page_mem_alloc_heap(
 
   assert(page && heap_no);
 
-  avl_space = page_get_max_insert_size(page, 1);
+  avl_space = page_get_max_insert_size<PAGE_SIZE>(page, 1);
 
   if (avl_space >= need) {
     block = page_header_get_ptr(page, PAGE_HEAP_TOP);
@@ -1095,15 +1121,16 @@ page_mem_alloc_heap(
 /************************************************************//**
 Gets the pointer to the next record on the page.
 @return pointer to next record */
+template <size_t PAGE_SIZE>
 static
 byte*
 page_rec_get_next(byte* page, const byte* rec)
 {
   uint32_t 		offs;
   // TODO 可能有问题的地方
-  offs = rec_get_next_offs(page, rec);
+  offs = rec_get_next_offs<PAGE_SIZE>(page, rec);
 
-  if (offs >= DATA_PAGE_SIZE) {
+  if (offs >= PAGE_SIZE) {
     // TODO Error
     std::cerr << "Error" << std::endl;
   } else if (offs == 0) {
@@ -1116,6 +1143,7 @@ page_rec_get_next(byte* page, const byte* rec)
 
 /************************************************************//**
 Sets the pointer to the next record on the page. */
+template <size_t PAGE_SIZE>
 static
 void
 page_rec_set_next(
@@ -1132,12 +1160,13 @@ page_rec_set_next(
   // TODO 可能有问题的地方
   offs = next != nullptr ? next - page : 0;
 
-  rec_set_next_offs_new(page, rec, offs);
+  rec_set_next_offs_new<PAGE_SIZE>(page, rec, offs);
 }
 
 /***************************************************************//**
 Looks for the record which owns the given record.
 @return the owner record */
+template <size_t PAGE_SIZE>
 static byte*
 page_rec_find_owner_rec(
 /*====================*/
@@ -1147,7 +1176,7 @@ page_rec_find_owner_rec(
 
   // TODO 可能有问题的地方
   while (rec_get_n_owned_new(rec) == 0) {
-    rec = page_rec_get_next(page, rec);
+    rec = page_rec_get_next<PAGE_SIZE>(page, rec);
   }
 
   return(rec);
@@ -1185,6 +1214,7 @@ page_dir_set_n_slots(
 Used to add n slots to the directory. Does not set the record pointers
 in the added slots or update n_owned values: this is the responsibility
 of the caller. */
+template <size_t PAGE_SIZE>
 static
 void
 page_dir_add_slot(
@@ -1205,7 +1235,7 @@ page_dir_add_slot(
   page_dir_set_n_slots(page, n_slots + 1);
 
   /* Move slots up */
-  slot = page_dir_get_nth_slot(page, n_slots);
+  slot = page_dir_get_nth_slot<PAGE_SIZE>(page, n_slots);
   std::memmove(slot, slot + PAGE_DIR_SLOT_SIZE,
           (n_slots - 1 - start) * PAGE_DIR_SLOT_SIZE);
 }
@@ -1242,6 +1272,7 @@ page_dir_slot_set_n_owned(
 
 /****************************************************************//**
 Splits a directory slot which owns too many records. */
+template <size_t PAGE_SIZE>
 void
 page_dir_split_slot(
 /*================*/
@@ -1258,7 +1289,7 @@ page_dir_split_slot(
   assert(page);
   assert(slot_no > 0);
 
-  slot = page_dir_get_nth_slot(page, slot_no);
+  slot = page_dir_get_nth_slot<PAGE_SIZE>(page, slot_no);
 
   n_owned = page_dir_slot_get_n_owned(page, slot);
   assert(n_owned == PAGE_DIR_SLOT_MAX_N_OWNED + 1);
@@ -1266,11 +1297,11 @@ page_dir_split_slot(
   /* 1. We loop to find a record approximately in the middle of the
   records owned by the slot. */
 
-  prev_slot = page_dir_get_nth_slot(page, slot_no - 1);
+  prev_slot = page_dir_get_nth_slot<PAGE_SIZE>(page, slot_no - 1);
   rec = (byte*) page_dir_slot_get_rec(page, prev_slot);
 
   for (i = 0; i < n_owned / 2; i++) {
-    rec = page_rec_get_next(page, rec);
+    rec = page_rec_get_next<PAGE_SIZE>(page, rec);
   }
 
   assert(n_owned / 2 >= PAGE_DIR_SLOT_MIN_N_OWNED);
@@ -1278,13 +1309,13 @@ page_dir_split_slot(
   /* 2. We add one directory slot immediately below the slot to be
   split. */
 
-  page_dir_add_slot(page, slot_no - 1);
+  page_dir_add_slot<PAGE_SIZE>(page, slot_no - 1);
 
   /* The added slot is now number slot_no, and the old slot is
   now number slot_no + 1 */
 
-  new_slot = page_dir_get_nth_slot(page, slot_no);
-  slot = page_dir_get_nth_slot(page, slot_no + 1);
+  new_slot = page_dir_get_nth_slot<PAGE_SIZE>(page, slot_no);
+  slot = page_dir_get_nth_slot<PAGE_SIZE>(page, slot_no + 1);
 
   /* 3. We store the appropriate values to the new slot. */
 
@@ -1295,6 +1326,9 @@ page_dir_split_slot(
   original slot */
 
   page_dir_slot_set_n_owned(page, slot, n_owned - (n_owned / 2));
+
+  /* 5. slot_no及之后的slot都往上移了一个位置 */
+  PageDirIndex::Local().Renumber<PAGE_SIZE>(page, slot_no);
 }
 
 
@@ -1308,6 +1342,7 @@ Inserts a record next to page cursor on an uncompressed page.
 Returns pointer to inserted record if succeed, i.e., enough
 space available, NULL otherwise. The cursor stays at the same position.
 @return pointer to record if succeed, NULL otherwise */
+template <size_t PAGE_SIZE>
 byte*
 page_cur_insert_rec_low(
 /*====================*/
@@ -1350,12 +1385,12 @@ page_cur_insert_rec_low(
     insert_buf = free_rec - free_rec_info.GetExtraSize();
 
     heap_no = rec_get_heap_no_new(free_rec);
-    page_mem_alloc_free(page, rec_get_next_ptr(page, free_rec), rec_size);
+    page_mem_alloc_free(page, rec_get_next_ptr<PAGE_SIZE>(page, free_rec), rec_size);
 
   } else {
     use_heap:
     free_rec = nullptr;
-    insert_buf = page_mem_alloc_heap(page, rec_size, &heap_no);
+    insert_buf = page_mem_alloc_heap<PAGE_SIZE>(page, rec_size, &heap_no);
 
     if (insert_buf == nullptr) {
       return nullptr;
@@ -1368,9 +1403,11 @@ page_cur_insert_rec_low(
   /* 4. Insert the record in the linked list of records */
   {
     /* next record after current before the insertion */
-    byte *next_rec = page_rec_get_next(page, pre_rec);
-    page_rec_set_next(page, insert_rec, next_rec);
-    page_rec_set_next(page, pre_rec, insert_rec);
+    byte *next_rec = page_rec_get_next<PAGE_SIZE>(page, pre_rec);
+    page_rec_set_next<PAGE_SIZE>(page, insert_rec, next_rec);
+    page_rec_set_next<PAGE_SIZE>(page, pre_rec, insert_rec);
+    // 顺序插入时下一条记录还是插在next_rec（supremum）前面
+    PageDirIndex::Local().RememberPrev(page, next_rec - page, insert_rec - page);
   }
 
   page_header_set_field(page, PAGE_N_RECS,
@@ -1399,7 +1436,7 @@ and set the heap_no field */
                           page_header_get_field(
                               page, PAGE_N_DIRECTION) + 1);
 
-  } else if ((page_rec_get_next(page, insert_rec) == last_insert)
+  } else if ((page_rec_get_next<PAGE_SIZE>(page, insert_rec) == last_insert)
              && (page_header_get_field(page, PAGE_DIRECTION)
                  != PAGE_RIGHT)) {
 
@@ -1418,7 +1455,7 @@ and set the heap_no field */
 
   /* 7. It remains to update the owner record. */
   {
-    byte*	owner_rec	= page_rec_find_owner_rec(page, insert_rec);
+    byte*	owner_rec	= page_rec_find_owner_rec<PAGE_SIZE>(page, insert_rec);
     uint32_t	n_owned;
     n_owned = rec_get_n_owned_new(owner_rec);
     rec_set_n_owned_new(owner_rec, n_owned + 1);
@@ -1430,7 +1467,7 @@ and set the heap_no field */
     if (n_owned == PAGE_DIR_SLOT_MAX_N_OWNED) {
 //      assert(mach_read_from_2(page_dir_get_nth_slot(page, page_dir_get_n_slots(page) - 1) - 2) == 0);
 //      std::cout << "slot_number:" << page_dir_find_owner_slot(page, owner_rec) << std::endl;
-      page_dir_split_slot(page, page_dir_find_owner_slot(page, owner_rec));
+      page_dir_split_slot<PAGE_SIZE>(page, page_dir_find_owner_slot<PAGE_SIZE>(page, owner_rec));
     }
   }
 
@@ -1443,14 +1480,15 @@ static byte *page_get_supremum_rec(byte *page) {
 /************************************************************//**
 Gets the pointer to the next record on the page.
 @return pointer to next record */
+template <size_t PAGE_SIZE>
 static
 const byte*
 page_rec_get_next_low(const byte* page, const byte*	rec) {
   uint32_t offs;
 
-  offs = rec_get_next_offs(page, rec);
+  offs = rec_get_next_offs<PAGE_SIZE>(page, rec);
 
-  if (offs >= DATA_PAGE_SIZE) {
+  if (offs >= PAGE_SIZE) {
     // Error
     std::cerr << "Next record offset is nonsensical" << std::endl;
     exit(1);
@@ -1466,6 +1504,7 @@ page_rec_get_next_low(const byte* page, const byte*	rec) {
 /************************************************************//**
 Gets the pointer to the previous record.
 @return pointer to previous record */
+template <size_t PAGE_SIZE>
 static
 const byte*
 page_rec_get_prev_const(const byte* page, const byte*	rec)
@@ -1475,20 +1514,26 @@ page_rec_get_prev_const(const byte* page, const byte*	rec)
   const byte*		rec2;
   const byte*		prev_rec = nullptr;
 
-  slot_no = page_dir_find_owner_slot(page, rec);
+  uint32_t prev_offs;
+  if (PageDirIndex::Local().FindPrev<PAGE_SIZE>(page, rec - page, prev_offs)) {
+    return page + prev_offs;
+  }
+
+  slot_no = page_dir_find_owner_slot<PAGE_SIZE>(page, rec);
 
   assert(slot_no != 0);
 
-  slot = page_dir_get_nth_slot(page, slot_no - 1);
+  slot = page_dir_get_nth_slot<PAGE_SIZE>(page, slot_no - 1);
 
   rec2 = page_dir_slot_get_rec(page, slot);
 
   while (rec != rec2) {
     prev_rec = rec2;
-    rec2 = page_rec_get_next_low(page, rec2);
+    rec2 = page_rec_get_next_low<PAGE_SIZE>(page, rec2);
   }
 
   assert(prev_rec);
+  PageDirIndex::Local().RememberPrev(page, rec - page, prev_rec - page);
 
   return(prev_rec);
 }
@@ -1497,12 +1542,14 @@ page_rec_get_prev_const(const byte* page, const byte*	rec)
 /************************************************************//**
 Gets the pointer to the previous record.
 @return pointer to previous record */
+template <size_t PAGE_SIZE>
 static byte* page_rec_get_prev(const byte *page, byte* rec) {
-return((byte*) page_rec_get_prev_const(page, rec));
+return((byte*) page_rec_get_prev_const<PAGE_SIZE>(page, rec));
 }
 /***********************************************************//**
 Parses a log record of a record insert on a page.
 @return end of log record or NULL */
+template <size_t PAGE_SIZE>
 static byte*
 page_cur_parse_insert_rec(
     bool is_short,
@@ -1519,7 +1566,7 @@ page_cur_parse_insert_rec(
   uint32_t info_and_status_bits = 0;
 
   if (is_short) {
-    cursor_rec = page_rec_get_prev(page->GetData(), page_get_supremum_rec(page->GetData()));
+    cursor_rec = page_rec_get_prev<PAGE_SIZE>(page->GetData(), page_get_supremum_rec(page->GetData()));
   } else {
     /* Read the cursor rec offset as a 2-byte ulint */
 
@@ -1530,7 +1577,7 @@ page_cur_parse_insert_rec(
     ptr += 2;
 
     // log文件损坏
-    assert(offset < DATA_PAGE_SIZE);
+    assert(offset < PAGE_SIZE);
     cursor_rec = page->GetData() + offset; // 上一条记录的位置
   }
 
@@ -1539,7 +1586,7 @@ page_cur_parse_insert_rec(
   uint32_t end_seg_len = mach_parse_compressed(&ptr, end_ptr);
   assert(ptr != nullptr);
 
-  if (end_seg_len >= DATA_PAGE_SIZE << 1) {
+  if (end_seg_len >= PAGE_SIZE << 1) {
     // 到这说明这条log损坏了
     return nullptr;
   }
@@ -1562,7 +1609,7 @@ page_cur_parse_insert_rec(
       return nullptr;
     }
 
-    assert(origin_offset < DATA_PAGE_SIZE);
+    assert(origin_offset < PAGE_SIZE);
 
     // 解析出mismatch_index
     mismatch_index = mach_parse_compressed(&ptr, end_ptr);
@@ -1571,7 +1618,7 @@ page_cur_parse_insert_rec(
       return nullptr;
     }
 
-    assert(mismatch_index < DATA_PAGE_SIZE);
+    assert(mismatch_index < PAGE_SIZE);
   }
 
   if (end_ptr < ptr + (end_seg_len >> 1)) {
@@ -1610,13 +1657,14 @@ page_cur_parse_insert_rec(
   rec_info.CalculateOffsets(ULINT_UNDEFINED);
 
   // 插入记录
-  page_cur_insert_rec_low(page->GetData(), pre_rec_info, cursor_rec, rec_info, rec_info.GetRecPtr());
+  page_cur_insert_rec_low<PAGE_SIZE>(page->GetData(), pre_rec_info, cursor_rec, rec_info, rec_info.GetRecPtr());
 
   if (buf != buf1) {
     free(buf);
   }
   return(const_cast<byte*>(ptr + end_seg_len));
 }
+template <size_t PAGE_SIZE>
 bool ApplyCompRecInsert(const LogEntry &log, Page *page) {
   RecordInfo inserted_rec_info;
   const byte *ptr = log.log_body_start_ptr_;
@@ -1641,14 +1689,14 @@ bool ApplyCompRecInsert(const LogEntry &log, Page *page) {
   uint32_t offset = mach_read_from_2(ptr);
   ptr += 2;
 
-  assert(offset < DATA_PAGE_SIZE);
+  assert(offset < PAGE_SIZE);
   cursor_rec = page->GetData() + offset; // 上一条记录的位置
 
   // 解析出end_seg_len属性
   uint32_t end_seg_len = mach_parse_compressed(&ptr, end_ptr);
   assert(ptr != nullptr);
 
-  if (end_seg_len >= DATA_PAGE_SIZE << 1) {
+  if (end_seg_len >= PAGE_SIZE << 1) {
     // 到这说明这条log损坏了
     return false;
   }
@@ -1671,7 +1719,7 @@ bool ApplyCompRecInsert(const LogEntry &log, Page *page) {
       return false;
     }
 
-    assert(origin_offset < DATA_PAGE_SIZE);
+    assert(origin_offset < PAGE_SIZE);
 
     // 解析出mismatch_index
     mismatch_index = mach_parse_compressed(&ptr, end_ptr);
@@ -1680,7 +1728,7 @@ bool ApplyCompRecInsert(const LogEntry &log, Page *page) {
       return false;
     }
 
-    assert(mismatch_index < DATA_PAGE_SIZE);
+    assert(mismatch_index < PAGE_SIZE);
   }
 
   if (end_ptr < ptr + (end_seg_len >> 1)) {
@@ -1719,7 +1767,7 @@ bool ApplyCompRecInsert(const LogEntry &log, Page *page) {
   inserted_rec_info.CalculateOffsets(ULINT_UNDEFINED);
 
   // 插入记录
-  page_cur_insert_rec_low(page->GetData(), pre_rec_info, cursor_rec, inserted_rec_info, inserted_rec_info.GetRecPtr());
+  page_cur_insert_rec_low<PAGE_SIZE>(page->GetData(), pre_rec_info, cursor_rec, inserted_rec_info, inserted_rec_info.GetRecPtr());
 
   if (buf != buf1) {
     free(buf);
@@ -1838,6 +1886,7 @@ row_upd_rec_sys_fields_in_recovery(
   trx_write_roll_ptr(field + DATA_TRX_ID_LEN, roll_ptr);
 }
 
+template <size_t PAGE_SIZE>
 bool ApplyCompRecClusterDeleteMark(const LogEntry &log, Page *page) {
   RecordInfo deleted_rec_info;
   const byte *ptr = log.log_body_start_ptr_;
@@ -1879,7 +1928,7 @@ bool ApplyCompRecClusterDeleteMark(const LogEntry &log, Page *page) {
   offset = mach_read_from_2(ptr);
   ptr += 2;
 
-  assert(offset <= DATA_PAGE_SIZE);
+  assert(offset <= PAGE_SIZE);
 
   rec = page->GetData() + offset;
 
@@ -1901,6 +1950,7 @@ bool ApplyCompRecClusterDeleteMark(const LogEntry &log, Page *page) {
   return true;
 }
 
+template <size_t PAGE_SIZE>
 bool ApplyRecSecondDeleteMark(const LogEntry &log, Page *page) {
   const byte *ptr = log.log_body_start_ptr_;
   const byte *end_ptr = log.log_body_end_ptr_;
@@ -1917,7 +1967,7 @@ bool ApplyRecSecondDeleteMark(const LogEntry &log, Page *page) {
   offset = mach_read_from_2(ptr);
   ptr += 2;
 
-  assert(offset <= DATA_PAGE_SIZE);
+  assert(offset <= PAGE_SIZE);
 
   rec = page->GetData() + offset;
 
@@ -1929,14 +1979,16 @@ bool ApplyRecSecondDeleteMark(const LogEntry &log, Page *page) {
 
 /**********************************************************//**
 Moves the cursor to the next record on page. */
+template <size_t PAGE_SIZE>
 static byte*
 page_cur_move_to_next(byte *page, byte*	rec) {
-  return page_rec_get_next(page, rec);
+  return page_rec_get_next<PAGE_SIZE>(page, rec);
 }
 /**************************************************************//**
 Used to delete n slots from the directory. This function updates
 also n_owned fields in the records, so that the first slot after
 the deleted ones inherits the records of the deleted slots. */
+template <size_t PAGE_SIZE>
 static void
 page_dir_delete_slot(byte* page, uint32_t slot_no) {
   assert(slot_no > 0);
@@ -1947,38 +1999,42 @@ page_dir_delete_slot(byte* page, uint32_t slot_no) {
 
   /* 1. Reset the n_owned fields of the slots to be
   deleted */
-  byte *slot = page_dir_get_nth_slot(page, slot_no);
+  byte *slot = page_dir_get_nth_slot<PAGE_SIZE>(page, slot_no);
   uint32_t n_owned = page_dir_slot_get_n_owned(page, slot);
   page_dir_slot_set_n_owned(page, slot, 0);
 
   /* 2. Update the n_owned value of the first non-deleted slot */
 
-  slot = page_dir_get_nth_slot(page, slot_no + 1);
+  slot = page_dir_get_nth_slot<PAGE_SIZE>(page, slot_no + 1);
   page_dir_slot_set_n_owned(page, slot,
                             n_owned + page_dir_slot_get_n_owned(page, slot));
 
   /* 3. Destroy the slot by copying slots */
   for (uint32_t i = slot_no + 1; i < n_slots; i++) {
-    byte* rec = const_cast<byte*>(page_dir_slot_get_rec(page, page_dir_get_nth_slot(page, i)));
-    page_dir_slot_set_rec(page, page_dir_get_nth_slot(page, i - 1), rec);
+    byte* rec = const_cast<byte*>(page_dir_slot_get_rec(page, page_dir_get_nth_slot<PAGE_SIZE>(page, i)));
+    page_dir_slot_set_rec(page, page_dir_get_nth_slot<PAGE_SIZE>(page, i - 1), rec);
   }
 
   /* 4. Zero out the last slot, which will be removed */
-  mach_write_to_2(page_dir_get_nth_slot(page, n_slots - 1), 0);
+  mach_write_to_2(page_dir_get_nth_slot<PAGE_SIZE>(page, n_slots - 1), 0);
 
   /* 5. Update the page header */
   page_header_set_field(page, PAGE_N_DIR_SLOTS, n_slots - 1);
+
+  /* 6. slot_no之后的slot都往下移了一个位置 */
+  PageDirIndex::Local().Renumber<PAGE_SIZE>(page, slot_no);
 }
 
 /*************************************************************//**
 Tries to balance the given directory slot with too few records with the upper
 neighbor, so that there are at least the minimum number of records owned by
 the slot; this may result in the merging of two slots. */
+template <size_t PAGE_SIZE>
 static void page_dir_balance_slot(byte* page, uint32_t slot_no) {
   assert(page);
   assert(slot_no > 0);
 
-  byte *slot = page_dir_get_nth_slot(page, slot_no);
+  byte *slot = page_dir_get_nth_slot<PAGE_SIZE>(page, slot_no);
 
   /* The last directory slot cannot be balanced with the upper
   neighbor, as there is none. */
@@ -1987,7 +2043,7 @@ static void page_dir_balance_slot(byte* page, uint32_t slot_no) {
     return;
   }
 
-  byte *up_slot = page_dir_get_nth_slot(page, slot_no + 1);
+  byte *up_slot = page_dir_get_nth_slot<PAGE_SIZE>(page, slot_no + 1);
 
   uint32_t n_owned = page_dir_slot_get_n_owned(page, slot);
   uint32_t up_n_owned = page_dir_slot_get_n_owned(page, up_slot);
@@ -2004,22 +2060,24 @@ static void page_dir_balance_slot(byte* page, uint32_t slot_no) {
     by the upper slot to the property of the lower slot */
     byte *old_rec = const_cast<byte *>(page_dir_slot_get_rec(page, slot));
 
-    byte *new_rec = rec_get_next_ptr(page, old_rec);
+    byte *new_rec = rec_get_next_ptr<PAGE_SIZE>(page, old_rec);
 
     rec_set_n_owned_new(old_rec, 0);
     rec_set_n_owned_new(new_rec, n_owned + 1);
 
     page_dir_slot_set_rec(page, slot, new_rec);
+    PageDirIndex::Local().Update<PAGE_SIZE>(page, slot_no);
 
     page_dir_slot_set_n_owned(page, up_slot, up_n_owned -1);
   } else {
     /* In this case we may merge the two slots */
-    page_dir_delete_slot(page, slot_no);
+    page_dir_delete_slot<PAGE_SIZE>(page, slot_no);
   }
 }
 
 /************************************************************//**
 Puts a record to free list. */
+template <size_t PAGE_SIZE>
 static
 void
 page_mem_free(
@@ -2033,7 +2091,7 @@ page_mem_free(
 
   free = page_header_get_ptr(page, PAGE_FREE);
 
-  page_rec_set_next(page, rec, free);
+  page_rec_set_next<PAGE_SIZE>(page, rec, free);
   page_header_set_ptr(page, PAGE_FREE, rec);
 
   garbage = page_header_get_field(page, PAGE_GARBAGE);
@@ -2048,6 +2106,7 @@ page_mem_free(
 /***********************************************************//**
 Deletes a record at the page rec_ptr. The rec_ptr is moved to the next
 record after the deleted one. */
+template <size_t PAGE_SIZE>
 static byte*
 page_cur_delete_rec(byte *page, byte* rec_ptr, const RecordInfo &deleted_rec_info)
 {
@@ -2055,9 +2114,9 @@ page_cur_delete_rec(byte *page, byte* rec_ptr, const RecordInfo &deleted_rec_inf
   byte *current_rec = rec_ptr;
 
   /* Save to local variables some data associated with current_rec */
-  uint32_t cur_slot_no = page_dir_find_owner_slot(page, current_rec);
+  uint32_t cur_slot_no = page_dir_find_owner_slot<PAGE_SIZE>(page, current_rec);
   assert(cur_slot_no > 0);
-  byte *cur_dir_slot = page_dir_get_nth_slot(page, cur_slot_no);
+  byte *cur_dir_slot = page_dir_get_nth_slot<PAGE_SIZE>(page, cur_slot_no);
   uint32_t cur_n_owned = page_dir_slot_get_n_owned(page, cur_dir_slot);
 
   /* 1. Reset the last insert info in the page header and increment
@@ -2072,23 +2131,31 @@ page_cur_delete_rec(byte *page, byte* rec_ptr, const RecordInfo &deleted_rec_inf
 
   /* 2. Find the next and the previous record. Note that the rec_ptr is
   left at the next record. */
-  byte *prev_slot = page_dir_get_nth_slot(page, cur_slot_no - 1);
+  PageDirIndex &dir_index = PageDirIndex::Local();
+  uint32_t prev_offs;
+  if (dir_index.FindPrev<PAGE_SIZE>(page, current_rec - page, prev_offs)) {
+    prev_rec = page + prev_offs;
+  } else {
+    byte *prev_slot = page_dir_get_nth_slot<PAGE_SIZE>(page, cur_slot_no - 1);
 
-  byte *rec = const_cast<byte*>(page_dir_slot_get_rec(page, prev_slot));
+    byte *rec = const_cast<byte*>(page_dir_slot_get_rec(page, prev_slot));
 
-  /* rec now points to the record of the previous directory slot. Look
-  for the immediate predecessor of current_rec in a loop. */
+    /* rec now points to the record of the previous directory slot. Look
+    for the immediate predecessor of current_rec in a loop. */
 
-  while (current_rec != rec) {
-    prev_rec = rec;
-    rec = page_rec_get_next(page, rec);
+    while (current_rec != rec) {
+      prev_rec = rec;
+      rec = page_rec_get_next<PAGE_SIZE>(page, rec);
+    }
   }
 
-  byte *next_rec = page_cur_move_to_next(page, current_rec);
+  byte *next_rec = page_cur_move_to_next<PAGE_SIZE>(page, current_rec);
   rec_ptr = next_rec;
   /* 3. Remove the record from the linked list of records */
 
-  page_rec_set_next(page, prev_rec, next_rec);
+  page_rec_set_next<PAGE_SIZE>(page, prev_rec, next_rec);
+  // 连续删除时下一条要删的记录的前一条还是prev_rec
+  dir_index.RememberPrev(page, next_rec - page, prev_rec - page);
 
   /* 4. If the deleted record is pointed to by a dir slot, update the
   record pointer in slot. In the following if-clause we assume that
@@ -2098,6 +2165,7 @@ page_cur_delete_rec(byte *page, byte* rec_ptr, const RecordInfo &deleted_rec_inf
 
   if (current_rec == page_dir_slot_get_rec(page, cur_dir_slot)) {
     page_dir_slot_set_rec(page, cur_dir_slot, prev_rec);
+    dir_index.Update<PAGE_SIZE>(page, cur_slot_no);
   }
 
   /* 5. Update the number of owned records of the slot */
@@ -2105,7 +2173,7 @@ page_cur_delete_rec(byte *page, byte* rec_ptr, const RecordInfo &deleted_rec_inf
   page_dir_slot_set_n_owned(page, cur_dir_slot, cur_n_owned - 1);
 
   /* 6. Free the memory occupied by the record */
-  page_mem_free(page, current_rec, deleted_rec_info);
+  page_mem_free<PAGE_SIZE>(page, current_rec, deleted_rec_info);
 
 
   /* 7. Now we have decremented the number of owned records of the slot.
@@ -2113,7 +2181,7 @@ page_cur_delete_rec(byte *page, byte* rec_ptr, const RecordInfo &deleted_rec_inf
   slots. */
 
   if (cur_n_owned <= PAGE_DIR_SLOT_MIN_N_OWNED) {
-    page_dir_balance_slot(page, cur_slot_no);
+    page_dir_balance_slot<PAGE_SIZE>(page, cur_slot_no);
   }
 
   return rec_ptr;
@@ -2149,6 +2217,7 @@ row_upd_rec_in_place(
                       update.fields_[i].len_);
   }
 }
+template <size_t PAGE_SIZE>
 bool ApplyCompRecUpdateInPlace(const LogEntry &log, Page *page) {
   RecordInfo update_rec_info;
   const byte *ptr = log.log_body_start_ptr_;
@@ -2191,7 +2260,7 @@ bool ApplyCompRecUpdateInPlace(const LogEntry &log, Page *page) {
   rec_offset = mach_read_from_2(ptr);
   ptr += 2;
 
-  assert(rec_offset <= DATA_PAGE_SIZE);
+  assert(rec_offset <= PAGE_SIZE);
 
 
   ptr = row_upd_index_parse(ptr, end_ptr, &update);
@@ -2217,6 +2286,7 @@ bool ApplyCompRecUpdateInPlace(const LogEntry &log, Page *page) {
   return true;
 }
 // Apply MLOG_COMP_REC_SEC_DELETE_MARK log.
+template <size_t PAGE_SIZE>
 bool ApplyCompRecSecondDeleteMark(const LogEntry &log, Page *page) {
   RecordInfo deleted_rec_info;
   const byte *ptr = log.log_body_start_ptr_;
@@ -2238,7 +2308,7 @@ bool ApplyCompRecSecondDeleteMark(const LogEntry &log, Page *page) {
   offset = mach_read_from_2(ptr);
   ptr += 2;
 
-  assert(offset <= DATA_PAGE_SIZE);
+  assert(offset <= PAGE_SIZE);
 
   rec = page->GetData() + offset;
 
@@ -2249,6 +2319,7 @@ bool ApplyCompRecSecondDeleteMark(const LogEntry &log, Page *page) {
 
 
 // Apply MLOG_COMP_REC_DELETE
+template <size_t PAGE_SIZE>
 bool ApplyCompRecDelete(const LogEntry &log, Page *page) {
   RecordInfo deleted_rec_info;
   const byte *ptr = log.log_body_start_ptr_;
@@ -2267,14 +2338,14 @@ bool ApplyCompRecDelete(const LogEntry &log, Page *page) {
   offset = mach_read_from_2(ptr);
   ptr += 2;
 
-  assert(offset <= DATA_PAGE_SIZE);
+  assert(offset <= PAGE_SIZE);
   // 即将要被delete掉的那条rec
   byte* deleted_rec = page->GetData() + offset;
 
   deleted_rec_info.SetRecPtr(deleted_rec);
   deleted_rec_info.CalculateOffsets(ULINT_UNDEFINED);
 
-  page_cur_delete_rec(page->GetData(), deleted_rec, deleted_rec_info);
+  page_cur_delete_rec<PAGE_SIZE>(page->GetData(), deleted_rec, deleted_rec_info);
   return true;
 }
 
@@ -2282,6 +2353,7 @@ bool ApplyCompRecDelete(const LogEntry &log, Page *page) {
 Returns the sum of the sizes of the records in the record list, excluding
 the infimum and supremum records.
 @return data in bytes */
+template <size_t PAGE_SIZE>
 static inline uint32_t page_get_data_size(const byte*	page) {
   uint32_t ret;
 
@@ -2289,7 +2361,7 @@ static inline uint32_t page_get_data_size(const byte*	page) {
                 - PAGE_NEW_SUPREMUM_END
                 - page_header_get_field(page, PAGE_GARBAGE));
 
-  assert(ret < DATA_PAGE_SIZE);
+  assert(ret < PAGE_SIZE);
 
   return(ret);
 }
@@ -2297,6 +2369,7 @@ static inline uint32_t page_get_data_size(const byte*	page) {
 Returns the maximum combined size of records which can be inserted on top
 of the record heap if a page is first reorganized.
 @return maximum combined size for inserted records */
+template <size_t PAGE_SIZE>
 static inline
 uint32_t
 page_get_max_insert_size_after_reorganize(
@@ -2307,10 +2380,10 @@ page_get_max_insert_size_after_reorganize(
   uint32_t	occupied;
   uint32_t	free_space;
 
-  occupied = page_get_data_size(page)
+  occupied = page_get_data_size<PAGE_SIZE>(page)
              + page_dir_calc_reserved_space(n_recs + page_get_n_recs(page));
 
-  free_space = page_get_free_space_of_empty();
+  free_space = page_get_free_space_of_empty<PAGE_SIZE>();
 
   if (occupied > free_space) {
 
@@ -2323,6 +2396,7 @@ page_get_max_insert_size_after_reorganize(
 Returns the number of records before the given record in chain.
 The number includes infimum and supremum records.
 @return number of records */
+template <size_t PAGE_SIZE>
 static inline uint32_t
 page_rec_get_n_recs_before(const byte *page, const byte* rec) {
   const byte* slot;
@@ -2331,12 +2405,12 @@ page_rec_get_n_recs_before(const byte *page, const byte* rec) {
 
   while (rec_get_n_owned_new(rec) == 0) {
 
-    rec = rec_get_next_ptr_const(page, rec);
+    rec = rec_get_next_ptr_const<PAGE_SIZE>(page, rec);
     n--;
   }
 
   for (int i = 0; ; i++) {
-    slot = page_dir_get_nth_slot(page, i);
+    slot = page_dir_get_nth_slot<PAGE_SIZE>(page, i);
     slot_rec = page_dir_slot_get_rec(page, slot);
 
     n += static_cast<int32_t>(rec_get_n_owned_new(slot_rec));
@@ -2350,7 +2424,7 @@ page_rec_get_n_recs_before(const byte *page, const byte* rec) {
   n--;
 
   assert(n >= 0);
-  assert((uint32_t) n < DATA_PAGE_SIZE / (REC_N_NEW_EXTRA_BYTES + 1));
+  assert((uint32_t) n < PAGE_SIZE / (REC_N_NEW_EXTRA_BYTES + 1));
 
   return static_cast<uint32_t>(n);
 }
@@ -2385,6 +2459,7 @@ IMPORTANT: The caller will have to update IBUF_BITMAP_FREE
 if new_block is a compressed leaf page in a secondary index.
 This has to be done either within the same mini-transaction,
 or by invoking ibuf_reset_free_bits() before mtr_commit(). */
+template <size_t PAGE_SIZE>
 static void
 page_copy_rec_list_end_no_locks(
 /*============================*/
@@ -2396,10 +2471,10 @@ page_copy_rec_list_end_no_locks(
 
   if (page_cur_is_before_first(from_page, from_rec)) {
 
-    from_rec = page_cur_move_to_next(from_page, from_rec);
+    from_rec = page_cur_move_to_next<PAGE_SIZE>(from_page, from_rec);
   }
 
-  assert(mach_read_from_2(to_page + DATA_PAGE_SIZE - 10) == PAGE_NEW_INFIMUM);
+  assert(mach_read_from_2(to_page + PAGE_SIZE - 10) == PAGE_NEW_INFIMUM);
 
   byte *to_rec = to_page + PAGE_NEW_INFIMUM;
 
@@ -2413,7 +2488,7 @@ page_copy_rec_list_end_no_locks(
     pre_rec_info.SetRecPtr(to_rec);
     insert_rec_info.CalculateOffsets(ULINT_UNDEFINED);
     pre_rec_info.CalculateOffsets(ULINT_UNDEFINED);
-    ins_rec = page_cur_insert_rec_low(to_page,
+    ins_rec = page_cur_insert_rec_low<PAGE_SIZE>(to_page,
                                       pre_rec_info,
                                       to_rec,
                                       insert_rec_info,
@@ -2423,7 +2498,7 @@ page_copy_rec_list_end_no_locks(
       exit(1);
     }
 
-    from_rec = page_cur_move_to_next(from_page, from_rec);
+    from_rec = page_cur_move_to_next<PAGE_SIZE>(from_page, from_rec);
     to_rec = ins_rec;
   }
 }
@@ -2450,6 +2525,7 @@ inline bool page_is_leaf(const byte*	page)	/*!< in: page */
 }
 
 
+template <size_t PAGE_SIZE>
 bool ApplyCompPageReorganize(const LogEntry &log, Page *page) {
   RecordInfo rec_info;
   const byte *ptr = log.log_body_start_ptr_;
@@ -2464,8 +2540,8 @@ bool ApplyCompPageReorganize(const LogEntry &log, Page *page) {
   byte *page_ptr = page->GetData();
   byte *infimum_rec = page_ptr + PAGE_NEW_INFIMUM;
 
-  uint32_t data_size1 = page_get_data_size(page_ptr);
-  uint32_t max_ins_size1 = page_get_max_insert_size_after_reorganize(page_ptr, 1);
+  uint32_t data_size1 = page_get_data_size<PAGE_SIZE>(page_ptr);
+  uint32_t max_ins_size1 = page_get_max_insert_size_after_reorganize<PAGE_SIZE>(page_ptr, 1);
 
   // Copy old page to a temporary space
   Page *temp_page = new Page(*page);
@@ -2473,10 +2549,10 @@ bool ApplyCompPageReorganize(const LogEntry &log, Page *page) {
   byte *temp_page_ptr = temp_page->GetData();
   /* Recreate the page: note that global data on page (possible
 	segment headers, next page-field, etc.) is preserved intact */
-  page_create_low(page_ptr);
+  page_create_low<PAGE_SIZE>(page_ptr);
 
   /* Copy the records from the temporary space to the recreated page; */
-  page_copy_rec_list_end_no_locks(page_ptr, temp_page_ptr, temp_page_ptr + PAGE_NEW_INFIMUM, rec_info);
+  page_copy_rec_list_end_no_locks<PAGE_SIZE>(page_ptr, temp_page_ptr, temp_page_ptr + PAGE_NEW_INFIMUM, rec_info);
 
   if (page_is_leaf(page_ptr)) {
     /* Copy max trx id to recreated page */
@@ -2486,8 +2562,8 @@ bool ApplyCompPageReorganize(const LogEntry &log, Page *page) {
   }
 
 
-  uint32_t data_size2 = page_get_data_size(page_ptr);
-  uint32_t max_ins_size2 = page_get_max_insert_size_after_reorganize(page_ptr, 1);
+  uint32_t data_size2 = page_get_data_size<PAGE_SIZE>(page_ptr);
+  uint32_t max_ins_size2 = page_get_max_insert_size_after_reorganize<PAGE_SIZE>(page_ptr, 1);
 
   if (data_size1 != data_size2 || max_ins_size1 != max_ins_size2) {
     std::cerr
@@ -2521,6 +2597,7 @@ dict_index_is_sec_or_ibuf(
 /*************************************************************//**
 Deletes records from a page from a given record onward, including that record.
 The infimum and supremum records are not deleted. */
+template <size_t PAGE_SIZE>
 static void
 page_delete_rec_list_end(
 /*=====================*/
@@ -2539,7 +2616,7 @@ page_delete_rec_list_end(
   uint32_t n_owned;
 
 
-  assert(size == ULINT_UNDEFINED || size < DATA_PAGE_SIZE);
+  assert(size == ULINT_UNDEFINED || size < PAGE_SIZE);
 
   if (rec - page == PAGE_NEW_SUPREMUM) {
     assert(n_recs == 0 || n_recs == ULINT_UNDEFINED);
@@ -2556,9 +2633,9 @@ page_delete_rec_list_end(
   /* The page gets invalid for optimistic searches: increment the
   frame modify clock */
 
-  prev_rec = page_rec_get_prev(page, rec);
+  prev_rec = page_rec_get_prev<PAGE_SIZE>(page, rec);
 
-  last_rec = page_rec_get_prev(page, page + PAGE_NEW_SUPREMUM);
+  last_rec = page_rec_get_prev<PAGE_SIZE>(page, page + PAGE_NEW_SUPREMUM);
 
   if ((size == ULINT_UNDEFINED) || (n_recs == ULINT_UNDEFINED)) {
     byte* rec2 = rec;
@@ -2575,17 +2652,17 @@ page_delete_rec_list_end(
       uint32_t data_size = rec_info.GetDataSize();
       uint32_t extra_size = rec_info.GetExtraSize();
       s = data_size + extra_size;
-      assert(rec2 - page + s - extra_size
-            < DATA_PAGE_SIZE);
-      assert(size + s < DATA_PAGE_SIZE);
+      assert(static_cast<size_t>(rec2 - page) + s - extra_size
+            < PAGE_SIZE);
+      assert(size + s < PAGE_SIZE);
       size += s;
       n_recs++;
 
-      rec2 = page_rec_get_next(page, rec2);
+      rec2 = page_rec_get_next<PAGE_SIZE>(page, rec2);
     } while (rec2 - page != PAGE_NEW_SUPREMUM);
   }
 
-  assert(size < DATA_PAGE_SIZE);
+  assert(size < PAGE_SIZE);
 
   /* Update the page directory; there is no need to balance the number
   of the records owned by the supremum record, as it is allowed to be
@@ -2597,27 +2674,29 @@ page_delete_rec_list_end(
   while (rec_get_n_owned_new(rec2) == 0) {
     count++;
 
-    rec2 = rec_get_next_ptr(page, rec2);
+    rec2 = rec_get_next_ptr<PAGE_SIZE>(page, rec2);
   }
 
   assert(rec_get_n_owned_new(rec2) > count);
 
   n_owned = rec_get_n_owned_new(rec2) - count;
-  slot_index = page_dir_find_owner_slot(page, rec2);
+  slot_index = page_dir_find_owner_slot<PAGE_SIZE>(page, rec2);
   assert(slot_index > 0);
-  slot = page_dir_get_nth_slot(page, slot_index);
+  slot = page_dir_get_nth_slot<PAGE_SIZE>(page, slot_index);
 
   page_dir_slot_set_rec(page, slot, page_get_supremum_rec(page));
+  PageDirIndex::Local().Update<PAGE_SIZE>(page, slot_index);
   page_dir_slot_set_n_owned(page, slot, n_owned);
 
   page_dir_set_n_slots(page, slot_index + 1);
 
   /* Remove the record chain segment from the record chain */
-  page_rec_set_next(page, prev_rec, page_get_supremum_rec(page));
+  page_rec_set_next<PAGE_SIZE>(page, prev_rec, page_get_supremum_rec(page));
+  PageDirIndex::Local().Invalidate();
 
   /* Catenate the deleted chain segment to the page free list */
 
-  page_rec_set_next(page, last_rec, page_header_get_ptr(page, PAGE_FREE));
+  page_rec_set_next<PAGE_SIZE>(page, last_rec, page_header_get_ptr(page, PAGE_FREE));
   page_header_set_ptr(page, PAGE_FREE, rec);
 
   page_header_set_field(page, PAGE_GARBAGE, size + page_header_get_field(page, PAGE_GARBAGE));
@@ -2645,6 +2724,7 @@ page_update_max_trx_id(byte* page, trx_id_t trx_id) {
 
 /**********************************************************//**
 Empty a previously created B-tree index page. */
+template <size_t PAGE_SIZE>
 static void page_create_empty(
 /*==============*/
     byte*	page,	/*!< in/out: B-tree block */
@@ -2657,7 +2737,7 @@ static void page_create_empty(
     assert(max_trx_id);
   }
 
-  page_create_low(page);
+  page_create_low<PAGE_SIZE>(page);
 
   if (max_trx_id) {
     page_update_max_trx_id(page, max_trx_id);
@@ -2668,6 +2748,7 @@ static void page_create_empty(
 /*************************************************************//**
 Deletes records from page, up to the given record, NOT including
 that record. Infimum and supremum records are not deleted. */
+template <size_t PAGE_SIZE>
 void
 page_delete_rec_list_start(
 /*=======================*/
@@ -2682,12 +2763,12 @@ page_delete_rec_list_start(
 
   if (rec - page == PAGE_NEW_SUPREMUM) {
     /* We are deleting all records. */
-    page_create_empty(page, index);
+    page_create_empty<PAGE_SIZE>(page, index);
     return;
   }
 
   byte *delete_rec = page + PAGE_NEW_INFIMUM;
-  delete_rec = page_cur_move_to_next(page, delete_rec);
+  delete_rec = page_cur_move_to_next<PAGE_SIZE>(page, delete_rec);
 
   /* Individual deletes are not logged */
 
@@ -2696,11 +2777,12 @@ page_delete_rec_list_start(
     RecordInfo rec_info(index);
     rec_info.SetRecPtr(delete_rec);
     rec_info.CalculateOffsets(ULINT_UNDEFINED);
-    delete_rec = page_cur_delete_rec(page, delete_rec, rec_info);
+    delete_rec = page_cur_delete_rec<PAGE_SIZE>(page, delete_rec, rec_info);
   }
 }
 
 
+template <size_t PAGE_SIZE>
 bool ApplyCompListDelete(const LogEntry &log, Page *page) {
   RecordInfo rec_info;
   const byte *ptr = log.log_body_start_ptr_;
@@ -2722,16 +2804,17 @@ bool ApplyCompListDelete(const LogEntry &log, Page *page) {
   ptr += 2;
 
   if (log.type_ == MLOG_COMP_LIST_END_DELETE) {
-    page_delete_rec_list_end(page_ptr + offset, page_ptr, rec_info,
+    page_delete_rec_list_end<PAGE_SIZE>(page_ptr + offset, page_ptr, rec_info,
                              ULINT_UNDEFINED, ULINT_UNDEFINED);
   } else {
-    page_delete_rec_list_start(page_ptr + offset, page_ptr, rec_info);
+    page_delete_rec_list_start<PAGE_SIZE>(page_ptr + offset, page_ptr, rec_info);
   }
 
   return true;
 }
 
 
+template <size_t PAGE_SIZE>
 bool ApplyIBufBitmapInit(const LogEntry &log, Page *page) {
   byte *ptr = log.log_body_start_ptr_;
   byte *end_ptr = log.log_body_end_ptr_;
@@ -2740,7 +2823,7 @@ bool ApplyIBufBitmapInit(const LogEntry &log, Page *page) {
 
   /* Write all zeros to the bitmap */
 
-  uint32_t byte_offset = ((DATA_PAGE_SIZE * IBUF_BITS_PER_PAGE) + 7) / 8;
+  uint32_t byte_offset = ((PAGE_SIZE * IBUF_BITS_PER_PAGE) + 7) / 8;
 
   std::memset(page->GetData() + IBUF_BITMAP, 0, byte_offset);
 
@@ -2748,6 +2831,7 @@ bool ApplyIBufBitmapInit(const LogEntry &log, Page *page) {
 }
 
 
+template <size_t PAGE_SIZE>
 bool ApplyCompListEndCopyCreated(const LogEntry &log, Page *page) {
   RecordInfo rec_info;
   byte *ptr = log.log_body_start_ptr_;
@@ -2777,7 +2861,7 @@ bool ApplyCompListEndCopyCreated(const LogEntry &log, Page *page) {
 
 
   while (ptr < rec_end) {
-    ptr = page_cur_parse_insert_rec(true, ptr, end_ptr, page, rec_info);
+    ptr = page_cur_parse_insert_rec<PAGE_SIZE>(true, ptr, end_ptr, page, rec_info);
   }
 
   assert(ptr == rec_end);
@@ -2792,6 +2876,7 @@ bool ApplyCompListEndCopyCreated(const LogEntry &log, Page *page) {
 }
 
 
+template <size_t PAGE_SIZE>
 byte* ParseOrApplyString(byte* log_body_start_ptr, const byte* log_body_end_ptr, byte* page) {
   uint32_t offset;
   uint32_t len;
@@ -2806,8 +2891,8 @@ byte* ParseOrApplyString(byte* log_body_start_ptr, const byte* log_body_end_ptr,
   len = mach_read_from_2(log_body_start_ptr);
   log_body_start_ptr += 2;
 
-  assert(offset < DATA_PAGE_SIZE);
-  assert(len + offset <= DATA_PAGE_SIZE);
+  assert(offset < PAGE_SIZE);
+  assert(len + offset <= PAGE_SIZE);
 
   if (log_body_end_ptr < log_body_start_ptr + len) {
     return nullptr;
@@ -2829,6 +2914,7 @@ specified.
 @param[in]	space_id	tablespace identifier
 @param[in]	page_no		page number
 @return log record end, nullptr if not a complete record */
+template <size_t PAGE_SIZE>
 static byte* ParseSingleLogRecordBody(LOG_TYPE	type,
                                       byte* ptr,
                                       const byte* end_ptr,
@@ -2860,17 +2946,17 @@ static byte* ParseSingleLogRecordBody(LOG_TYPE	type,
     case MLOG_2BYTES:
     case MLOG_4BYTES:
     case MLOG_8BYTES:
-      ptr = ParseOrApplyNBytes(type, ptr, end_ptr, nullptr);
+      ptr = ParseOrApplyNBytes<PAGE_SIZE>(type, ptr, end_ptr, nullptr);
       break;
     case MLOG_REC_INSERT:
     case MLOG_COMP_REC_INSERT:
       if (nullptr != (ptr = mlog_parse_index(ptr, end_ptr,type == MLOG_COMP_REC_INSERT))) {
-        ptr = PARSE_MLOG_REC_INSERT(false, ptr, end_ptr);
+        ptr = PARSE_MLOG_REC_INSERT<PAGE_SIZE>(false, ptr, end_ptr);
       }
       break;
     case MLOG_REC_CLUST_DELETE_MARK: case MLOG_COMP_REC_CLUST_DELETE_MARK:
       if (nullptr != (ptr = mlog_parse_index(ptr, end_ptr,type == MLOG_COMP_REC_CLUST_DELETE_MARK))) {
-        ptr = PARSE_MLOG_REC_CLUST_DELETE_MARK(ptr, end_ptr);
+        ptr = PARSE_MLOG_REC_CLUST_DELETE_MARK<PAGE_SIZE>(ptr, end_ptr);
       }
       break;
     case MLOG_COMP_REC_SEC_DELETE_MARK:
@@ -2880,12 +2966,12 @@ static byte* ParseSingleLogRecordBody(LOG_TYPE	type,
       }
       /* Fall through */
     case MLOG_REC_SEC_DELETE_MARK:
-      ptr = PARSE_MLOG_REC_SEC_DELETE_MARK(ptr, end_ptr);
+      ptr = PARSE_MLOG_REC_SEC_DELETE_MARK<PAGE_SIZE>(ptr, end_ptr);
       break;
     case MLOG_REC_UPDATE_IN_PLACE:
     case MLOG_COMP_REC_UPDATE_IN_PLACE:
       if (nullptr != (ptr = mlog_parse_index(ptr, end_ptr,type == MLOG_COMP_REC_UPDATE_IN_PLACE))) {
-        ptr = PARSE_MLOG_REC_UPDATE_IN_PLACE(ptr, end_ptr);
+        ptr = PARSE_MLOG_REC_UPDATE_IN_PLACE<PAGE_SIZE>(ptr, end_ptr);
       }
       break;
     case MLOG_LIST_END_DELETE:
@@ -2925,7 +3011,7 @@ static byte* ParseSingleLogRecordBody(LOG_TYPE	type,
       ptr = PARSE_OR_APPLY_ADD_UNDO_REC(ptr, end_ptr, nullptr);
       break;
     case MLOG_UNDO_ERASE_END:
-      ptr = PARSE_OR_APPLY_UNDO_ERASE_PAGE_END(ptr, end_ptr, nullptr);
+      ptr = PARSE_OR_APPLY_UNDO_ERASE_PAGE_END<PAGE_SIZE>(ptr, end_ptr, nullptr);
       break;
     case MLOG_UNDO_INIT:
       ptr = PARSE_OR_APPLY_UNDO_PAGE_INIT(ptr, end_ptr, nullptr);
@@ -2935,7 +3021,7 @@ static byte* ParseSingleLogRecordBody(LOG_TYPE	type,
       break;
     case MLOG_UNDO_HDR_CREATE:
     case MLOG_UNDO_HDR_REUSE:
-      ptr = ParseOrApplyTrxUndoPageHeader(type, ptr, end_ptr,nullptr);
+      ptr = ParseOrApplyTrxUndoPageHeader<PAGE_SIZE>(type, ptr, end_ptr,nullptr);
       break;
     case MLOG_REC_MIN_MARK:
     case MLOG_COMP_REC_MIN_MARK:
@@ -2949,7 +3035,7 @@ static byte* ParseSingleLogRecordBody(LOG_TYPE	type,
       if (nullptr != (ptr = mlog_parse_index(ptr, end_ptr,
                                              type == MLOG_COMP_REC_DELETE))) {
 
-        ptr = ParseDeleteRec(ptr, end_ptr, nullptr);
+        ptr = ParseDeleteRec<PAGE_SIZE>(ptr, end_ptr, nullptr);
       }
       break;
     case MLOG_IBUF_BITMAP_INIT:
@@ -2961,7 +3047,7 @@ static byte* ParseSingleLogRecordBody(LOG_TYPE	type,
       // 该类型的日志解析不会干任何事，没有body
       break;
     case MLOG_WRITE_STRING:
-      ptr = ParseOrApplyString(ptr, end_ptr, nullptr);
+      ptr = ParseOrApplyString<PAGE_SIZE>(ptr, end_ptr, nullptr);
       break;
       // ZIP页不管它
     case MLOG_ZIP_WRITE_NODE_PTR:
@@ -2978,6 +3064,7 @@ static byte* ParseSingleLogRecordBody(LOG_TYPE	type,
   return(ptr);
 }
 
+template <size_t PAGE_SIZE>
 uint32_t ParseSingleLogRecord(LOG_TYPE &type,
                      const byte* ptr,
                      const byte* end_ptr,
@@ -3031,10 +3118,32 @@ uint32_t ParseSingleLogRecord(LOG_TYPE &type,
   *body = const_cast<byte *>(new_ptr);
   // 4. 解析log body
 
-  new_ptr = ParseSingleLogRecordBody(type, const_cast<byte *>(new_ptr), end_ptr, space_id, page_id);
+  new_ptr = ParseSingleLogRecordBody<PAGE_SIZE>(type, const_cast<byte *>(new_ptr), end_ptr, space_id, page_id);
 
   if (new_ptr == nullptr) return 0;
   return(new_ptr - ptr);
 }
 
+// 每一种page大小实例化一份，ApplySystem在启动时选择和数据目录相同的那一份
+#define INSTANTIATE_APPLY_FUNCTIONS(PAGE_SIZE) \
+  template uint32_t ParseSingleLogRecord<PAGE_SIZE>(LOG_TYPE &type, const byte *ptr, const byte *end_ptr, \
+                                                    space_id_t &space_id, page_id_t &page_id, byte **body); \
+  template byte *ParseOrApplyNBytes<PAGE_SIZE>(LOG_TYPE type, const byte *log_body_start_ptr, \
+                                               const byte *log_body_end_ptr, byte *page); \
+  template byte *ParseOrApplyString<PAGE_SIZE>(byte *log_body_start_ptr, const byte *log_body_end_ptr, byte *page); \
+  template byte *ApplyCompPageCreate<PAGE_SIZE>(byte *page); \
+  template bool ApplyInitFilePage2<PAGE_SIZE>(const LogEntry &log, Page *page); \
+  template bool ApplyCompRecInsert<PAGE_SIZE>(const LogEntry &log, Page *page); \
+  template bool ApplyCompRecClusterDeleteMark<PAGE_SIZE>(const LogEntry &log, Page *page); \
+  template bool ApplyRecSecondDeleteMark<PAGE_SIZE>(const LogEntry &log, Page *page); \
+  template bool ApplyCompRecUpdateInPlace<PAGE_SIZE>(const LogEntry &log, Page *page); \
+  template bool ApplyCompRecSecondDeleteMark<PAGE_SIZE>(const LogEntry &log, Page *page); \
+  template bool ApplyCompRecDelete<PAGE_SIZE>(const LogEntry &log, Page *page); \
+  template bool ApplyCompListEndCopyCreated<PAGE_SIZE>(const LogEntry &log, Page *page); \
+  template bool ApplyCompPageReorganize<PAGE_SIZE>(const LogEntry &log, Page *page); \
+  template bool ApplyCompListDelete<PAGE_SIZE>(const LogEntry &log, Page *page); \
+  template bool ApplyIBufBitmapInit<PAGE_SIZE>(const LogEntry &log, Page *page);
+FOR_EACH_PAGE_SIZE(INSTANTIATE_APPLY_FUNCTIONS)
+#undef INSTANTIATE_APPLY_FUNCTIONS
+
 }
@@ -0,0 +1,81 @@
+#include "scheduler.h"
+#include <algorithm>
+namespace Lemon {
+
+WorkStealingScheduler::WorkStealingScheduler(uint32_t n_workers) :
+    queues_() {
+  queues_.reserve(n_workers);
+  for (uint32_t i = 0; i < n_workers; ++i) {
+    queues_.emplace_back(new TaskQueue());
+  }
+}
+
+uint64_t WorkStealingScheduler::EstimateCost(const std::vector<LogEntry> &logs) {
+  uint64_t cost = logs.size() * COST_PER_LOG;
+  for (const auto &log: logs) {
+    cost += log.log_len_;
+  }
+  return cost;
+}
+
+void WorkStealingScheduler::Push(uint32_t worker, const ApplyTask &task) {
+  TaskQueue &queue = *queues_[worker];
+  queue.tasks_.push_back(task);
+  queue.remaining_cost_ += task.cost_;
+}
+
+void WorkStealingScheduler::Start() {
+  for (auto &queue: queues_) {
+    std::sort(queue->tasks_.begin(), queue->tasks_.end(),
+              [](const ApplyTask &a, const ApplyTask &b) {
+                return a.cost_ > b.cost_;
+              });
+  }
+}
+
+void WorkStealingScheduler::VisitTasks(const std::function<void(uint32_t, const ApplyTask &)> &visit) const {
+  for (const auto &queue: queues_) {
+    for (uint32_t i = 0; i < queue->tasks_.size(); ++i) {
+      visit(i, queue->tasks_[i]);
+    }
+  }
+}
+
+bool WorkStealingScheduler::PopFront(TaskQueue &queue, ApplyTask &task) {
+  std::lock_guard<std::mutex> guard(queue.latch_);
+  if (queue.tasks_.empty()) {
+    return false;
+  }
+  task = queue.tasks_.front();
+  queue.tasks_.pop_front();
+  queue.remaining_cost_ -= task.cost_;
+  return true;
+}
+
+bool WorkStealingScheduler::Next(uint32_t worker, ApplyTask &task, bool &stolen) {
+  stolen = false;
+  if (PopFront(*queues_[worker], task)) {
+    return true;
+  }
+  // 自己的任务做完了，每次都从剩余cost最大的worker那里偷
+  while (true) {
+    uint32_t victim = worker;
+    uint64_t max_cost = 0;
+    for (uint32_t i = 0; i < queues_.size(); ++i) {
+      uint64_t cost = queues_[i]->remaining_cost_.load(std::memory_order_relaxed);
+      if (i != worker && cost > max_cost) {
+        max_cost = cost;
+        victim = i;
+      }
+    }
+    if (victim == worker) {
+      return false;
+    }
+    if (PopFront(*queues_[victim], task)) {
+      stolen = true;
+      return true;
+    }
+  }
+}
+
+}
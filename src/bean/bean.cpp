@@ -26,6 +26,7 @@ void RecordInfo::AddField(uint32_t main_type, uint32_t precise_type, uint32_t le
   }
 //  data_size_ += length;
 
+  assert(fields_.size() < REC_MAX_N_FIELDS);
   int i = static_cast<int>(fields_.size());
 
 
@@ -86,12 +87,13 @@ void RecordInfo::CalculateOffsets(uint32_t max_n) {
 
   size = n + (1 + REC_OFFS_HEADER_SIZE);
 
-  // 分配内存
+  // 不超过INLINE_FIELDS列时offsets_放在对象内部，更多的列用线程缓存的数组，都不需要分配内存
   offsets_.resize(size);
 
   offsets_[1] = n;
 
   // offsets[2]和offsets[3]用不到
+  offsets_[0] = offsets_[2] = offsets_[3] = 0;
 
   const byte*	nulls;
   const byte*	lens;
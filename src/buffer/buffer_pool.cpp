@@ -1,192 +1,1384 @@
 #include "buffer_pool.h"
+#include "page_layout.h"
 #include <iostream>
 #include <random>
 #include <cstring>
 #include <cassert>
 #include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <tuple>
 namespace Lemon {
 Page::Page() :
-    data_(new unsigned char[DATA_PAGE_SIZE]),
-    state_(State::INVALID) {
+    data_(nullptr),
+    size_(0),
+    state_(State::INVALID),
+    owns_data_(false),
+    frame_id_(0) {
+
+}
+
+Page::Page(byte *data, size_t size) :
+    data_(data),
+    size_(size),
+    state_(State::INVALID),
+    owns_data_(false),
+    frame_id_(0) {
 
 }
 
 Page::~Page() {
-  if (data_ != nullptr) {
+  if (owns_data_ && data_ != nullptr) {
     delete[] data_;
-    data_ = nullptr;
   }
+  data_ = nullptr;
 }
 
 void Page::WriteCheckSum(uint32_t checksum) {
   mach_write_to_4(data_ + FIL_PAGE_SPACE_OR_CHKSUM, checksum);
-  mach_write_to_4(data_ + DATA_PAGE_SIZE - FIL_PAGE_END_LSN_OLD_CHKSUM, checksum);
+  mach_write_to_4(data_ + size_ - FIL_PAGE_END_LSN_OLD_CHKSUM, checksum);
 }
 
 Page::Page(const Page &other) :
-  data_(new unsigned char[DATA_PAGE_SIZE]),
-  state_(other.state_) {
+  data_(new unsigned char[other.size_]),
+  size_(other.size_),
+  state_(other.state_),
+  owns_data_(true),
+  frame_id_(0) {
+
+  std::memcpy(data_, other.data_, size_);
+}
+
+PageGuard::PageGuard(BufferPool *pool, Page *page, bool exclusive, bool latched) :
+    pool_(pool),
+    page_(page),
+    exclusive_(exclusive),
+    latched_(latched) {
+
+}
+
+PageGuard::PageGuard(PageGuard &&other) noexcept :
+    pool_(other.pool_),
+    page_(other.page_),
+    exclusive_(other.exclusive_),
+    latched_(other.latched_),
+    oldest_modification_(other.oldest_modification_),
+    newest_modification_(other.newest_modification_) {
+  other.page_ = nullptr;
+}
+
+PageGuard &PageGuard::operator=(PageGuard &&other) noexcept {
+  if (this != &other) {
+    Release();
+    pool_ = other.pool_;
+    page_ = other.page_;
+    exclusive_ = other.exclusive_;
+    latched_ = other.latched_;
+    oldest_modification_ = other.oldest_modification_;
+    newest_modification_ = other.newest_modification_;
+    other.page_ = nullptr;
+  }
+  return *this;
+}
+
+void PageGuard::MarkDirty(lsn_t oldest_modification, lsn_t newest_modification) {
+  assert(exclusive_);
+  if (oldest_modification_ == 0) {
+    oldest_modification_ = oldest_modification;
+  }
+  newest_modification_ = std::max(newest_modification_, newest_modification);
+}
+
+void PageGuard::Release() {
+  if (page_ == nullptr) {
+    return;
+  }
+  // 先释放page的锁，MarkDirty和UnpinPage需要拿分片的锁
+  if (latched_) {
+    pool_->UnlatchPage(page_, exclusive_);
+  }
+  if (newest_modification_ != 0) {
+    pool_->MarkDirty(page_, oldest_modification_, newest_modification_);
+  }
+  pool_->UnpinPage(page_);
+  page_ = nullptr;
+  oldest_modification_ = 0;
+  newest_modification_ = 0;
+}
+
+void PageHashTable::Reserve(uint32_t n) {
+  if (static_cast<uint64_t>(n) * 2 <= mask_ + 1 && !slots_.empty()) {
+    return;
+  }
+  std::vector<Slot> old_slots;
+  old_slots.swap(slots_);
+  Init(n);
+  for (const auto &slot: old_slots) {
+    if (slot.key_ != EMPTY_KEY) {
+      Insert(slot.key_, slot.frame_id_);
+    }
+  }
+}
+
+void PageHashTable::Init(uint32_t n) {
+  // 装载因子不超过1/2，线性探测的探测长度很短
+  uint32_t bits = 1;
+  while ((static_cast<uint64_t>(1) << bits) < static_cast<uint64_t>(n) * 2) {
+    bits++;
+  }
+  shift_ = 64 - bits;
+  mask_ = (static_cast<uint64_t>(1) << bits) - 1;
+  slots_.assign(mask_ + 1, {EMPTY_KEY, 0});
+}
+
+bool PageHashTable::Find(page_key_t key, frame_id_t &frame_id) const {
+  for (uint64_t i = Bucket(key); ; i = (i + 1) & mask_) {
+    const Slot &slot = slots_[i];
+    if (slot.key_ == key) {
+      frame_id = slot.frame_id_;
+      return true;
+    }
+    if (slot.key_ == EMPTY_KEY) {
+      return false;
+    }
+  }
+}
+
+void PageHashTable::Insert(page_key_t key, frame_id_t frame_id) {
+  uint64_t i = Bucket(key);
+  while (slots_[i].key_ != EMPTY_KEY) {
+    assert(slots_[i].key_ != key);
+    i = (i + 1) & mask_;
+  }
+  slots_[i] = {key, frame_id};
+}
 
-  std::memcpy(data_, other.data_, DATA_PAGE_SIZE);
+void PageHashTable::Erase(page_key_t key) {
+  uint64_t i = Bucket(key);
+  while (slots_[i].key_ != key) {
+    if (slots_[i].key_ == EMPTY_KEY) {
+      return;
+    }
+    i = (i + 1) & mask_;
+  }
+  // 把后面探测链上的元素往前挪，不需要墓碑
+  for (uint64_t j = (i + 1) & mask_; slots_[j].key_ != EMPTY_KEY; j = (j + 1) & mask_) {
+    uint64_t home = Bucket(slots_[j].key_);
+    // home不在(i, j]之间时，slot j可以挪到slot i
+    bool stay = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+    if (!stay) {
+      slots_[i] = slots_[j];
+      i = j;
+    }
+  }
+  slots_[i].key_ = EMPTY_KEY;
 }
 
 BufferPool::BufferPool() :
-    lru_list_(),
-    hash_map_(),
-    buffer_(new Page[BUFFER_POOL_SIZE]),
-    data_path_("/home/lemon/mysql/data"),
-    space_id_2_file_name_(),
-    free_list_(), frame_id_2_page_address_(BUFFER_POOL_SIZE) {
+    spaces_(MysqlHome() + "/data", MysqlHome() + "/parsed_logs/space_registry"),
+    page_size_(UNIV_PAGE_SIZE_DEF),
+    doublewrite_(MysqlHome() + "/parsed_logs/doublewrite"),
+    shards_(),
+    chunks_(BUFFER_POOL_MAX_CHUNKS) {
+
+}
 
-  // 1. 构建映射表
-  std::vector<std::string> filenames;
-  TravelDirectory(data_path_, ".ibd", filenames);
-  byte page_buf[DATA_PAGE_SIZE];
-  std::ifstream ifs;
-  for (auto & filename : filenames) {
-    ifs.open(filename, std::ios::binary | std::ios::in);
-    ifs.read(reinterpret_cast<char *>(page_buf), DATA_PAGE_SIZE);
-    uint32_t space_id = mach_read_from_4(page_buf + FIL_PAGE_ARCH_LOG_NO_OR_SPACE_ID);
-    ifs.close();
-    space_id_2_file_name_.insert({space_id, PageReaderWriter(filename)});
-//    std::cout << space_id << "->" << filename << std::endl;
+bool BufferPool::Init(uint64_t size_mb) {
+  // 1. 表空间文件在第一次用到时才去找，这里只读出page大小，frame的大小和它相同
+  size_t page_size = spaces_.DetectPageSize();
+  if (page_size != 0) {
+    page_size_ = page_size;
+  } else {
+    std::cerr << "can not read page size from data directory, use " << page_size_ << std::endl;
   }
+  spaces_.SetPageSize(page_size_);
 
-  // 2. 初始化free_list_
-  for (int i = 0; i < static_cast<int>(BUFFER_POOL_SIZE); ++i) {
-    free_list_.emplace_back(i);
+  // 2. 上一次写回的过程中崩溃时，表空间文件中可能有写坏了的page，apply之前先用doublewrite文件中的副本修复
+  if (doublewrite_.Open(page_size_)) {
+    doublewrite_.Recover(spaces_);
   }
+
+  // 3. 默认只有一个分片，分配需要的chunk
+  uint64_t n_chunks = size_mb == 0 ? BUFFER_POOL_SIZE / BUFFER_POOL_CHUNK_SIZE : ChunksForSize(size_mb);
+  if (n_chunks > BUFFER_POOL_MAX_CHUNKS) {
+    std::cerr << "buffer pool size " << size_mb << "MB is too large" << std::endl;
+    return false;
+  }
+  Partition(1);
+  return Resize(static_cast<uint32_t>(n_chunks));
 }
 
+uint64_t BufferPool::ChunksForSize(uint64_t size_mb) const {
+  uint64_t chunk_size = static_cast<uint64_t>(BUFFER_POOL_CHUNK_SIZE) * page_size_;
+  uint64_t n_chunks = (size_mb * 1024 * 1024 + chunk_size - 1) / chunk_size;
+  return std::max<uint64_t>(n_chunks, 1);
+}
 
 BufferPool::~BufferPool() {
-  if (buffer_ != nullptr) {
-    delete[] buffer_;
-    buffer_ = nullptr;
+  StopFlusher();
+  StopReaders();
+}
+
+void BufferPool::Partition(uint32_t n_shards) {
+  assert(n_shards > 0 && n_shards <= BUFFER_POOL_CHUNK_SIZE);
+  // 后台刷脏线程可能正在遍历分片
+  std::lock_guard<std::mutex> flush_guard(flush_latch_);
+  shards_.clear();
+  for (uint32_t i = 0; i < n_shards; ++i) {
+    shards_.emplace_back(new Shard());
+    shards_.back()->page_table_.Init(n_chunks_ * (BUFFER_POOL_CHUNK_SIZE / n_shards + 1));
+  }
+  for (uint32_t chunk_id = 0; chunk_id < n_chunks_; ++chunk_id) {
+    AttachChunk(chunk_id);
+  }
+}
+
+bool BufferPool::Resize(uint32_t n_chunks) {
+  if (n_chunks == 0 || n_chunks > BUFFER_POOL_MAX_CHUNKS) {
+    std::cerr << "invalid buffer pool size: " << n_chunks << " chunks" << std::endl;
+    return false;
+  }
+  // 和后台刷脏线程、FlushAll、DropSpace互斥，一次只有一个Resize
+  std::lock_guard<std::mutex> flush_guard(flush_latch_);
+  while (n_chunks_ < n_chunks) {
+    if (!AllocChunk(n_chunks_)) {
+      return false;
+    }
+    AttachChunk(n_chunks_);
+    n_chunks_++;
+  }
+  while (n_chunks_ > n_chunks) {
+    DetachChunk(n_chunks_ - 1);
+    chunks_[n_chunks_ - 1].reset();
+    n_chunks_--;
+  }
+  return true;
+}
+
+bool BufferPool::AllocChunk(uint32_t chunk_id) {
+  std::unique_ptr<Chunk> chunk(new Chunk());
+  // 所有frame的数据放在一整块对齐的内存中，Page只是指向其中一个frame
+  if (!chunk->arena_.Allocate(BUFFER_POOL_CHUNK_SIZE, page_size_)) {
+    return false;
+  }
+  if (lock_frames_) {
+    chunk->arena_.Lock();
+  }
+  chunk->frames_ = static_cast<FrameDescriptor *>(
+      aligned_alloc(CACHE_LINE_SIZE, sizeof(FrameDescriptor) * BUFFER_POOL_CHUNK_SIZE));
+  if (chunk->frames_ == nullptr) {
+    std::cerr << "allocate frame descriptors for buffer pool failed" << std::endl;
+    return false;
+  }
+  chunk->pages_.reset(new Page[BUFFER_POOL_CHUNK_SIZE]);
+  for (uint32_t i = 0; i < BUFFER_POOL_CHUNK_SIZE; ++i) {
+    new (&chunk->frames_[i]) FrameDescriptor();
+    chunk->pages_[i].data_ = chunk->arena_.GetFrame(i);
+    chunk->pages_[i].size_ = page_size_;
+    chunk->pages_[i].frame_id_ = chunk_id * BUFFER_POOL_CHUNK_SIZE + i;
+  }
+  chunks_[chunk_id] = std::move(chunk);
+  return true;
+}
+
+void BufferPool::AttachChunk(uint32_t chunk_id) {
+  // 第i个分片拥有chunk中的[i * BUFFER_POOL_CHUNK_SIZE / n_shards, (i + 1) * BUFFER_POOL_CHUNK_SIZE / n_shards)这些frame
+  frame_id_t base = chunk_id * BUFFER_POOL_CHUNK_SIZE;
+  auto n_shards = static_cast<uint32_t>(shards_.size());
+  for (uint32_t i = 0; i < n_shards; ++i) {
+    Shard &shard = *shards_[i];
+    frame_id_t begin = base + static_cast<frame_id_t>(static_cast<uint64_t>(i) * BUFFER_POOL_CHUNK_SIZE / n_shards);
+    frame_id_t end = base + static_cast<frame_id_t>(static_cast<uint64_t>(i + 1) * BUFFER_POOL_CHUNK_SIZE / n_shards);
+    std::lock_guard<std::mutex> guard(shard.latch_);
+    for (frame_id_t frame_id = begin; frame_id < end; ++frame_id) {
+      shard.frames_.push_back(frame_id);
+    }
+    shard.page_table_.Reserve(static_cast<uint32_t>(shard.frames_.size()));
+    // 倒着放进去，先分配编号小的frame
+    for (frame_id_t frame_id = end; frame_id > begin; --frame_id) {
+      assert(FrameAt(frame_id - 1).valid_ == false);
+      shard.free_frames_.push_back(frame_id - 1);
+    }
+  }
+}
+
+void BufferPool::DetachChunk(uint32_t chunk_id) {
+  frame_id_t begin = chunk_id * BUFFER_POOL_CHUNK_SIZE;
+  frame_id_t end = begin + BUFFER_POOL_CHUNK_SIZE;
+  auto in_chunk = [begin, end](frame_id_t frame_id) {
+    return frame_id >= begin && frame_id < end;
+  };
+  for (auto &shard_ptr: shards_) {
+    Shard &shard = *shard_ptr;
+    std::unique_lock<std::mutex> lock(shard.latch_);
+
+    // 1.从CLOCK和free list中拿掉，这些frame不会再被分配出去
+    auto first = std::find_if(shard.frames_.begin(), shard.frames_.end(), in_chunk);
+    std::vector<frame_id_t> victims(first, shard.frames_.end());
+    shard.frames_.erase(first, shard.frames_.end());
+    if (shard.clock_hand_ >= shard.frames_.size()) {
+      shard.clock_hand_ = 0;
+    }
+    shard.free_frames_.erase(std::remove_if(shard.free_frames_.begin(), shard.free_frames_.end(), in_chunk),
+                             shard.free_frames_.end());
+
+    // 2.淘汰里面的page，被pin住或者还在预读的page要等它用完
+    for (frame_id_t frame_id: victims) {
+      FrameDescriptor &frame = FrameAt(frame_id);
+      while (frame.n_waiters_ > 0 || (frame.valid_ && (frame.pin_count_ > 0 || frame.io_pending_))) {
+        shard.io_cv_.wait_for(lock, std::chrono::milliseconds(1));
+      }
+      if (!frame.valid_) {
+        continue;
+      }
+      if (frame.dirty_) {
+        WriteFrame(frame_id);
+        dirty_evictions_++;
+      } else {
+        clean_evictions_++;
+      }
+      shard.page_table_.Erase(frame.key_);
+      frame.valid_ = false;
+      PageAt(frame_id)->SetState(Page::State::INVALID);
+    }
+
+    // 3.等待期间读失败的page会被放回free list
+    shard.free_frames_.erase(std::remove_if(shard.free_frames_.begin(), shard.free_frames_.end(), in_chunk),
+                             shard.free_frames_.end());
+  }
+}
+
+bool BufferPool::PopFreeFrameLocked(Shard &shard, frame_id_t &frame_id) {
+  if (shard.free_frames_.empty()) {
+    return false;
+  }
+  frame_id = shard.free_frames_.back();
+  shard.free_frames_.pop_back();
+  // 空闲frame不够了，叫醒后台刷脏线程
+  if (shard.free_frames_.size() < free_frames_target_) {
+    flusher_cv_.notify_one();
+  }
+  return true;
+}
+
+bool BufferPool::AllocFrameLocked(Shard &shard, std::unique_lock<std::mutex> &lock, frame_id_t &frame_id) {
+  if (PopFreeFrameLocked(shard, frame_id)) {
+    return true;
+  }
+  if (free_frames_target_ > 0) {
+    free_frame_stalls_++;
+    flusher_cv_.notify_one();
+  }
+  return EvictLocked(shard, lock, frame_id);
+}
+
+bool BufferPool::EvictLocked(Shard &shard, std::unique_lock<std::mutex> &lock, frame_id_t &frame_id) {
+  if (policy_ == ReplacementPolicy::LOG_AWARE) {
+    return EvictLogAwareLocked(shard, lock, frame_id);
+  }
+  std::vector<frame_id_t> dirty_frames;
+  while (true) {
+    // 释放锁的期间其他线程写回的page可能已经放进free list了
+    if (PopFreeFrameLocked(shard, frame_id)) {
+      return true;
+    }
+    // 最多扫两圈：第一圈可能只是把引用位清零。
+    // 优先淘汰干净的page，扫过的没有被引用的脏page攒成一批，一圈之内不会重复
+    dirty_frames.clear();
+    bool io_pending = false;
+    auto n_frames = static_cast<uint32_t>(shard.frames_.size());
+    uint32_t collect_end = 2 * n_frames;
+    for (uint32_t i = 0; i < 2 * n_frames && dirty_frames.size() < Doublewrite::BATCH_PAGES; ++i) {
+      frame_id_t candidate = shard.frames_[shard.clock_hand_];
+      shard.clock_hand_ = shard.clock_hand_ + 1 == n_frames ? 0 : shard.clock_hand_ + 1;
+      FrameDescriptor &frame = FrameAt(candidate);
+      if (!frame.valid_ || frame.pin_count_ > 0 || frame.n_waiters_ > 0) {
+        io_pending = io_pending || frame.io_pending_;
+        continue;
+      }
+      if (frame.ref_) {
+        frame.ref_ = false;
+        continue;
+      }
+      if (frame.dirty_) {
+        if (dirty_frames.empty()) {
+          collect_end = i + n_frames;
+        }
+        if (i < collect_end) {
+          dirty_frames.push_back(candidate);
+        }
+        continue;
+      }
+      EvictFrameLocked(shard, candidate);
+      clean_evictions_++;
+      frame_id = candidate;
+      return true;
+    }
+    if (dirty_frames.empty()) {
+      if (!WaitForIOLocked(shard, lock, io_pending)) {
+        return false;
+      }
+      continue;
+    }
+    // 没有干净的page，这一批脏page一起写回之后淘汰其中一个
+    if (!FlushAndEvictLocked(shard, lock, dirty_frames, frame_id)) {
+      return false;
+    }
+    if (frame_id != INVALID_FRAME_ID) {
+      return true;
+    }
+  }
+}
+
+bool BufferPool::EvictLogAwareLocked(Shard &shard, std::unique_lock<std::mutex> &lock, frame_id_t &frame_id) {
+  std::vector<frame_id_t> dirty_frames;
+  while (true) {
+    if (PopFreeFrameLocked(shard, frame_id)) {
+      return true;
+    }
+    bool io_pending = false;
+    auto n_frames = static_cast<uint32_t>(shard.frames_.size());
+    uint32_t n_sampled = 0;
+    bool found = false;
+    uint64_t victim_next_use = 0;
+    // 这一批不会再用到的干净page，被选中的page是脏的时候用它代替
+    bool found_clean = false;
+    frame_id_t clean_victim = 0;
+    uint64_t clean_next_use = 0;
+    dirty_frames.clear();
+    for (uint32_t i = 0; i < n_frames && n_sampled < LOG_AWARE_SAMPLE_SIZE; ++i) {
+      frame_id_t candidate = shard.frames_[shard.clock_hand_];
+      shard.clock_hand_ = shard.clock_hand_ + 1 == n_frames ? 0 : shard.clock_hand_ + 1;
+      const FrameDescriptor &frame = FrameAt(candidate);
+      if (!frame.valid_ || frame.pin_count_ > 0 || frame.n_waiters_ > 0) {
+        io_pending = io_pending || frame.io_pending_;
+        continue;
+      }
+      n_sampled++;
+      uint64_t next_use = NextUse(frame);
+      if (!found || next_use > victim_next_use) {
+        found = true;
+        frame_id = candidate;
+        victim_next_use = next_use;
+      }
+      if (next_use >= NEXT_BATCH_REFERENCE) {
+        if (frame.dirty_) {
+          dirty_frames.push_back(candidate);
+        } else if (!found_clean || next_use > clean_next_use) {
+          found_clean = true;
+          clean_victim = candidate;
+          clean_next_use = next_use;
+        }
+      }
+      if (next_use == NO_REFERENCE && !frame.dirty_) {
+        break;
+      }
+    }
+    if (!found) {
+      if (!WaitForIOLocked(shard, lock, io_pending)) {
+        return false;
+      }
+      continue;
+    }
+    if (FrameAt(frame_id).dirty_ && found_clean) {
+      frame_id = clean_victim;
+    }
+    if (!FrameAt(frame_id).dirty_) {
+      EvictFrameLocked(shard, frame_id);
+      clean_evictions_++;
+      return true;
+    }
+    // 选中的page是脏的，和样本中这一批不会再用到的脏page一起写回
+    frame_id_t victim = frame_id;
+    if (std::find(dirty_frames.begin(), dirty_frames.end(), victim) == dirty_frames.end()) {
+      dirty_frames.push_back(victim);
+    }
+    if (!FlushAndEvictLocked(shard, lock, dirty_frames, frame_id)) {
+      return false;
+    }
+    if (frame_id != INVALID_FRAME_ID) {
+      return true;
+    }
+  }
+}
+
+bool BufferPool::WaitForIOLocked(Shard &shard, std::unique_lock<std::mutex> &lock, bool io_pending) {
+  if (!io_pending) {
+    std::cerr << "all pages in the buffer pool shard are pinned." << std::endl;
+    return false;
+  }
+  // 其他线程正在写回或者读这个分片中的page，写回的page之后会放进free list或者变成干净的
+  shard.io_cv_.wait(lock);
+  return true;
+}
+
+void BufferPool::EvictFrameLocked(Shard &shard, frame_id_t frame_id) {
+  FrameDescriptor &frame = FrameAt(frame_id);
+  assert(!frame.dirty_);
+  shard.page_table_.Erase(frame.key_);
+  frame.valid_ = false;
+  PageAt(frame_id)->SetState(Page::State::INVALID);
+}
+
+void BufferPool::BeginFlushLocked(frame_id_t frame_id) {
+  FrameDescriptor &frame = FrameAt(frame_id);
+  frame.dirty_ = false;
+  frame.io_pending_ = true;
+  frame.pin_count_++;
+}
+
+void BufferPool::EndFlushLocked(frame_id_t frame_id, bool ok) {
+  FrameDescriptor &frame = FrameAt(frame_id);
+  frame.io_pending_ = false;
+  frame.pin_count_--;
+  if (!ok) {
+    frame.dirty_ = true;
+  } else {
+    frame.oldest_modification_ = 0;
+    frame.newest_modification_ = 0;
   }
 }
 
+bool BufferPool::FlushAndEvictLocked(Shard &shard, std::unique_lock<std::mutex> &lock,
+                                     std::vector<frame_id_t> &frames, frame_id_t &frame_id) {
+  // 写的过程中frame被pin住并且标记成io_pending_，不会被淘汰，要用的线程等它写完
+  std::sort(frames.begin(), frames.end(), [this](frame_id_t a, frame_id_t b) {
+    return FrameAt(a).key_ < FrameAt(b).key_;
+  });
+  for (frame_id_t f: frames) {
+    BeginFlushLocked(f);
+  }
+  lock.unlock();
+  std::vector<bool> ok;
+  uint32_t n_writes = WriteFrames(frames, ok);
+  lock.lock();
+  foreground_flushes_++;
+  foreground_flush_writes_ += n_writes;
+
+  uint32_t n_ok = 0;
+  for (size_t i = 0; i < frames.size(); ++i) {
+    EndFlushLocked(frames[i], ok[i]);
+    n_ok += ok[i];
+  }
+  shard.io_cv_.notify_all();
+  foreground_flush_pages_ += n_ok;
+  if (n_ok == 0) {
+    std::cerr << "write back dirty pages for eviction failed." << std::endl;
+    return false;
+  }
+
+  // 这一批都是要淘汰的page，释放锁的期间有线程开始用或者在等的留下。
+  // 第一个直接给调用者，其余的放进free list，时钟指针已经扫过了它们，留在原地要再扫一圈才能被淘汰
+  frame_id = INVALID_FRAME_ID;
+  for (size_t i = 0; i < frames.size(); ++i) {
+    const FrameDescriptor &frame = FrameAt(frames[i]);
+    if (!ok[i] || !frame.valid_ || frame.dirty_ || frame.pin_count_ > 0 || frame.n_waiters_ > 0) {
+      continue;
+    }
+    if (frame_id == INVALID_FRAME_ID) {
+      EvictFrameLocked(shard, frames[i]);
+      frame_id = frames[i];
+    } else {
+      RemoveFrameLocked(shard, frames[i]);
+    }
+    dirty_evictions_++;
+  }
+  return true;
+}
+
+uint64_t BufferPool::NextUse(const FrameDescriptor &frame) const {
+  // 每个page在一批中只会被apply一次，这一批已经用过了的话只可能在下一批再用到
+  if (frame.use_epoch_ != ref_epoch_) {
+    auto iter = current_refs_.find(frame.key_);
+    if (iter != current_refs_.end()) {
+      return iter->second;
+    }
+  }
+  if (next_refs_.find(frame.key_) != next_refs_.end()) {
+    return NEXT_BATCH_REFERENCE;
+  }
+  return NO_REFERENCE;
+}
+
+void BufferPool::SetFutureReferences(std::unordered_map<page_key_t, uint32_t> current,
+                                     std::unordered_set<page_key_t> next) {
+  // 后台刷脏线程挑选page时也会读这些成员
+  std::lock_guard<std::mutex> flush_guard(flush_latch_);
+  current_refs_ = std::move(current);
+  next_refs_ = std::move(next);
+  ref_epoch_++;
+}
+
+void BufferPool::InstallFrameLocked(Shard &shard, frame_id_t frame_id, space_id_t space_id, page_id_t page_id) {
+  FrameDescriptor &frame = FrameAt(frame_id);
+  assert(frame.valid_ == false);
+  frame.key_ = MakePageKey(space_id, page_id);
+  frame.space_id_ = space_id;
+  frame.page_id_ = page_id;
+  frame.valid_ = true;
+  frame.ref_ = true;
+  frame.dirty_ = false;
+  frame.oldest_modification_ = 0;
+  frame.newest_modification_ = 0;
+  // 预读上来的page还没有被使用
+  frame.use_epoch_ = ref_epoch_ - 1;
+  shard.page_table_.Insert(frame.key_, frame_id);
+}
+
+void BufferPool::RemoveFrameLocked(Shard &shard, frame_id_t frame_id) {
+  FrameDescriptor &frame = FrameAt(frame_id);
+  assert(frame.valid_ == true);
+  shard.page_table_.Erase(frame.key_);
+  frame.valid_ = false;
+  frame.ref_ = false;
+  frame.dirty_ = false;
+  shard.free_frames_.push_back(frame_id);
+  PageAt(frame_id)->SetState(Page::State::INVALID);
+}
+
 Page *BufferPool::NewPage(space_id_t space_id, page_id_t page_id) {
-  if (hash_map_.find(space_id) != hash_map_.end()
-      && hash_map_[space_id].find(page_id) != hash_map_[space_id].end()) {
+  Shard &shard = GetShard(space_id, page_id);
+  std::unique_lock<std::mutex> lock(shard.latch_);
+  frame_id_t frame_id;
+  if (shard.page_table_.Find(MakePageKey(space_id, page_id), frame_id)) {
     std::cerr << "the page(space_id = " << space_id
               << ", page_id = " << page_id << ") was already in buffer pool"
               << std::endl;
     return nullptr;
   }
-  if (free_list_.empty()) {
-    // buffer pool 空间不够
-    Evict(64);
+  // 从free list申请一个buffer frame，没有的话淘汰一个
+  if (!AllocFrameLocked(shard, lock, frame_id)) {
+    return nullptr;
+  }
+  // 淘汰脏page时释放过锁，期间这个page可能被读上来了
+  frame_id_t existing;
+  if (shard.page_table_.Find(MakePageKey(space_id, page_id), existing)) {
+    shard.free_frames_.push_back(frame_id);
+    std::cerr << "the page(space_id = " << space_id
+              << ", page_id = " << page_id << ") was already in buffer pool"
+              << std::endl;
+    return nullptr;
   }
-  // 从free list申请一个buffer frame
-  frame_id_t frame_id = free_list_.front();
-  free_list_.pop_front();
-
-  assert(frame_id_2_page_address_[frame_id].in_lru_ == false);
 
   // 初始化申请到的buffer frame
-  buffer_[frame_id].Reset();
-  buffer_[frame_id].SetState(Page::State::FROM_BUFFER);
+  PageAt(frame_id)->Reset();
+  PageAt(frame_id)->SetState(Page::State::FROM_BUFFER);
+  InstallFrameLocked(shard, frame_id, space_id, page_id);
+
+  return PageAt(frame_id);
+}
+
+Page *BufferPool::GetPage(space_id_t space_id, page_id_t page_id) {
+  Shard &shard = GetShard(space_id, page_id);
+  std::unique_lock<std::mutex> lock(shard.latch_);
+  return GetPageLocked(shard, lock, space_id, page_id);
+}
 
-  // 新创建的page加入lru list
-  lru_list_.emplace_front(frame_id);
-  hash_map_[space_id][page_id] = lru_list_.begin();
+Page *BufferPool::FetchPage(space_id_t space_id, page_id_t page_id) {
+  Shard &shard = GetShard(space_id, page_id);
+  std::unique_lock<std::mutex> lock(shard.latch_);
+  Page *page = GetPageLocked(shard, lock, space_id, page_id);
+  if (page != nullptr) {
+    FrameAt(page->frame_id_).pin_count_++;
+  }
+  return page;
+}
 
-  // 初始化frame_id_2_page_address_
-  frame_id_2_page_address_[frame_id].in_lru_ = true;
-  frame_id_2_page_address_[frame_id].space_id_ = space_id;
-  frame_id_2_page_address_[frame_id].page_id_ = page_id;
+void BufferPool::UnpinPage(Page *page) {
+  FrameDescriptor &frame = FrameAt(page->frame_id_);
+  Shard &shard = GetShard(frame.space_id_, frame.page_id_);
+  std::lock_guard<std::mutex> guard(shard.latch_);
+  assert(frame.pin_count_ > 0);
+  frame.pin_count_--;
+}
 
-  return &buffer_[frame_id];
+PageGuard BufferPool::FetchPageRead(space_id_t space_id, page_id_t page_id) {
+  Page *page = FetchPage(space_id, page_id);
+  if (page == nullptr) {
+    return {};
+  }
+  return LatchPage(page, false);
 }
 
-void BufferPool::Evict(int n) {
-  for (int i = 0; i < n; ++i) {
-    if (lru_list_.empty()) return;
-    // 把 buffer frame 从 LRU List 中移除
-    frame_id_t frame_id = lru_list_.back();
-    space_id_t space_id = frame_id_2_page_address_[frame_id].space_id_;
-    page_id_t page_id = frame_id_2_page_address_[frame_id].page_id_;
+PageGuard BufferPool::FetchPageWrite(space_id_t space_id, page_id_t page_id) {
+  Page *page = FetchPage(space_id, page_id);
+  if (page == nullptr) {
+    return {};
+  }
+  return LatchPage(page, true);
+}
 
-    // 写回
-    WriteBack(space_id, page_id);
-    lru_list_.pop_back();
-    assert(frame_id_2_page_address_[frame_id].in_lru_ == true);
-    frame_id_2_page_address_[frame_id].in_lru_ = false;
+PageGuard BufferPool::LatchPage(Page *page, bool exclusive) {
+  RWLatch &latch = FrameAt(page->frame_id_).latch_;
+  if (exclusive) {
+    latch.WLock();
+  } else {
+    latch.RLock();
+  }
+  return {this, page, exclusive};
+}
 
-    hash_map_[space_id].erase(page_id);
+PageGuard BufferPool::OwnPage(Page *page) {
+  return {this, page, true, false};
+}
 
-    // 把 buffer frame 归还 Free List
-    free_list_.push_back(frame_id);
+void BufferPool::UnlatchPage(Page *page, bool exclusive) {
+  RWLatch &latch = FrameAt(page->frame_id_).latch_;
+  if (exclusive) {
+    latch.WUnlock();
+  } else {
+    latch.RUnlock();
+  }
+}
 
-    buffer_[frame_id].SetState(Page::State::INVALID);
+void BufferPool::MarkDirty(Page *page, lsn_t oldest_modification, lsn_t newest_modification) {
+  FrameDescriptor &frame = FrameAt(page->frame_id_);
+  Shard &shard = GetShard(frame.space_id_, frame.page_id_);
+  std::lock_guard<std::mutex> guard(shard.latch_);
+  assert(frame.pin_count_ > 0);
+  if (!frame.dirty_) {
+    frame.dirty_ = true;
+    frame.oldest_modification_ = oldest_modification;
   }
+  frame.newest_modification_ = std::max(frame.newest_modification_, newest_modification);
 }
 
-Page *BufferPool::GetPage(space_id_t space_id, page_id_t page_id) {
-  if (space_id_2_file_name_.find(space_id) == space_id_2_file_name_.end()) {
+Page *BufferPool::GetPageLocked(Shard &shard, std::unique_lock<std::mutex> &lock,
+                                space_id_t space_id, page_id_t page_id) {
+  page_key_t key = MakePageKey(space_id, page_id);
+  frame_id_t frame_id;
+  page_requests_++;
+
+  while (true) {
+    // 该 page 已经在buffer pool中了
+    if (shard.page_table_.Find(key, frame_id)) {
+      // 还在读（预读或者另一个线程的同步读），等它读完之后重新查找，等待期间page可能被淘汰了。
+      // 等待的线程记在frame上，读完到重新拿到分片的锁之间这个frame不会被淘汰
+      FrameDescriptor &frame = FrameAt(frame_id);
+      if (frame.io_pending_) {
+        auto t1 = std::chrono::steady_clock::now();
+        frame.n_waiters_++;
+        shard.io_cv_.wait(lock);
+        frame.n_waiters_--;
+        auto t2 = std::chrono::steady_clock::now();
+        prefetch_wait_time_ += (t2 - t1).count();
+        prefetch_waits_++;
+        continue;
+      }
+
+      frame.ref_ = true;
+      frame.use_epoch_ = ref_epoch_;
+      return PageAt(frame_id);
+    }
+
+    // 不在buffer pool中，从磁盘读，读完之后重新查找
+    // TODO 假定所有的Page在磁盘上都是存在的
+    if (!ReadPageFromDisk(shard, lock, space_id, page_id)) {
+      return nullptr;
+    }
+  }
+}
+
+bool BufferPool::ReadPageFromDisk(Shard &shard, std::unique_lock<std::mutex> &lock,
+                                  space_id_t space_id, page_id_t page_id) {
+  if (IsCorruptPage(MakePageKey(space_id, page_id))) {
+    return false;
+  }
+  std::shared_ptr<DataFile> file = spaces_.Open(space_id);
+  if (file == nullptr) {
     std::cerr << "invalid space_id(" << space_id << ")" << std::endl;
-    return nullptr;
+    return false;
+  }
+  // 和预读一样先把frame放进哈希表并标记成io_pending_，读的时候不持有分片的锁，
+  // 同一个分片上其他page的访问不会被这次读挡住，同时访问这个page的线程等它读完
+  frame_id_t frame_id;
+  if (!ReservePageLocked(shard, lock, space_id, page_id, frame_id)) {
+    return shard.page_table_.Find(MakePageKey(space_id, page_id), frame_id);
+  }
+  lock.unlock();
+  bool ok = file->ReadPage(page_id, PageAt(frame_id)->GetData())
+      && ValidatePage(space_id, page_id, PageAt(frame_id)->GetData());
+  CompleteRead({space_id, page_id, std::move(file), {frame_id}}, {ok});
+  lock.lock();
+  if (ok) {
+    sync_reads_++;
+  }
+  return ok;
+}
+
+bool BufferPool::WriteBack(space_id_t space_id, page_id_t page_id) {
+  Shard &shard = GetShard(space_id, page_id);
+  std::lock_guard<std::mutex> guard(shard.latch_);
+  // 找找看是不是在buffer pool中
+  frame_id_t frame_id;
+  if (!shard.page_table_.Find(MakePageKey(space_id, page_id), frame_id)) {
+//  std::cout << "Page(space_id = " << space_id << ", page_id = " << page_id << ") is not in buffer pool." << std::endl;
+    return false;
+  }
+  if (!FrameAt(frame_id).dirty_) {
+    return true;
   }
+  return WriteFrame(frame_id);
+}
+
+bool BufferPool::WriteFrame(frame_id_t frame_id) {
+  std::vector<bool> ok;
+  WriteFrames({frame_id}, ok);
+  if (!ok[0]) {
+    return false;
+  }
+  FrameDescriptor &frame = FrameAt(frame_id);
+  frame.dirty_ = false;
+  frame.oldest_modification_ = 0;
+  frame.newest_modification_ = 0;
+  return true;
+}
 
-  // 该 page 已经被lru缓存了
-  if (hash_map_.find(space_id) != hash_map_.end()
-      && hash_map_[space_id].find(page_id) != hash_map_[space_id].end()) {
-    auto iter = hash_map_[space_id][page_id];
-    auto frame_id = *hash_map_[space_id][page_id];
+void BufferPool::FlushAll() {
+  std::lock_guard<std::mutex> flush_guard(flush_latch_);
 
-    // 提升到lru list的队头
-    lru_list_.erase(iter);
-    lru_list_.emplace_front(frame_id);
-    hash_map_[space_id][page_id] = lru_list_.begin();
+  // 1.pin住所有的脏page，预读还没完成的page不会是脏的。记下当时最近一次修改的LSN，
+  // 写的过程中又被修改过的page写完之后仍然是脏的
+  std::vector<std::tuple<page_key_t, frame_id_t, lsn_t>> dirty_frames;
+  for (auto &shard_ptr: shards_) {
+    Shard &shard = *shard_ptr;
+    std::lock_guard<std::mutex> guard(shard.latch_);
+    for (frame_id_t frame_id: shard.frames_) {
+      FrameDescriptor &frame = FrameAt(frame_id);
+      if (frame.valid_ && frame.dirty_ && !frame.io_pending_) {
+        frame.pin_count_++;
+        dirty_frames.emplace_back(frame.key_, frame_id, frame.newest_modification_);
+      }
+    }
+  }
 
-    return &buffer_[frame_id];
+  // 2.按照(文件, 偏移量)排序，一批一批地经过doublewrite文件写回
+  std::sort(dirty_frames.begin(), dirty_frames.end());
+  std::vector<frame_id_t> frames;
+  std::vector<lsn_t> newest_modifications;
+  for (const auto &dirty_frame: dirty_frames) {
+    frames.push_back(std::get<1>(dirty_frame));
+    newest_modifications.push_back(std::get<2>(dirty_frame));
   }
+  std::vector<bool> ok;
+  WriteFrames(frames, ok);
 
-  // 不在buffer pool中，从磁盘读
-  // TODO 假定所有的Page在磁盘上都是存在的
-  return ReadPageFromDisk(space_id, page_id);
+  // 3.unpin，写成功并且没有再被修改过的page变成干净的
+  for (size_t i = 0; i < frames.size(); ++i) {
+    FrameDescriptor &frame = FrameAt(frames[i]);
+    Shard &shard = GetShard(frame.space_id_, frame.page_id_);
+    {
+      std::lock_guard<std::mutex> guard(shard.latch_);
+      frame.pin_count_--;
+      if (ok[i] && frame.dirty_ && frame.newest_modification_ == newest_modifications[i]) {
+        frame.dirty_ = false;
+        frame.oldest_modification_ = 0;
+        frame.newest_modification_ = 0;
+      }
+    }
+    shard.io_cv_.notify_all();
+  }
+  spaces_.SyncAll();
 }
 
-Page *BufferPool::ReadPageFromDisk(space_id_t space_id, page_id_t page_id) {
+void BufferPool::DropSpace(space_id_t space_id, bool remove_file) {
+  // Resize淘汰page时会释放分片的锁，不能同时进行
+  std::lock_guard<std::mutex> flush_guard(flush_latch_);
+  for (auto &shard_ptr: shards_) {
+    Shard &shard = *shard_ptr;
+    std::unique_lock<std::mutex> lock(shard.latch_);
+    // 正在预读的frame不能被回收，等这个表空间的预读全部完成
+    shard.io_cv_.wait(lock, [this, &shard, space_id]() {
+      for (frame_id_t frame_id: shard.frames_) {
+        const FrameDescriptor &frame = FrameAt(frame_id);
+        if (frame.valid_ && frame.space_id_ == space_id && frame.io_pending_) {
+          return false;
+        }
+      }
+      return true;
+    });
+    for (frame_id_t frame_id: shard.frames_) {
+      if (FrameAt(frame_id).valid_ && FrameAt(frame_id).space_id_ == space_id) {
+        RemoveFrameLocked(shard, frame_id);
+      }
+    }
+  }
+  // 表空间被删除或者重建之后，之前校验失败的page也不存在了
+  {
+    std::lock_guard<std::mutex> guard(corrupt_latch_);
+    corrupt_pages_.erase(corrupt_pages_.lower_bound(MakePageKey(space_id, 0)),
+                         corrupt_pages_.upper_bound(MakePageKey(space_id, ~static_cast<page_id_t>(0))));
+  }
+  if (remove_file) {
+    spaces_.Remove(space_id);
+  }
+}
 
-  if (free_list_.empty()) {
-    // buffer pool 空间不够
-    Evict(64);
+bool BufferPool::LockFrames() {
+  std::lock_guard<std::mutex> flush_guard(flush_latch_);
+  lock_frames_ = true;
+  bool ok = true;
+  for (uint32_t chunk_id = 0; chunk_id < n_chunks_; ++chunk_id) {
+    ok = chunks_[chunk_id]->arena_.Lock() && ok;
   }
+  return ok;
+}
 
-  // 从free list中分配一个frame，从磁盘读取page，填充这个frame
-  frame_id_t frame_id = free_list_.front();
-  auto fs = space_id_2_file_name_[space_id].stream_;
-  fs->seekg(static_cast<std::streamoff>(page_id * DATA_PAGE_SIZE));
-  fs->read(reinterpret_cast<char *>(buffer_[frame_id].GetData()), DATA_PAGE_SIZE);
-  buffer_[frame_id].SetState(Page::State::FROM_DISK);
-  free_list_.pop_front();
+void BufferPool::SetFlusher(uint32_t free_frames) {
+  StopFlusher();
+  free_frames_target_ = free_frames;
+  if (free_frames == 0) {
+    return;
+  }
+  stop_flusher_ = false;
+  flusher_ = std::thread(&BufferPool::FlusherLoop, this);
+}
 
-  assert(frame_id_2_page_address_[frame_id].in_lru_ == false);
+void BufferPool::StopFlusher() {
+  {
+    std::lock_guard<std::mutex> guard(flusher_latch_);
+    stop_flusher_ = true;
+  }
+  flusher_cv_.notify_all();
+  if (flusher_.joinable()) {
+    flusher_.join();
+  }
+  free_frames_target_ = 0;
+}
 
-  // 将page放入lru list
-  frame_id_2_page_address_[frame_id].space_id_ = space_id;
-  frame_id_2_page_address_[frame_id].page_id_ = page_id;
-  frame_id_2_page_address_[frame_id].in_lru_ = true;
-  lru_list_.emplace_front(frame_id);
-  hash_map_[space_id][page_id] = lru_list_.begin();
-  return &buffer_[frame_id];
+void BufferPool::FlusherLoop() {
+  std::unique_lock<std::mutex> lock(flusher_latch_);
+  while (!stop_flusher_) {
+    // 前台发现空闲frame不够时会叫醒，否则定期检查一次
+    flusher_cv_.wait_for(lock, std::chrono::milliseconds(10));
+    if (stop_flusher_) {
+      break;
+    }
+    lock.unlock();
+    FlushForFreeFrames();
+    lock.lock();
+  }
 }
 
-bool BufferPool::WriteBack(space_id_t space_id, page_id_t page_id) {
-  // 找找看是不是在buffer pool中
-  if (hash_map_.find(space_id) != hash_map_.end() && hash_map_[space_id].find(page_id) != hash_map_[space_id].end()) {
-    frame_id_t frame_id = *(hash_map_[space_id][page_id]);
-    auto fs = space_id_2_file_name_[space_id].stream_;
-    fs->seekp(static_cast<std::streamoff>(page_id * DATA_PAGE_SIZE));
-    fs->write(reinterpret_cast<char *>(buffer_[frame_id].GetData()), DATA_PAGE_SIZE);
-    return true;
+void BufferPool::FlushForFreeFrames() {
+  std::lock_guard<std::mutex> flush_guard(flush_latch_);
+
+  // 1.每个分片按照CLOCK挑出要淘汰的page，脏page先pin住并标记成io_pending_，写完之前不能被使用
+  std::vector<std::pair<page_key_t, frame_id_t>> dirty_frames;
+  for (auto &shard_ptr: shards_) {
+    Shard &shard = *shard_ptr;
+    std::lock_guard<std::mutex> guard(shard.latch_);
+    auto n_frames = static_cast<uint32_t>(shard.frames_.size());
+    uint32_t target = std::min(free_frames_target_, n_frames / 2);
+    uint32_t n_picked = 0;
+    for (uint32_t i = 0; i < 2 * n_frames && shard.free_frames_.size() + n_picked < target; ++i) {
+      frame_id_t candidate = shard.frames_[shard.clock_hand_];
+      shard.clock_hand_ = shard.clock_hand_ + 1 == n_frames ? 0 : shard.clock_hand_ + 1;
+      FrameDescriptor &frame = FrameAt(candidate);
+      if (!frame.valid_ || frame.pin_count_ > 0 || frame.io_pending_ || frame.n_waiters_ > 0) {
+        continue;
+      }
+      // LOG_AWARE不淘汰这一批还要用到的page
+      if (policy_ == ReplacementPolicy::LOG_AWARE ? NextUse(frame) < NEXT_BATCH_REFERENCE : frame.ref_) {
+        frame.ref_ = false;
+        continue;
+      }
+      if (!frame.dirty_) {
+        RemoveFrameLocked(shard, candidate);
+        clean_evictions_++;
+        continue;
+      }
+      BeginFlushLocked(candidate);
+      dirty_frames.emplace_back(frame.key_, candidate);
+      n_picked++;
+    }
+  }
+  if (dirty_frames.empty()) {
+    return;
   }
 
-//  std::cout << "Page(space_id = " << space_id << ", page_id = " << page_id << ") is not in buffer pool." << std::endl;
+  // 2.按照(space_id, page_id)也就是(文件, 偏移量)排序，一批一批地经过doublewrite文件写回，
+  // 文件中相邻的page合并成一次pwritev
+  auto t1 = std::chrono::steady_clock::now();
+  std::sort(dirty_frames.begin(), dirty_frames.end());
+  std::vector<frame_id_t> frames;
+  for (const auto &dirty_frame: dirty_frames) {
+    frames.push_back(dirty_frame.second);
+  }
+  std::vector<bool> ok;
+  flusher_writes_ += WriteFrames(frames, ok);
+
+  // 3.写完之后没有人pin住、也没有人在等的page直接淘汰，写失败的page重新标记成脏的
+  for (size_t i = 0; i < frames.size(); ++i) {
+    FrameDescriptor &frame = FrameAt(frames[i]);
+    Shard &shard = GetShard(frame.space_id_, frame.page_id_);
+    {
+      std::lock_guard<std::mutex> guard(shard.latch_);
+      EndFlushLocked(frames[i], ok[i]);
+      if (ok[i]) {
+        flusher_pages_++;
+        dirty_evictions_++;
+        if (frame.pin_count_ == 0 && frame.n_waiters_ == 0) {
+          RemoveFrameLocked(shard, frames[i]);
+        }
+      }
+    }
+    shard.io_cv_.notify_all();
+  }
+  auto t2 = std::chrono::steady_clock::now();
+  flusher_time_ += (t2 - t1).count();
+}
+
+// 写回用的私有副本，按照UNIV_PAGE_SIZE_MIN对齐，打开O_DIRECT时也可以直接写。每个线程一份，只增不减
+struct IOBuffer {
+  byte *data_ = nullptr;
+  size_t size_ = 0;
+
+  ~IOBuffer() {
+    free(data_);
+  }
+
+  byte *Reserve(size_t size) {
+    if (size > size_) {
+      free(data_);
+      data_ = static_cast<byte *>(aligned_alloc(UNIV_PAGE_SIZE_MIN, size));
+      size_ = data_ != nullptr ? size : 0;
+    }
+    return data_;
+  }
+};
+
+uint32_t BufferPool::WriteFrames(const std::vector<frame_id_t> &frames, std::vector<bool> &ok) {
+  ok.assign(frames.size(), false);
+  uint32_t n_writes = 0;
+  static thread_local IOBuffer io_buffer;
+  size_t n_pages = std::min(frames.size(), static_cast<size_t>(Doublewrite::BATCH_PAGES));
+  byte *buffer = io_buffer.Reserve(n_pages * page_size_);
+  if (buffer == nullptr) {
+    std::cerr << "allocate " << n_pages << " pages for writing back failed" << std::endl;
+    return 0;
+  }
+  std::vector<Doublewrite::Entry> entries;
+  std::vector<size_t> indexes;
+  for (size_t begin = 0; begin < frames.size(); begin += Doublewrite::BATCH_PAGES) {
+    size_t end = std::min(frames.size(), begin + Doublewrite::BATCH_PAGES);
+    entries.clear();
+    indexes.clear();
+    std::shared_ptr<DataFile> file;
+    for (size_t i = begin; i < end; ++i) {
+      FrameDescriptor &frame = FrameAt(frames[i]);
+      // frames是排好序的，同一个表空间的page挨在一起
+      if (file == nullptr || entries.empty() || entries.back().space_id_ != frame.space_id_) {
+        file = spaces_.Open(frame.space_id_);
+      }
+      if (file == nullptr) {
+        continue;
+      }
+      // 正在修改page的线程不会去拿分片的锁，所以持有分片的锁时等page的读锁不会死锁。
+      // 读锁只保护拷贝，checksum写在副本上：多个线程可以同时持有读锁写回同一个page，不能改frame中的page
+      Page copy(buffer + entries.size() * page_size_, page_size_);
+      frame.latch_.RLock();
+      std::memcpy(copy.GetData(), PageAt(frames[i])->GetData(), page_size_);
+      frame.latch_.RUnlock();
+      copy.WriteCheckSum(PageCalcChecksumCrc32(copy.GetData(), copy.GetSize()));
+      entries.push_back({frame.space_id_, frame.page_id_, file, copy.GetData(), false});
+      indexes.push_back(i);
+    }
+    n_writes += doublewrite_.Write(entries);
+    for (size_t j = 0; j < entries.size(); ++j) {
+      ok[indexes[j]] = entries[j].ok_;
+      pages_written_ += entries[j].ok_;
+    }
+  }
+  return n_writes;
+}
+
+void BufferPool::SetDoublewrite(bool enabled) {
+  std::lock_guard<std::mutex> flush_guard(flush_latch_);
+  doublewrite_.SetEnabled(enabled);
+}
+
+void BufferPool::SetDirectIO(bool direct) {
+  // 还在队列中的预读持有旧的文件，读完之后才会关闭
+  spaces_.SetDirectIO(direct);
+}
+
+void BufferPool::SetPrefetchDepth(uint32_t n_readers) {
+  StopReaders();
+  std::lock_guard<std::mutex> guard(prefetch_latch_);
+  stop_readers_ = false;
+  for (uint32_t i = 0; i < n_readers; ++i) {
+    readers_.emplace_back(&BufferPool::ReaderLoop, this);
+  }
+}
+
+void BufferPool::StopReaders() {
+  {
+    std::lock_guard<std::mutex> guard(prefetch_latch_);
+    stop_readers_ = true;
+  }
+  prefetch_cv_.notify_all();
+  for (auto &reader: readers_) {
+    reader.join();
+  }
+  readers_.clear();
+}
+
+bool BufferPool::ReservePageLocked(Shard &shard, std::unique_lock<std::mutex> &lock,
+                                   space_id_t space_id, page_id_t page_id, frame_id_t &frame_id) {
+  if (shard.page_table_.Find(MakePageKey(space_id, page_id), frame_id)
+      || IsCorruptPage(MakePageKey(space_id, page_id))) {
+    return false;
+  }
+  if (!AllocFrameLocked(shard, lock, frame_id)) {
+    return false;
+  }
+  // 淘汰脏page时释放过锁，其他线程可能已经把这个page读上来了
+  frame_id_t existing;
+  if (shard.page_table_.Find(MakePageKey(space_id, page_id), existing)) {
+    shard.free_frames_.push_back(frame_id);
+    frame_id = existing;
+    return false;
+  }
+  InstallFrameLocked(shard, frame_id, space_id, page_id);
+
+  // 读完之前一直pin住，不会被淘汰
+  FrameAt(frame_id).pin_count_++;
+  FrameAt(frame_id).io_pending_ = true;
+  return true;
+}
+
+void BufferPool::Prefetch(std::vector<std::pair<space_id_t, page_id_t>> pages) {
+  if (readers_.empty() || pages.empty()) {
+    return;
+  }
+
+  // 每个分片最多预读一半的frame，防止先读上来的page在被使用之前就被后面的预读淘汰了
+  std::vector<uint32_t> reserved(shards_.size(), 0);
+
+  std::sort(pages.begin(), pages.end());
+  std::vector<ReadRequest> requests;
+  // page按照space_id排好序了，每个表空间只需要打开一次
+  std::shared_ptr<DataFile> file;
+  for (size_t i = 0; i < pages.size(); ++i) {
+    space_id_t space_id = pages[i].first;
+    page_id_t page_id = pages[i].second;
+    if (i == 0 || space_id != pages[i - 1].first) {
+      file = spaces_.Open(space_id);
+    }
+    if (file == nullptr) {
+      continue;
+    }
+    uint32_t shard_id = GetShardId(space_id, page_id);
+    Shard &shard = *shards_[shard_id];
+    frame_id_t frame_id;
+    {
+      std::unique_lock<std::mutex> lock(shard.latch_);
+      if (reserved[shard_id] >= shard.frames_.size() / 2
+          || !ReservePageLocked(shard, lock, space_id, page_id, frame_id)) {
+        continue;
+      }
+    }
+    reserved[shard_id]++;
+
+    // 和上一个读请求在文件中相邻，合并成一次读
+    if (!requests.empty()) {
+      ReadRequest &last = requests.back();
+      if (last.space_id_ == space_id
+          && last.page_id_ + last.frames_.size() == page_id
+          && last.frames_.size() < PREFETCH_MAX_PAGES_PER_READ) {
+        last.frames_.push_back(frame_id);
+        continue;
+      }
+    }
+    requests.push_back({space_id, page_id, file, {frame_id}});
+  }
+
+  SubmitReads(requests);
+}
+
+void BufferPool::SubmitReads(std::vector<ReadRequest> &requests) {
+  prefetch_reads_ += requests.size();
+  {
+    std::lock_guard<std::mutex> guard(prefetch_latch_);
+    for (auto &request: requests) {
+      prefetch_pages_ += request.frames_.size();
+      read_queue_.push_back(std::move(request));
+    }
+  }
+  prefetch_cv_.notify_all();
+}
+
+Page *BufferPool::TryFetchPage(space_id_t space_id, page_id_t page_id, bool &pending) {
+  pending = false;
+  Shard &shard = GetShard(space_id, page_id);
+  std::unique_lock<std::mutex> lock(shard.latch_);
+  frame_id_t frame_id;
+  if (shard.page_table_.Find(MakePageKey(space_id, page_id), frame_id)) {
+    if (FrameAt(frame_id).io_pending_) {
+      pending = true;
+      return nullptr;
+    }
+  } else if (!readers_.empty()) {
+    // 找不到表空间文件时交给GetPageLocked报错
+    std::shared_ptr<DataFile> file = spaces_.Open(space_id);
+    if (file != nullptr && ReservePageLocked(shard, lock, space_id, page_id, frame_id)) {
+      lock.unlock();
+      std::vector<ReadRequest> requests;
+      requests.push_back({space_id, page_id, std::move(file), {frame_id}});
+      SubmitReads(requests);
+      pending = true;
+      return nullptr;
+    }
+  }
+
+  // 已经在buffer pool中了，或者只能同步读
+  Page *page = GetPageLocked(shard, lock, space_id, page_id);
+  if (page != nullptr) {
+    FrameAt(page->frame_id_).pin_count_++;
+  }
+  return page;
+}
+
+void BufferPool::ReaderLoop() {
+  byte *bufs[PREFETCH_MAX_PAGES_PER_READ];
+  while (true) {
+    ReadRequest request;
+    {
+      std::unique_lock<std::mutex> lock(prefetch_latch_);
+      prefetch_cv_.wait(lock, [this]() {
+        return stop_readers_ || !read_queue_.empty();
+      });
+      if (read_queue_.empty()) {
+        return;
+      }
+      request = std::move(read_queue_.front());
+      read_queue_.pop_front();
+    }
+
+    for (size_t i = 0; i < request.frames_.size(); ++i) {
+      bufs[i] = PageAt(request.frames_[i])->GetData();
+    }
+    bool ok = request.file_->ReadPages(request.page_id_, bufs, static_cast<uint32_t>(request.frames_.size()));
+    if (!ok) {
+      prefetch_failed_reads_++;
+    }
+    // 在预读线程中校验，apply线程拿到的page都是校验过的
+    std::vector<bool> valid(request.frames_.size(), ok);
+    for (size_t i = 0; ok && i < request.frames_.size(); ++i) {
+      valid[i] = ValidatePage(request.space_id_, request.page_id_ + i, bufs[i]);
+    }
+    CompleteRead(request, valid);
+  }
+}
+
+void BufferPool::CompleteRead(const ReadRequest &request, const std::vector<bool> &ok) {
+  for (size_t i = 0; i < request.frames_.size(); ++i) {
+    frame_id_t frame_id = request.frames_[i];
+    page_id_t page_id = request.page_id_ + i;
+    Shard &shard = GetShard(request.space_id_, page_id);
+    {
+      std::lock_guard<std::mutex> guard(shard.latch_);
+      FrameDescriptor &frame = FrameAt(frame_id);
+      assert(frame.io_pending_ && frame.pin_count_ > 0);
+      frame.io_pending_ = false;
+      frame.pin_count_--;
+      if (ok[i]) {
+        PageAt(frame_id)->SetState(Page::State::FROM_DISK);
+      } else {
+        // 读失败的page从buffer pool中拿掉，使用时再同步读一次；校验失败的page不会再读
+        RemoveFrameLocked(shard, frame_id);
+      }
+    }
+    shard.io_cv_.notify_all();
+  }
+}
+
+bool BufferPool::ValidatePage(space_id_t space_id, page_id_t page_id, const byte *data) {
+  if (!validate_pages_) {
+    return true;
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  PageCheck check = CheckPage(data, page_size_, space_id, page_id);
+  auto t2 = std::chrono::steady_clock::now();
+  validation_time_ += (t2 - t1).count();
+  pages_validated_++;
+  if (check == PageCheck::OK) {
+    return true;
+  }
+  std::cerr << "corrupt page (space_id = " << space_id << ", page_id = " << page_id << "): "
+            << PageCheckString(check) << ", logs on it will not be applied" << std::endl;
+  std::lock_guard<std::mutex> guard(corrupt_latch_);
+  corrupt_pages_.emplace(MakePageKey(space_id, page_id), check);
   return false;
 }
 
+bool BufferPool::IsCorruptPage(page_key_t key) const {
+  if (!validate_pages_) {
+    return false;
+  }
+  std::lock_guard<std::mutex> guard(corrupt_latch_);
+  return corrupt_pages_.count(key) > 0;
+}
+
+std::map<page_key_t, PageCheck> BufferPool::GetCorruptPages() const {
+  std::lock_guard<std::mutex> guard(corrupt_latch_);
+  return corrupt_pages_;
+}
+
+void BufferPool::ReportStats(std::ostream &os) const {
+  os << "prefetch_pages: " << prefetch_pages_ << std::endl;
+  os << "prefetch_reads: " << prefetch_reads_ << std::endl;
+  os << "prefetch_failed_reads: " << prefetch_failed_reads_ << std::endl;
+  os << "prefetch_waits: " << prefetch_waits_ << std::endl;
+  os << "prefetch_wait_time: " << prefetch_wait_time_ << std::endl;
+  os << "page_validation: " << (validate_pages_ ? "on" : "off") << std::endl;
+  os << "pages_validated: " << pages_validated_ << std::endl;
+  os << "validation_time: " << validation_time_ << std::endl;
+  {
+    std::lock_guard<std::mutex> guard(corrupt_latch_);
+    os << "corrupt_pages: " << corrupt_pages_.size() << std::endl;
+    for (const auto &corrupt_page: corrupt_pages_) {
+      os << "  (space_id = " << (corrupt_page.first >> 32)
+         << ", page_id = " << static_cast<page_id_t>(corrupt_page.first) << "): "
+         << PageCheckString(corrupt_page.second) << std::endl;
+    }
+  }
+  os << "flusher_pages: " << flusher_pages_ << std::endl;
+  os << "flusher_writes: " << flusher_writes_ << std::endl;
+  os << "flusher_avg_batch_size: "
+     << (flusher_writes_ == 0 ? 0.0 : static_cast<double>(flusher_pages_) / flusher_writes_) << std::endl;
+  os << "flusher_time: " << flusher_time_ << std::endl;
+  os << "foreground_flushes: " << foreground_flushes_ << std::endl;
+  os << "foreground_flush_pages: " << foreground_flush_pages_ << std::endl;
+  os << "foreground_flush_writes: " << foreground_flush_writes_ << std::endl;
+  os << "flusher_rate(pages/s): "
+     << (flusher_time_ == 0 ? 0.0 : static_cast<double>(flusher_pages_) * 1e9 / flusher_time_) << std::endl;
+  os << "free_frame_stalls: " << free_frame_stalls_ << std::endl;
+  os << "replacement_policy: " << (policy_ == ReplacementPolicy::LOG_AWARE ? "log-aware" : "clock") << std::endl;
+  uint64_t page_requests = GetPageRequests();
+  uint64_t page_reads = GetPageReads();
+  os << "page_requests: " << page_requests << std::endl;
+  os << "page_reads: " << page_reads << std::endl;
+  os << "hit_ratio: "
+     << (page_requests == 0 ? 0.0 : std::max(0.0, 1.0 - static_cast<double>(page_reads) / page_requests))
+     << std::endl;
+  uint32_t n_chunks = n_chunks_;
+  uint32_t n_hugetlb_chunks = 0;
+  for (uint32_t chunk_id = 0; chunk_id < n_chunks; ++chunk_id) {
+    n_hugetlb_chunks += chunks_[chunk_id]->arena_.IsHugeTLB();
+  }
+  os << "buffer_pool_chunks: " << n_chunks << std::endl;
+  os << "buffer_pool_frames: " << static_cast<uint64_t>(n_chunks) * BUFFER_POOL_CHUNK_SIZE << std::endl;
+  os << "hugetlb_chunks: " << n_hugetlb_chunks << (lock_frames_ ? ", locked" : "") << std::endl;
+  os << "clean_evictions: " << clean_evictions_ << std::endl;
+  os << "dirty_evictions: " << dirty_evictions_ << std::endl;
+  os << "pages_written: " << pages_written_ << std::endl;
+  doublewrite_.ReportStats(os);
+  spaces_.ReportStats(os);
+}
+
 BufferPool buffer_pool;
 }
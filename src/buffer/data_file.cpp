@@ -0,0 +1,113 @@
+#include "data_file.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+namespace Lemon {
+
+DataFile::~DataFile() {
+  Close();
+}
+
+bool DataFile::Open(const std::string &file_name, bool direct, size_t page_size) {
+  Close();
+  file_name_ = file_name;
+  page_size_ = page_size;
+  direct_ = false;
+  if (direct) {
+    fd_ = open(file_name.c_str(), O_RDWR | O_DIRECT);
+    if (fd_ != -1) {
+      direct_ = true;
+      return true;
+    }
+    // tmpfs之类的文件系统不支持O_DIRECT
+    std::cerr << "open " << file_name << " with O_DIRECT failed: " << std::strerror(errno)
+              << ", fall back to buffered I/O" << std::endl;
+  }
+  fd_ = open(file_name.c_str(), O_RDWR);
+  if (fd_ == -1) {
+    std::cerr << "open " << file_name << " failed: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void DataFile::Close() {
+  if (fd_ != -1) {
+    if (unsynced_) {
+      Sync();
+    }
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool DataFile::ReadPages(page_id_t page_id, byte *const *bufs, uint32_t n) const {
+  return DoIO(false, page_id, bufs, n);
+}
+
+bool DataFile::WritePages(page_id_t page_id, byte *const *bufs, uint32_t n) const {
+  if (!DoIO(true, page_id, bufs, n)) {
+    return false;
+  }
+  unsynced_ = true;
+  return true;
+}
+
+bool DataFile::DoIO(bool write, page_id_t page_id, byte *const *bufs, uint32_t n) const {
+  if (fd_ == -1 || n == 0 || n > IOV_MAX) {
+    return false;
+  }
+  struct iovec iov[IOV_MAX];
+  for (uint32_t i = 0; i < n; ++i) {
+    iov[i].iov_base = bufs[i];
+    iov[i].iov_len = page_size_;
+  }
+  struct iovec *cur = iov;
+  int n_iov = static_cast<int>(n);
+  off_t offset = PageOffset(page_id);
+  while (n_iov > 0) {
+    ssize_t ret = write ? pwritev(fd_, cur, n_iov, offset) : preadv(fd_, cur, n_iov, offset);
+    if (ret < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      std::cerr << (write ? "write " : "read ") << file_name_ << " (page_id = " << page_id
+                << ", n_pages = " << n << ") failed: "
+                << (ret < 0 ? std::strerror(errno) : "end of file") << std::endl;
+      return false;
+    }
+    // 跳过已经完成的部分
+    offset += ret;
+    auto done = static_cast<size_t>(ret);
+    while (n_iov > 0 && done >= cur->iov_len) {
+      done -= cur->iov_len;
+      cur++;
+      n_iov--;
+    }
+    if (n_iov > 0) {
+      cur->iov_base = static_cast<byte *>(cur->iov_base) + done;
+      cur->iov_len -= done;
+    }
+  }
+  return true;
+}
+
+bool DataFile::Sync() const {
+  if (fd_ == -1) {
+    return false;
+  }
+  // 先清掉标记，fsync过程中的新写入会重新设置
+  unsynced_ = false;
+  if (fsync(fd_) != 0) {
+    unsynced_ = true;
+    std::cerr << "fsync " << file_name_ << " failed: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}
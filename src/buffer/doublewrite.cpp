@@ -0,0 +1,223 @@
+#include "doublewrite.h"
+#include "page_layout.h"
+#include "utility.h"
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <cassert>
+#include <algorithm>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+namespace Lemon {
+
+Doublewrite::Doublewrite(std::string path) :
+    path_(std::move(path)) {
+
+}
+
+Doublewrite::~Doublewrite() {
+  free(header_);
+}
+
+bool Doublewrite::Open(size_t page_size) {
+  page_size_ = page_size;
+  free(header_);
+  header_ = static_cast<byte *>(aligned_alloc(UNIV_PAGE_SIZE_MIN, page_size_));
+  int fd = open(path_.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd == -1) {
+    std::cerr << "open doublewrite file " << path_ << " failed: " << std::strerror(errno)
+              << ", pages will be written without doublewrite" << std::endl;
+    return false;
+  }
+  close(fd);
+  return file_.Open(path_, false, page_size_);
+}
+
+uint32_t Doublewrite::Recover(SpaceRegistry &spaces) {
+  if (!file_.IsOpen()) {
+    return 0;
+  }
+  // 新建的文件是空的，上一次干净地退出时header也被清空了
+  struct stat st{};
+  if (stat(path_.c_str(), &st) != 0 || static_cast<size_t>(st.st_size) < page_size_) {
+    return 0;
+  }
+  auto n_file_pages = static_cast<uint64_t>(st.st_size) / page_size_;
+
+  // 1.找出每个page在所有slot中完整的、LSN最大的副本。
+  // 副本本身也可能没写完（崩溃发生在写doublewrite文件的时候），这时表空间文件还没有被动过。
+  // 只比较头尾的LSN发现不了中间写坏的page，要用checksum校验整个page
+  byte *copy = static_cast<byte *>(aligned_alloc(UNIV_PAGE_SIZE_MIN, page_size_));
+  byte *page = static_cast<byte *>(aligned_alloc(UNIV_PAGE_SIZE_MIN, page_size_));
+  std::map<std::pair<space_id_t, page_id_t>, std::pair<lsn_t, page_id_t>> newest_copies;
+  for (uint32_t slot = 0; slot < N_SLOTS && slot * SLOT_PAGES < n_file_pages; ++slot) {
+    page_id_t base = slot * SLOT_PAGES;
+    if (!file_.ReadPage(base, header_)
+        || mach_read_from_4(header_ + HEADER_MAGIC) != MAGIC
+        || mach_read_from_4(header_ + HEADER_PAGE_SIZE) != page_size_) {
+      continue;
+    }
+    uint32_t n_pages = mach_read_from_4(header_ + HEADER_N_PAGES);
+    if (n_pages > BATCH_PAGES) {
+      n_pages = BATCH_PAGES;
+    }
+    for (uint32_t i = 0; i < n_pages; ++i) {
+      space_id_t space_id = mach_read_from_4(header_ + HEADER_ENTRIES + i * 8);
+      page_id_t page_id = mach_read_from_4(header_ + HEADER_ENTRIES + i * 8 + 4);
+      if (!file_.ReadPage(base + 1 + i, copy)
+          || CheckPage(copy, page_size_, space_id, page_id) != PageCheck::OK) {
+        continue;
+      }
+      lsn_t lsn = mach_read_from_8(copy + FIL_PAGE_LSN);
+      auto iter = newest_copies.find({space_id, page_id});
+      if (iter == newest_copies.end() || iter->second.first < lsn) {
+        newest_copies[{space_id, page_id}] = {lsn, base + 1 + i};
+      }
+    }
+  }
+
+  // 2.表空间文件中写坏了的page用副本修复
+  uint32_t n_repaired = 0;
+  for (const auto &newest_copy: newest_copies) {
+    space_id_t space_id = newest_copy.first.first;
+    page_id_t page_id = newest_copy.first.second;
+    std::shared_ptr<DataFile> file = spaces.Open(space_id);
+    if (file == nullptr) {
+      continue;
+    }
+    if (file->ReadPage(page_id, page) && CheckPage(page, page_size_, space_id, page_id) == PageCheck::OK) {
+      continue;
+    }
+    if (file_.ReadPage(newest_copy.second.second, copy) && file->WritePage(page_id, copy) && file->Sync()) {
+      n_repaired++;
+      std::cout << "repaired torn page (space_id = " << space_id << ", page_id = " << page_id
+                << ") from doublewrite file" << std::endl;
+    }
+  }
+  free(copy);
+  free(page);
+
+  // 3.修复完之后清空所有的header，下次启动不需要再检查，下一批从第一个slot开始写
+  std::memset(header_, 0, page_size_);
+  bool ok = true;
+  for (uint32_t slot = 0; slot < N_SLOTS; ++slot) {
+    ok = file_.WritePage(slot * SLOT_PAGES, header_) && ok;
+  }
+  if (!ok || !file_.Sync()) {
+    std::cerr << "clear doublewrite header failed" << std::endl;
+  }
+  next_slot_ = 0;
+  return n_repaired;
+}
+
+bool Doublewrite::SyncDataFiles() {
+  // 失败的文件留在列表中，下次再试，在这之前不能覆盖任何slot
+  bool ok = true;
+  std::vector<std::shared_ptr<DataFile>> failed;
+  for (auto &file: unsynced_files_) {
+    if (!file->IsUnsynced()) {
+      // 已经被FlushAll或者关闭文件时fsync过了
+      continue;
+    }
+    n_data_syncs_++;
+    if (!file->Sync()) {
+      failed.push_back(std::move(file));
+      ok = false;
+    }
+  }
+  unsynced_files_.swap(failed);
+  return ok;
+}
+
+uint32_t Doublewrite::Write(std::vector<Entry> &entries) {
+  assert(entries.size() <= BATCH_PAGES);
+  std::lock_guard<std::mutex> guard(latch_);
+  for (auto &entry: entries) {
+    entry.ok_ = false;
+  }
+  if (entries.empty()) {
+    return 0;
+  }
+  auto n = static_cast<uint32_t>(entries.size());
+  bool staged = enabled_ && file_.IsOpen();
+
+  // 1.header和所有page一次顺序写到下一个slot中，fsync之后才能原地写。
+  // 轮完一圈之后slot中的副本要被覆盖了，先把上一圈原地写过的表空间文件fsync
+  auto t1 = std::chrono::steady_clock::now();
+  if (staged) {
+    if (next_slot_ == 0 && !unsynced_files_.empty() && !SyncDataFiles()) {
+      return 0;
+    }
+    std::memset(header_, 0, page_size_);
+    mach_write_to_4(header_ + HEADER_MAGIC, MAGIC);
+    mach_write_to_4(header_ + HEADER_N_PAGES, n);
+    mach_write_to_4(header_ + HEADER_PAGE_SIZE, static_cast<uint32_t>(page_size_));
+    byte *bufs[BATCH_PAGES + 1];
+    bufs[0] = header_;
+    for (uint32_t i = 0; i < n; ++i) {
+      mach_write_to_4(header_ + HEADER_ENTRIES + i * 8, entries[i].space_id_);
+      mach_write_to_4(header_ + HEADER_ENTRIES + i * 8 + 4, entries[i].page_id_);
+      bufs[1 + i] = entries[i].data_;
+    }
+    // 副本不完整时不能原地写，这一批page保持脏的，之后再写
+    if (!file_.WritePages(next_slot_ * SLOT_PAGES, bufs, n + 1) || !file_.Sync()) {
+      return 0;
+    }
+    next_slot_ = (next_slot_ + 1) % N_SLOTS;
+    n_batches_++;
+    n_pages_ += n;
+  }
+  auto t2 = std::chrono::steady_clock::now();
+
+  // 2.原地写，同一个文件中相邻的page合并成一次pwritev
+  uint32_t n_writes = 0;
+  uint32_t begin = 0;
+  while (begin < n) {
+    uint32_t end = begin + 1;
+    while (end < n
+           && entries[end].file_ == entries[begin].file_
+           && entries[end].page_id_ == entries[end - 1].page_id_ + 1) {
+      end++;
+    }
+    byte *bufs[BATCH_PAGES];
+    for (uint32_t i = begin; i < end; ++i) {
+      bufs[i - begin] = entries[i].data_;
+    }
+    bool ok = entries[begin].file_->WritePages(entries[begin].page_id_, bufs, end - begin);
+    for (uint32_t i = begin; i < end; ++i) {
+      entries[i].ok_ = ok;
+    }
+    n_writes++;
+    begin = end;
+  }
+
+  // 3.记下写过的表空间文件，slot被覆盖之前再fsync。entries按照space_id排好序，同一个文件挨在一起
+  if (staged) {
+    for (uint32_t i = 0; i < n; ++i) {
+      const auto &file = entries[i].file_;
+      if ((i > 0 && file == entries[i - 1].file_)
+          || std::find(unsynced_files_.begin(), unsynced_files_.end(), file) != unsynced_files_.end()) {
+        continue;
+      }
+      unsynced_files_.push_back(file);
+    }
+  }
+  auto t3 = std::chrono::steady_clock::now();
+  stage_time_ += (t2 - t1).count();
+  write_time_ += (t3 - t2).count();
+  return n_writes;
+}
+
+void Doublewrite::ReportStats(std::ostream &os) const {
+  os << "doublewrite: " << (enabled_ && file_.IsOpen() ? "on" : "off") << std::endl;
+  os << "doublewrite_batches: " << n_batches_ << std::endl;
+  os << "doublewrite_pages: " << n_pages_ << std::endl;
+  os << "doublewrite_stage_time: " << stage_time_ << std::endl;
+  os << "doublewrite_write_time: " << write_time_ << std::endl;
+  os << "doublewrite_data_syncs: " << n_data_syncs_ << std::endl;
+}
+
+}
@@ -0,0 +1,65 @@
+#include "frame_arena.h"
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <sys/mman.h>
+namespace Lemon {
+
+// MAP_HUGETLB要求映射的长度是大页大小的整数倍
+static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+FrameArena::~FrameArena() {
+  Release();
+}
+
+void FrameArena::Release() {
+  if (addr_ != nullptr) {
+    munmap(addr_, len_);
+    addr_ = nullptr;
+  }
+  len_ = 0;
+  huge_tlb_ = false;
+  locked_ = false;
+}
+
+bool FrameArena::Allocate(size_t n_frames, size_t frame_size) {
+  Release();
+  frame_size_ = frame_size;
+  size_t len = n_frames * frame_size;
+
+  // 1.先尝试预留的大页
+  size_t huge_len = (len + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+  void *addr = mmap(nullptr, huge_len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (addr != MAP_FAILED) {
+    addr_ = static_cast<byte *>(addr);
+    len_ = huge_len;
+    huge_tlb_ = true;
+    return true;
+  }
+
+  // 2.没有预留大页，使用普通的匿名映射，让内核尽量用透明大页
+  addr = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (addr == MAP_FAILED) {
+    std::cerr << "allocate " << len << " bytes for buffer pool failed: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  madvise(addr, len, MADV_HUGEPAGE);
+  addr_ = static_cast<byte *>(addr);
+  len_ = len;
+  return true;
+}
+
+bool FrameArena::Lock() {
+  if (addr_ == nullptr || locked_) {
+    return locked_;
+  }
+  if (mlock(addr_, len_) != 0) {
+    std::cerr << "mlock buffer pool failed: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  locked_ = true;
+  return true;
+}
+
+}
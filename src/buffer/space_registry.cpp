@@ -0,0 +1,293 @@
+#include "space_registry.h"
+#include "utility.h"
+#include "page_layout.h"
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+namespace Lemon {
+
+// 读取表空间文件第一个page中的space_id
+static bool ReadSpaceId(const std::string &file_name, space_id_t &space_id) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  byte buf[4];
+  bool ok = pread(fd, buf, sizeof(buf), FIL_PAGE_ARCH_LOG_NO_OR_SPACE_ID) == static_cast<ssize_t>(sizeof(buf));
+  close(fd);
+  if (ok) {
+    space_id = mach_read_from_4(buf);
+  }
+  return ok;
+}
+
+SpaceRegistry::SpaceRegistry(std::string data_path, std::string cache_path) :
+    data_path_(std::move(data_path)),
+    cache_path_(std::move(cache_path)) {
+
+}
+
+void SpaceRegistry::SetOpenFilesLimit(uint32_t n) {
+  std::lock_guard<std::mutex> guard(latch_);
+  open_files_limit_ = n;
+  EvictLocked();
+}
+
+void SpaceRegistry::SetDirectIO(bool direct) {
+  std::lock_guard<std::mutex> guard(latch_);
+  direct_ = direct;
+  while (!lru_.empty()) {
+    CloseLocked(lru_.back());
+  }
+}
+
+size_t SpaceRegistry::DetectPageSize() {
+  size_t page_size;
+  if (ReadPageSize(data_path_ + "/ibdata1", page_size)) {
+    return page_size;
+  }
+  std::lock_guard<std::mutex> guard(latch_);
+  if (!cache_loaded_) {
+    LoadCacheLocked();
+  }
+  if (file_names_.empty() && !scanned_) {
+    ScanLocked();
+  }
+  for (const auto &file_name: file_names_) {
+    if (ReadPageSize(file_name.second, page_size)) {
+      return page_size;
+    }
+  }
+  return 0;
+}
+
+void SpaceRegistry::Register(space_id_t space_id, const std::string &file_name) {
+  std::string path;
+  if (!file_name.empty() && file_name[0] == '/') {
+    path = file_name;
+  } else {
+    path = data_path_ + "/" + (file_name.compare(0, 2, "./") == 0 ? file_name.substr(2) : file_name);
+  }
+  std::lock_guard<std::mutex> guard(latch_);
+  auto iter = file_names_.find(space_id);
+  if (iter != file_names_.end() && iter->second == path) {
+    return;
+  }
+  file_names_[space_id] = path;
+  unverified_.erase(space_id);
+  changed_ = true;
+  // 文件换了，之前打开的文件不能再用
+  CloseLocked(space_id);
+}
+
+void SpaceRegistry::Remove(space_id_t space_id) {
+  std::lock_guard<std::mutex> guard(latch_);
+  CloseLocked(space_id);
+  unverified_.erase(space_id);
+  if (file_names_.erase(space_id) > 0) {
+    changed_ = true;
+  }
+}
+
+std::string SpaceRegistry::GetFileName(space_id_t space_id) {
+  std::lock_guard<std::mutex> guard(latch_);
+  std::string file_name;
+  LookupLocked(space_id, file_name);
+  return file_name;
+}
+
+std::shared_ptr<DataFile> SpaceRegistry::Open(space_id_t space_id) {
+  std::lock_guard<std::mutex> guard(latch_);
+  auto iter = open_files_.find(space_id);
+  if (iter != open_files_.end()) {
+    lru_.splice(lru_.begin(), lru_, iter->second.lru_iter_);
+    return iter->second.file_;
+  }
+
+  std::string file_name;
+  if (!LookupLocked(space_id, file_name)) {
+    return nullptr;
+  }
+  // 缓存文件中的映射可能已经过时了，第一次打开之前确认一下文件中的space_id，不对的话重新扫描
+  if (unverified_.erase(space_id) > 0) {
+    space_id_t file_space_id;
+    if (!ReadSpaceId(file_name, file_space_id) || file_space_id != space_id) {
+      file_names_.erase(space_id);
+      changed_ = true;
+      scanned_ = false;
+      if (!LookupLocked(space_id, file_name)) {
+        return nullptr;
+      }
+    }
+  }
+
+  auto file = std::make_shared<DataFile>();
+  if (!file->Open(file_name, direct_, page_size_)) {
+    return nullptr;
+  }
+  n_opens_++;
+  EvictLocked();
+  lru_.push_front(space_id);
+  open_files_.insert({space_id, {file, lru_.begin()}});
+  return file;
+}
+
+void SpaceRegistry::SyncAll() {
+  std::vector<std::shared_ptr<DataFile>> files;
+  {
+    std::lock_guard<std::mutex> guard(latch_);
+    for (const auto &open_file: open_files_) {
+      files.push_back(open_file.second.file_);
+    }
+  }
+  // 被关闭的文件在关闭时已经fsync过了
+  for (const auto &file: files) {
+    if (file->IsUnsynced()) {
+      file->Sync();
+    }
+  }
+}
+
+bool SpaceRegistry::LookupLocked(space_id_t space_id, std::string &file_name) {
+  if (!cache_loaded_) {
+    LoadCacheLocked();
+  }
+  auto iter = file_names_.find(space_id);
+  if (iter == file_names_.end() && !scanned_) {
+    ScanLocked();
+    iter = file_names_.find(space_id);
+  }
+  if (iter == file_names_.end()) {
+    return false;
+  }
+  file_name = iter->second;
+  return true;
+}
+
+void SpaceRegistry::LoadCacheLocked() {
+  cache_loaded_ = true;
+  std::ifstream ifs(cache_path_);
+  std::string line;
+  while (std::getline(ifs, line)) {
+    std::istringstream iss(line);
+    space_id_t space_id;
+    std::string file_name;
+    // 解析日志时加入的映射比缓存文件新，不覆盖
+    if (iss >> space_id >> file_name && file_names_.emplace(space_id, file_name).second) {
+      unverified_.insert(space_id);
+    }
+  }
+}
+
+void SpaceRegistry::ScanLocked() {
+  scanned_ = true;
+  auto t1 = std::chrono::steady_clock::now();
+  std::vector<std::string> all_files;
+  TravelDirectory(data_path_, ".ibd", all_files);
+
+  // 已经知道space_id的文件不需要再打开
+  std::unordered_set<std::string> known_files;
+  for (const auto &file_name: file_names_) {
+    known_files.insert(file_name.second);
+  }
+  std::vector<std::string> files;
+  for (auto &file_name: all_files) {
+    if (known_files.find(file_name) == known_files.end()) {
+      files.push_back(std::move(file_name));
+    }
+  }
+
+  std::vector<space_id_t> space_ids(files.size());
+  std::vector<char> found(files.size(), 0);
+  std::atomic<size_t> next{0};
+  auto scan = [&files, &space_ids, &found, &next]() {
+    for (size_t i = next++; i < files.size(); i = next++) {
+      found[i] = ReadSpaceId(files[i], space_ids[i]);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (uint32_t i = 1; i < scan_threads_ && i < files.size(); ++i) {
+    threads.emplace_back(scan);
+  }
+  scan();
+  for (auto &thread: threads) {
+    thread.join();
+  }
+
+  for (size_t i = 0; i < files.size(); ++i) {
+    if (found[i] && file_names_.emplace(space_ids[i], files[i]).second) {
+      changed_ = true;
+    }
+  }
+  n_scanned_files_ += files.size();
+  auto t2 = std::chrono::steady_clock::now();
+  scan_time_ += (t2 - t1).count();
+}
+
+void SpaceRegistry::EvictLocked() {
+  while (open_files_limit_ > 0 && open_files_.size() >= open_files_limit_) {
+    CloseLocked(lru_.back());
+    n_closes_++;
+  }
+}
+
+void SpaceRegistry::CloseLocked(space_id_t space_id) {
+  auto iter = open_files_.find(space_id);
+  if (iter == open_files_.end()) {
+    return;
+  }
+  // 其他线程可能还在用这个文件，最后一个使用者释放之后才真正关闭
+  lru_.erase(iter->second.lru_iter_);
+  open_files_.erase(iter);
+}
+
+bool SpaceRegistry::SaveCache() {
+  std::string content;
+  {
+    std::lock_guard<std::mutex> guard(latch_);
+    if (!changed_) {
+      return true;
+    }
+    for (const auto &file_name: file_names_) {
+      content.append(std::to_string(file_name.first)).append(" ").append(file_name.second).append("\n");
+    }
+    changed_ = false;
+  }
+
+  std::string tmp_path = cache_path_ + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    std::cerr << "open " << tmp_path << " failed: " << std::strerror(errno) << std::endl;
+    return false;
+  }
+  bool ok = write(fd, content.data(), content.size()) == static_cast<ssize_t>(content.size())
+            && fsync(fd) == 0;
+  close(fd);
+  if (!ok || rename(tmp_path.c_str(), cache_path_.c_str()) != 0) {
+    std::cerr << "write space cache " << cache_path_ << " failed: " << std::strerror(errno) << std::endl;
+    std::lock_guard<std::mutex> guard(latch_);
+    changed_ = true;
+    return false;
+  }
+  return true;
+}
+
+void SpaceRegistry::ReportStats(std::ostream &os) const {
+  {
+    std::lock_guard<std::mutex> guard(latch_);
+    os << "known_spaces: " << file_names_.size() << std::endl;
+    os << "open_files: " << open_files_.size() << std::endl;
+  }
+  os << "file_opens: " << n_opens_ << std::endl;
+  os << "file_closes_by_limit: " << n_closes_ << std::endl;
+  os << "scanned_files: " << n_scanned_files_ << std::endl;
+  os << "scan_time: " << scan_time_ << std::endl;
+}
+
+}
@@ -3,6 +3,8 @@
 #include <fstream>
 #include <fmt/format.h>
 #include <unordered_map>
+#include <cstring>
+#include <string>
 using namespace Lemon;
 void CompareLog() {
   std::ifstream standard_ifs("/home/lemon/mysql/parsed_logs/redolog.txt", std::ios::in);
@@ -69,11 +71,61 @@ void test() {
     }
   }
 }
-int main() {
+int main(int argc, char *argv[]) {
+  // buffer pool要先按照参数中的大小分配好，ApplySystem和其他参数都会用到它
+  uint64_t buffer_pool_size_mb = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strncmp(argv[i], "--buffer-pool-size=", 19) == 0) {
+      buffer_pool_size_mb = std::stoull(argv[i] + 19);
+    }
+  }
+  if (!buffer_pool.Init(buffer_pool_size_mb)) {
+    return 1;
+  }
+
   ApplySystem applySystem(true);
-  while (1) {
-    applySystem.PopulateHashMap();
-    applySystem.ApplyHashLogs();
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    if (std::strncmp(arg, "--buffer-pool-size=", 19) == 0) {
+      continue;
+    } else if (std::strncmp(arg, "--apply-threads=", 16) == 0) {
+      applySystem.SetApplyThreads(static_cast<uint32_t>(std::stoul(arg + 16)));
+    } else if (std::strncmp(arg, "--prefetch-depth=", 17) == 0) {
+      applySystem.SetPrefetchDepth(static_cast<uint32_t>(std::stoul(arg + 17)));
+    } else if (std::strncmp(arg, "--suspend-window=", 17) == 0) {
+      applySystem.SetSuspendWindow(static_cast<uint32_t>(std::stoul(arg + 17)));
+    } else if (std::strncmp(arg, "--target-lsn=", 13) == 0) {
+      applySystem.SetTargetLSN(std::stoull(arg + 13));
+    } else if (std::strncmp(arg, "--checkpoint-interval=", 22) == 0) {
+      applySystem.SetCheckpointInterval(static_cast<uint32_t>(std::stoul(arg + 22)));
+    } else if (std::strncmp(arg, "--free-frames=", 14) == 0) {
+      applySystem.SetFreeFrames(static_cast<uint32_t>(std::stoul(arg + 14)));
+    } else if (std::strncmp(arg, "--buffer-pool-size-file=", 24) == 0) {
+      applySystem.SetBufferPoolSizeFile(arg + 24);
+    } else if (std::strcmp(arg, "--replacement=clock") == 0) {
+      applySystem.SetReplacementPolicy(ReplacementPolicy::CLOCK);
+    } else if (std::strcmp(arg, "--replacement=log-aware") == 0) {
+      applySystem.SetReplacementPolicy(ReplacementPolicy::LOG_AWARE);
+    } else if (std::strncmp(arg, "--open-files-limit=", 19) == 0) {
+      applySystem.SetOpenFilesLimit(static_cast<uint32_t>(std::stoul(arg + 19)));
+    } else if (std::strncmp(arg, "--space-scan-threads=", 21) == 0) {
+      applySystem.SetSpaceScanThreads(static_cast<uint32_t>(std::stoul(arg + 21)));
+    } else if (std::strcmp(arg, "--direct-io") == 0) {
+      applySystem.SetDirectIO(true);
+    } else if (std::strcmp(arg, "--doublewrite") == 0) {
+      applySystem.SetDoublewrite(true);
+    } else if (std::strcmp(arg, "--validate-pages") == 0) {
+      applySystem.SetPageValidation(true);
+    } else if (std::strcmp(arg, "--lock-buffer-pool") == 0) {
+      applySystem.LockBufferPool();
+    } else if (std::strncmp(arg, "--pipeline-depth=", 17) == 0) {
+      applySystem.SetPipelineDepth(static_cast<uint32_t>(std::stoul(arg + 17)));
+    } else {
+      std::cerr << "unknown option: " << arg << std::endl;
+      return 1;
+    }
   }
+  applySystem.Run();
+  applySystem.ReportStats(std::cout);
 //CompareLog();
 }
\ No newline at end of file
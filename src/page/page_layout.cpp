@@ -1,6 +1,80 @@
 #include "page_layout.h"
+#include "utility.h"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
 namespace Lemon {
 
+size_t PageSizeFromFspFlags(uint32_t flags) {
+  uint32_t ssize = (flags & FSP_FLAGS_MASK_PAGE_SSIZE) >> FSP_FLAGS_POS_PAGE_SSIZE;
+  if (ssize == 0) {
+    return UNIV_PAGE_SIZE_DEF;
+  }
+  size_t page_size = static_cast<size_t>(512) << ssize;
+  if (page_size < UNIV_PAGE_SIZE_MIN || page_size > UNIV_PAGE_SIZE_MAX) {
+    return 0;
+  }
+  return page_size;
+}
+
+bool ReadPageSize(const std::string &file_name, size_t &page_size) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  byte buf[4];
+  bool ok = pread(fd, buf, sizeof(buf), FSP_HEADER_OFFSET + FSP_SPACE_FLAGS) == static_cast<ssize_t>(sizeof(buf));
+  close(fd);
+  if (!ok) {
+    return false;
+  }
+  page_size = PageSizeFromFspFlags(mach_read_from_4(buf));
+  return page_size != 0;
+}
+
+bool PageIsTorn(const byte *page, size_t page_size) {
+  return mach_read_from_4(page + FIL_PAGE_LSN + 4)
+         != mach_read_from_4(page + page_size - FIL_PAGE_END_LSN_OLD_CHKSUM + 4);
+}
 
+uint32_t PageCalcChecksumCrc32(const byte *page, size_t page_size) {
+  uint32_t c1 = ut_crc32(page + FIL_PAGE_OFFSET, FIL_PAGE_FILE_FLUSH_LSN - FIL_PAGE_OFFSET);
+  uint32_t c2 = ut_crc32(page + FIL_PAGE_DATA, page_size - FIL_PAGE_DATA - FIL_PAGE_END_LSN_OLD_CHKSUM);
+  return c1 ^ c2;
+}
+
+const char *PageCheckString(PageCheck check) {
+  switch (check) {
+    case PageCheck::OK:
+      return "ok";
+    case PageCheck::BAD_CHECKSUM:
+      return "bad checksum";
+    case PageCheck::LSN_MISMATCH:
+      return "header and trailer LSN mismatch";
+    case PageCheck::ID_MISMATCH:
+      return "space_id or page_id mismatch";
+  }
+  return "unknown";
+}
+
+PageCheck CheckPage(const byte *page, size_t page_size, space_id_t space_id, page_id_t page_id) {
+  uint32_t checksum = mach_read_from_4(page + FIL_PAGE_SPACE_OR_CHKSUM);
+  // 只有checksum和LSN都是0的时候才需要检查是不是整个page都是0
+  if (checksum == 0 && mach_read_from_8(page + FIL_PAGE_LSN) == 0
+      && page[0] == 0 && std::memcmp(page, page + 1, page_size - 1) == 0) {
+    return PageCheck::OK;
+  }
+  if (PageIsTorn(page, page_size)) {
+    return PageCheck::LSN_MISMATCH;
+  }
+  if (checksum != BUF_NO_CHECKSUM_MAGIC && checksum != PageCalcChecksumCrc32(page, page_size)) {
+    return PageCheck::BAD_CHECKSUM;
+  }
+  if (mach_read_from_4(page + FIL_PAGE_OFFSET) != page_id
+      || mach_read_from_4(page + FIL_PAGE_ARCH_LOG_NO_OR_SPACE_ID) != space_id) {
+    return PageCheck::ID_MISMATCH;
+  }
+  return PageCheck::OK;
+}
 
 }
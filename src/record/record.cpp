@@ -4,6 +4,7 @@
 #include <string>
 #include <iostream>
 #include "utility.h"
+#include "page_layout.h"
 namespace Lemon {
 
 uint32_t
@@ -150,6 +151,7 @@ rec_get_heap_no_new(
 The following function is used to get the pointer of the next chained record
 on the same page.
 @return pointer to the next chained record, or NULL if none */
+template <size_t PAGE_SIZE>
 const byte*
 rec_get_next_ptr_const(const byte *page, const byte* rec)	/*!< in: physical record */
 
@@ -164,20 +166,21 @@ rec_get_next_ptr_const(const byte *page, const byte* rec)	/*!< in: physical reco
   }
 
   // TODO 可能有问题的地方
-  return page + ((rec - page + field_value) % DATA_PAGE_SIZE);
+  return page + ((rec - page + field_value) % PAGE_SIZE);
 }
 
 /******************************************************//**
 The following function is used to get the pointer of the next chained record
 on the same page.
 @return pointer to the next chained record, or NULL if none */
+template <size_t PAGE_SIZE>
 byte*
 rec_get_next_ptr(
 /*=============*/
     const byte *page,
     byte*	rec) /*!< in: physical record */
 {
-return(const_cast<byte*>(rec_get_next_ptr_const(page, rec)));
+return(const_cast<byte*>(rec_get_next_ptr_const<PAGE_SIZE>(page, rec)));
 }
 
 byte*
@@ -198,6 +201,7 @@ rec_copy(void* buf, const RecordInfo &rec_info)
   return((byte*) buf + extra_len);
 }
 
+template <size_t PAGE_SIZE>
 uint32_t rec_get_next_offs(const byte* page, const byte *rec) {
   uint32_t field_value;
   field_value = mach_read_from_2(rec - REC_NEXT);
@@ -205,12 +209,13 @@ uint32_t rec_get_next_offs(const byte* page, const byte *rec) {
     return(0);
   }
   // TODO 可能有问题的地方
-  return (rec + field_value - page) % DATA_PAGE_SIZE;
+  return (rec + field_value - page) % PAGE_SIZE;
 }
 
 /******************************************************//**
 The following function is used to set the next record offset field
 of a new-style record. */
+template <size_t PAGE_SIZE>
 void
 rec_set_next_offs_new(
 /*==================*/
@@ -221,7 +226,7 @@ rec_set_next_offs_new(
   uint32_t	field_value;
 
   assert(rec);
-  assert(DATA_PAGE_SIZE > next);
+  assert(PAGE_SIZE > next);
 
   if (!next) {
     field_value = 0;
@@ -631,5 +636,13 @@ uint32_t rec_get_deleted_flag(const byte*	rec) {
                       REC_INFO_BITS_SHIFT);
 }
 
+// 每一种page大小实例化一份
+#define INSTANTIATE_REC_NEXT(PAGE_SIZE) \
+  template const byte *rec_get_next_ptr_const<PAGE_SIZE>(const byte *page, const byte *rec); \
+  template byte *rec_get_next_ptr<PAGE_SIZE>(const byte *page, byte *rec); \
+  template uint32_t rec_get_next_offs<PAGE_SIZE>(const byte *page, const byte *rec); \
+  template void rec_set_next_offs_new<PAGE_SIZE>(const byte *page, byte *rec, uint32_t next);
+FOR_EACH_PAGE_SIZE(INSTANTIATE_REC_NEXT)
+#undef INSTANTIATE_REC_NEXT
 
-}
\ No newline at end of file
+}
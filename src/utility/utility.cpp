@@ -2,9 +2,22 @@
 #include <dirent.h>
 #include <iostream>
 #include <cassert>
+#include <cstring>
+#include <cstdlib>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
 
 namespace Lemon {
 
+const std::string &MysqlHome() {
+  static const std::string home = []() {
+    const char *env = std::getenv("LEMON_MYSQL_HOME");
+    return std::string(env != nullptr && env[0] != '\0' ? env : "/home/lemon/mysql");
+  }();
+  return home;
+}
+
 /**
  * 递归遍历文件夹下以suffix结尾的文件
  * @param dir_path 文件夹路径，不要以/结尾
@@ -359,4 +372,64 @@ lsn_t recv_calc_lsn_on_data_add(
 }
 
 
+/** CRC-32C的反射多项式 */
+static constexpr uint32_t CRC32C_POLY = 0x82F63B78U;
+
+/** 查表计算CRC-32C用的表，第一次使用时生成 */
+static const uint32_t *ut_crc32_table() {
+  static const struct Table {
+    uint32_t entries_[256];
+    Table() : entries_() {
+      for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+          c = (c >> 1) ^ ((c & 1) ? CRC32C_POLY : 0);
+        }
+        entries_[i] = c;
+      }
+    }
+  } table;
+  return table.entries_;
+}
+
+static uint32_t ut_crc32_sw(const byte *buf, size_t len) {
+  const uint32_t *table = ut_crc32_table();
+  uint32_t crc = 0xFFFFFFFFU;
+  for (size_t i = 0; i < len; ++i) {
+    crc = table[(crc ^ buf[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+#if defined(__x86_64__)
+/** 用SSE4.2的crc32指令，每次处理8个字节 */
+__attribute__((target("sse4.2")))
+static uint32_t ut_crc32_hw(const byte *buf, size_t len) {
+  uint64_t crc = 0xFFFFFFFFU;
+  // 先处理到8字节对齐
+  for (; len > 0 && (reinterpret_cast<uintptr_t>(buf) & 7) != 0; --len) {
+    crc = _mm_crc32_u8(static_cast<uint32_t>(crc), *buf++);
+  }
+  for (; len >= 8; len -= 8, buf += 8) {
+    uint64_t data;
+    std::memcpy(&data, buf, 8);
+    crc = _mm_crc32_u64(crc, data);
+  }
+  for (; len > 0; --len) {
+    crc = _mm_crc32_u8(static_cast<uint32_t>(crc), *buf++);
+  }
+  return ~static_cast<uint32_t>(crc);
+}
+#endif
+
+uint32_t ut_crc32(const byte *buf, size_t len) {
+#if defined(__x86_64__)
+  static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+  if (has_sse42) {
+    return ut_crc32_hw(buf, len);
+  }
+#endif
+  return ut_crc32_sw(buf, len);
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,253 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "doublewrite.h"
+#include "space_registry.h"
+#include "page_layout.h"
+#include "utility.h"
+
+/**
+ * 模拟原地写的过程中崩溃：一批或两批page经过doublewrite文件写回之后不清空header，
+ * 再把表空间文件或者doublewrite文件中的page写坏，检查Recover能不能正确地修复。
+ * 写坏的是page中间的字节，头尾的LSN都还是一致的，只有checksum能发现。
+ */
+namespace Lemon {
+
+static constexpr size_t TEST_PAGE_SIZE = UNIV_PAGE_SIZE_DEF;
+static constexpr space_id_t TEST_SPACE_ID = 7;
+static constexpr page_id_t N_PAGES = 8;
+// 一批写回的page：5、6、7
+static constexpr page_id_t FIRST_PAGE = 5;
+static constexpr uint32_t BATCH = 3;
+
+// 构造一个checksum正确的page，和BufferPool::WriteFrames写回之前一样在头尾写上crc32
+static void MakePage(byte *page, page_id_t page_id, lsn_t lsn) {
+  for (size_t i = 0; i < TEST_PAGE_SIZE; ++i) {
+    page[i] = static_cast<byte>(i * 31 + page_id);
+  }
+  mach_write_to_4(page + FIL_PAGE_OFFSET, page_id);
+  mach_write_to_4(page + FIL_PAGE_ARCH_LOG_NO_OR_SPACE_ID, TEST_SPACE_ID);
+  mach_write_to_8(page + FIL_PAGE_LSN, lsn);
+  mach_write_to_8(page + FIL_PAGE_FILE_FLUSH_LSN, 0);
+  mach_write_to_4(page + TEST_PAGE_SIZE - FIL_PAGE_END_LSN_OLD_CHKSUM + 4, static_cast<uint32_t>(lsn));
+  uint32_t checksum = PageCalcChecksumCrc32(page, TEST_PAGE_SIZE);
+  mach_write_to_4(page + FIL_PAGE_SPACE_OR_CHKSUM, checksum);
+  mach_write_to_4(page + TEST_PAGE_SIZE - FIL_PAGE_END_LSN_OLD_CHKSUM, checksum);
+}
+
+// 把文件中第n个page中间的一段字节改掉，模拟只写了一半的page
+static bool DamageMiddle(const std::string &path, uint32_t n) {
+  int fd = open(path.c_str(), O_RDWR);
+  if (fd == -1) {
+    return false;
+  }
+  std::vector<byte> garbage(512, 0x5A);
+  off_t offset = static_cast<off_t>(n) * TEST_PAGE_SIZE + TEST_PAGE_SIZE / 2;
+  bool ok = pwrite(fd, garbage.data(), garbage.size(), offset) == static_cast<ssize_t>(garbage.size());
+  close(fd);
+  return ok;
+}
+
+static bool ReadFilePage(const std::string &path, page_id_t page_id, byte *page) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  off_t offset = static_cast<off_t>(page_id) * TEST_PAGE_SIZE;
+  bool ok = pread(fd, page, TEST_PAGE_SIZE, offset) == static_cast<ssize_t>(TEST_PAGE_SIZE);
+  close(fd);
+  return ok;
+}
+
+static bool CreateSpaceFile(const std::string &path) {
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    return false;
+  }
+  bool ok = ftruncate(fd, static_cast<off_t>(N_PAGES) * TEST_PAGE_SIZE) == 0;
+  close(fd);
+  return ok;
+}
+
+class DoublewriteTest {
+public:
+  explicit DoublewriteTest(const std::string &dir) :
+      dir_(dir), space_file_(dir + "/t1.ibd"), dw_file_(dir + "/doublewrite") {
+    for (uint32_t i = 0; i < BATCH; ++i) {
+      pages_[i] = static_cast<byte *>(aligned_alloc(UNIV_PAGE_SIZE_MIN, TEST_PAGE_SIZE));
+      MakePage(pages_[i], FIRST_PAGE + i, 1000 + i);
+    }
+  }
+
+  ~DoublewriteTest() {
+    for (byte *page: pages_) {
+      free(page);
+    }
+    std::remove(space_file_.c_str());
+    std::remove(dw_file_.c_str());
+  }
+
+  // 写一批page，返回之前不清空header，相当于原地写完之后、下一批开始之前崩溃了。
+  // newer不为空时再用下一个slot写一批，只有第二个page的新版本
+  bool WriteBatch(byte *newer = nullptr) {
+    std::remove(dw_file_.c_str());
+    if (!CreateSpaceFile(space_file_)) {
+      std::cerr << "create " << space_file_ << " failed" << std::endl;
+      return false;
+    }
+    SpaceRegistry spaces(dir_, dir_ + "/space_registry");
+    spaces.SetPageSize(TEST_PAGE_SIZE);
+    spaces.Register(TEST_SPACE_ID, space_file_);
+    std::shared_ptr<DataFile> file = spaces.Open(TEST_SPACE_ID);
+    Doublewrite doublewrite(dw_file_);
+    if (file == nullptr || !doublewrite.Open(TEST_PAGE_SIZE)) {
+      std::cerr << "open files failed" << std::endl;
+      return false;
+    }
+    doublewrite.SetEnabled(true);
+    std::vector<Doublewrite::Entry> entries;
+    for (uint32_t i = 0; i < BATCH; ++i) {
+      entries.push_back({TEST_SPACE_ID, FIRST_PAGE + i, file, pages_[i], false});
+    }
+    doublewrite.Write(entries);
+    if (newer != nullptr) {
+      entries.push_back({TEST_SPACE_ID, FIRST_PAGE + 1, file, newer, false});
+      entries.erase(entries.begin(), entries.end() - 1);
+      doublewrite.Write(entries);
+    }
+    for (const auto &entry: entries) {
+      if (!entry.ok_) {
+        std::cerr << "write page " << entry.page_id_ << " failed" << std::endl;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // 重新启动：打开doublewrite文件并修复
+  uint32_t Recover() {
+    SpaceRegistry spaces(dir_, dir_ + "/space_registry");
+    spaces.SetPageSize(TEST_PAGE_SIZE);
+    spaces.Register(TEST_SPACE_ID, space_file_);
+    Doublewrite doublewrite(dw_file_);
+    if (!doublewrite.Open(TEST_PAGE_SIZE)) {
+      return 0;
+    }
+    return doublewrite.Recover(spaces);
+  }
+
+  // 表空间文件中的page和写下去的是否相同
+  bool PageIntact(uint32_t i) {
+    std::vector<byte> buf(TEST_PAGE_SIZE);
+    return ReadFilePage(space_file_, FIRST_PAGE + i, buf.data())
+           && std::memcmp(buf.data(), pages_[i], TEST_PAGE_SIZE) == 0;
+  }
+
+  // 原地写的page中间写坏了，头尾的LSN一致，要用副本修复，其他的page不动
+  bool TestTornInPlacePage() {
+    if (!WriteBatch() || !DamageMiddle(space_file_, FIRST_PAGE + 1)) {
+      return false;
+    }
+    uint32_t n_repaired = Recover();
+    if (n_repaired != 1) {
+      std::cerr << "torn in-place page: repaired " << n_repaired << " pages, expected 1" << std::endl;
+      return false;
+    }
+    for (uint32_t i = 0; i < BATCH; ++i) {
+      if (!PageIntact(i)) {
+        std::cerr << "torn in-place page: page " << FIRST_PAGE + i << " is not restored" << std::endl;
+        return false;
+      }
+    }
+    // header已经清空了，再启动一次不会再修复
+    if (Recover() != 0) {
+      std::cerr << "torn in-place page: doublewrite header is not cleared" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // 副本中间写坏了，不能用它覆盖表空间文件中的page
+  bool TestTornStagedCopy() {
+    if (!WriteBatch()
+        || !DamageMiddle(dw_file_, 1 + 1)
+        || !DamageMiddle(space_file_, FIRST_PAGE + 1)) {
+      return false;
+    }
+    std::vector<byte> damaged(TEST_PAGE_SIZE);
+    if (!ReadFilePage(space_file_, FIRST_PAGE + 1, damaged.data())) {
+      return false;
+    }
+    uint32_t n_repaired = Recover();
+    if (n_repaired != 0) {
+      std::cerr << "torn staged copy: repaired " << n_repaired << " pages, expected 0" << std::endl;
+      return false;
+    }
+    std::vector<byte> buf(TEST_PAGE_SIZE);
+    if (!ReadFilePage(space_file_, FIRST_PAGE + 1, buf.data())
+        || std::memcmp(buf.data(), damaged.data(), TEST_PAGE_SIZE) != 0) {
+      std::cerr << "torn staged copy: page " << FIRST_PAGE + 1 << " was overwritten" << std::endl;
+      return false;
+    }
+    if (!PageIntact(0) || !PageIntact(2)) {
+      std::cerr << "torn staged copy: undamaged pages were changed" << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // 同一个page在两个slot中都有副本，用LSN大的那个修复
+  bool TestNewestCopy() {
+    byte *newer = static_cast<byte *>(aligned_alloc(UNIV_PAGE_SIZE_MIN, TEST_PAGE_SIZE));
+    MakePage(newer, FIRST_PAGE + 1, 2000);
+    bool ok = WriteBatch(newer) && DamageMiddle(space_file_, FIRST_PAGE + 1);
+    uint32_t n_repaired = ok ? Recover() : 0;
+    if (ok && n_repaired != 1) {
+      std::cerr << "newest copy: repaired " << n_repaired << " pages, expected 1" << std::endl;
+      ok = false;
+    }
+    std::vector<byte> buf(TEST_PAGE_SIZE);
+    if (ok && (!ReadFilePage(space_file_, FIRST_PAGE + 1, buf.data())
+               || std::memcmp(buf.data(), newer, TEST_PAGE_SIZE) != 0)) {
+      std::cerr << "newest copy: page " << FIRST_PAGE + 1 << " is not restored from the newer copy" << std::endl;
+      ok = false;
+    }
+    free(newer);
+    return ok;
+  }
+
+private:
+  std::string dir_;
+  std::string space_file_;
+  std::string dw_file_;
+  byte *pages_[BATCH];
+};
+
+}
+
+using namespace Lemon;
+
+int main() {
+  char dir_template[] = "/tmp/doublewrite_test.XXXXXX";
+  char *dir = mkdtemp(dir_template);
+  if (dir == nullptr) {
+    std::cerr << "create temporary directory failed" << std::endl;
+    return 1;
+  }
+  bool ok;
+  {
+    DoublewriteTest test(dir);
+    ok = test.TestTornInPlacePage();
+    ok = test.TestTornStagedCopy() && ok;
+    ok = test.TestNewestCopy() && ok;
+  }
+  std::remove((std::string(dir) + "/space_registry").c_str());
+  rmdir(dir);
+  std::cout << (ok ? "doublewrite recovery tests passed" : "doublewrite recovery tests failed") << std::endl;
+  return ok ? 0 : 1;
+}
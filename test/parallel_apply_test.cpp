@@ -0,0 +1,442 @@
+#include <iostream>
+#include <fstream>
+#include <random>
+#include <deque>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+#include "apply.h"
+#include "parse.h"
+#include "buffer_pool.h"
+#include "utility.h"
+
+/**
+ * 同一批日志分别用1个apply线程和N个apply线程apply，写回之后逐字节比较表空间文件中的每一个page。
+ * 日志是随机生成的：每个page先MLOG_COMP_PAGE_CREATE，之后是随机的插入、删除和直接修改page的日志，
+ * 不同page的日志按照LSN交错在一起。page比buffer pool的frame多，apply的过程中会淘汰脏page。
+ * 同一段日志还会分成多批，分别用CLOCK和LOG_AWARE替换策略apply，比较两者的命中率。
+ * 所有文件都放在LEMON_MYSQL_HOME下，不会碰到真正的数据目录。
+ */
+namespace Lemon {
+
+// ApplyHashLogs只apply这个范围中的表空间
+static constexpr space_id_t TEST_SPACE_ID = 30;
+// 比一个chunk的frame多，apply的过程中一定会淘汰
+static constexpr page_id_t N_PAGES = BUFFER_POOL_CHUNK_SIZE + 2048;
+static constexpr size_t TEST_PAGE_SIZE = UNIV_PAGE_SIZE_DEF;
+// config.h中没有的两个page内偏移，和InnoDB的定义一致
+static constexpr uint32_t FIL_PAGE_PREV = 8;
+static constexpr uint32_t PAGE_BTR_SEG_LEAF = 36;
+
+struct TestLog {
+  LOG_TYPE type_;
+  page_id_t page_id_;
+  lsn_t lsn_;
+  std::vector<byte> rec_; // [type][space_id][page_id][body]
+  uint32_t body_offset_;
+};
+
+// 可以直接往ApplySystem中放一批日志，跳过redo log文件的读取和解析
+class ParallelApplyTest {
+public:
+  static bool ApplyBatch(ApplySystem &apply_system, std::deque<TestLog> &logs, lsn_t end_lsn) {
+    for (auto &log: logs) {
+      apply_system.AddLog(log.type_, TEST_SPACE_ID, log.page_id_, log.lsn_, static_cast<uint32_t>(log.rec_.size()),
+                          log.rec_.data(), log.rec_.data() + log.body_offset_);
+    }
+    apply_system.FinishBatch(nullptr, 0, end_lsn, 0);
+    return apply_system.ApplyHashLogs();
+  }
+
+  // 按照LSN的顺序把日志分成n_batches批，流水线模式下一批一批地apply，apply一批的时候下一批已经解析好了，
+  // LOG_AWARE策略可以看到下一批要用到的page
+  static bool ApplyInBatches(ApplySystem &apply_system, std::deque<TestLog> &logs, lsn_t end_lsn,
+                             uint32_t n_batches) {
+    apply_system.SetPipelineDepth(2);
+    bool ok = true;
+    size_t begin = 0;
+    for (uint32_t batch = 0; batch < n_batches; ++batch) {
+      size_t end = logs.size() * (batch + 1) / n_batches;
+      for (size_t i = begin; i < end; ++i) {
+        TestLog &log = logs[i];
+        apply_system.AddLog(log.type_, TEST_SPACE_ID, log.page_id_, log.lsn_, static_cast<uint32_t>(log.rec_.size()),
+                            log.rec_.data(), log.rec_.data() + log.body_offset_);
+      }
+      apply_system.FinishBatch(nullptr, 0, end < logs.size() ? logs[end].lsn_ : end_lsn, 0);
+      begin = end;
+      // 第一批先不apply，等下一批解析好
+      if (batch > 0) {
+        ok = apply_system.ApplyHashLogs() && ok;
+      }
+    }
+    ok = apply_system.ApplyHashLogs() && ok;
+    apply_system.SetPipelineDepth(0);
+    return ok;
+  }
+
+  // 流水线模式下，一批日志已经解析好、还在等待apply的时候解析到了MLOG_TRUNCATE，
+  // 这一批中这个表空间的日志也要丢掉
+  static bool DiscardQueuedLogs(ApplySystem &apply_system, std::deque<TestLog> &logs, lsn_t end_lsn) {
+    apply_system.SetPipelineDepth(2);
+    for (auto &log: logs) {
+      apply_system.AddLog(log.type_, TEST_SPACE_ID, log.page_id_, log.lsn_, static_cast<uint32_t>(log.rec_.size()),
+                          log.rec_.data(), log.rec_.data() + log.body_offset_);
+    }
+    apply_system.FinishBatch(nullptr, 0, end_lsn, 0);
+
+    bool queued = apply_system.ready_batches_.size() == 1
+                  && apply_system.ready_batches_.front()->hash_map_.count(TEST_SPACE_ID) == 1;
+
+    // [type][space_id][page_id][8 bytes truncate LSN]，space_id和page_id都小于0x80，压缩格式只占一个字节
+    std::vector<byte> rec{static_cast<byte>(MLOG_TRUNCATE), static_cast<byte>(TEST_SPACE_ID), 0};
+    uint32_t body_offset = static_cast<uint32_t>(rec.size());
+    rec.resize(rec.size() + 8);
+    mach_write_to_8(rec.data() + body_offset, end_lsn);
+    apply_system.AddLog(MLOG_TRUNCATE, TEST_SPACE_ID, 0, end_lsn, static_cast<uint32_t>(rec.size()),
+                        rec.data(), rec.data() + body_offset);
+    bool ok = queued && apply_system.ready_batches_.front()->hash_map_.count(TEST_SPACE_ID) == 0;
+    if (!ok) {
+      std::cerr << "pipelined truncate: queued logs of space " << TEST_SPACE_ID << " were not discarded" << std::endl;
+    }
+    apply_system.FinishBatch(nullptr, 0, end_lsn + rec.size(), 0);
+    ok = apply_system.ApplyHashLogs() && apply_system.ApplyHashLogs() && ok;
+    apply_system.SetPipelineDepth(0);
+    return ok;
+  }
+};
+
+static void WriteCompressed(std::vector<byte> &buf, uint32_t n) {
+  byte tmp[5];
+  if (n < 0x80) {
+    buf.push_back(static_cast<byte>(n));
+  } else if (n < 0x4000) {
+    mach_write_to_2(tmp, static_cast<uint16_t>(n | 0x8000));
+    buf.insert(buf.end(), tmp, tmp + 2);
+  } else {
+    std::cerr << "compressed value too large: " << n << std::endl;
+    exit(1);
+  }
+}
+
+static void Write2(std::vector<byte> &buf, uint32_t n) {
+  byte tmp[2];
+  mach_write_to_2(tmp, static_cast<uint16_t>(n));
+  buf.insert(buf.end(), tmp, tmp + 2);
+}
+
+static void Write4(std::vector<byte> &buf, uint32_t n) {
+  byte tmp[4];
+  mach_write_to_4(tmp, n);
+  buf.insert(buf.end(), tmp, tmp + 4);
+}
+
+// 两个定长NOT NULL字段的索引：4字节的key和8字节的value
+static void WriteIndex(std::vector<byte> &buf) {
+  Write2(buf, 2);
+  Write2(buf, 2);
+  Write2(buf, 0x8000 | 4);
+  Write2(buf, 0x8000 | 8);
+}
+
+static TestLog MakeLog(LOG_TYPE type, page_id_t page_id) {
+  TestLog log{type, page_id, 0, {}, 0};
+  log.rec_.push_back(static_cast<byte>(type));
+  WriteCompressed(log.rec_, TEST_SPACE_ID);
+  WriteCompressed(log.rec_, page_id);
+  log.body_offset_ = static_cast<uint32_t>(log.rec_.size());
+  return log;
+}
+
+// 在一个scratch page上依次apply生成的日志，得到插入的记录的位置，后面的日志才能引用它们
+static bool ApplyToScratch(const TestLog &log, Page *page) {
+  byte *body = const_cast<byte *>(log.rec_.data()) + log.body_offset_;
+  byte *end = const_cast<byte *>(log.rec_.data()) + log.rec_.size();
+  LogEntry entry(log.type_, TEST_SPACE_ID, log.page_id_, 0, log.rec_.size(), body, end);
+  switch (log.type_) {
+    case MLOG_COMP_PAGE_CREATE:
+      return ApplyCompPageCreate<TEST_PAGE_SIZE>(page->GetData()) != nullptr;
+    case MLOG_COMP_REC_INSERT:
+      return ApplyCompRecInsert<TEST_PAGE_SIZE>(entry, page);
+    case MLOG_COMP_REC_DELETE:
+      return ApplyCompRecDelete<TEST_PAGE_SIZE>(entry, page);
+    case MLOG_4BYTES:
+      return ParseOrApplyNBytes<TEST_PAGE_SIZE>(log.type_, body, end, page->GetData()) != nullptr;
+    case MLOG_WRITE_STRING:
+      return ParseOrApplyString<TEST_PAGE_SIZE>(body, end, page->GetData()) != nullptr;
+    default:
+      return false;
+  }
+}
+
+static void GeneratePageLogs(page_id_t page_id, std::mt19937 &rng, byte *scratch, std::vector<TestLog> &logs) {
+  Page page(scratch, TEST_PAGE_SIZE);
+  std::memset(scratch, 0, TEST_PAGE_SIZE);
+  logs.push_back(MakeLog(MLOG_COMP_PAGE_CREATE, page_id));
+  ApplyToScratch(logs.back(), &page);
+
+  // 按照key顺序排列的记录的位置
+  std::vector<uint32_t> recs;
+  uint32_t n_ops = 20 + rng() % 60;
+  for (uint32_t op = 0; op < n_ops; ++op) {
+    uint32_t kind = rng() % 10;
+    TestLog log{};
+    if (kind < 6 || recs.empty()) {
+      // 插入：[index][cursor][end_seg_len][info_bits][origin_offset][mismatch_index][extra + data]
+      log = MakeLog(MLOG_COMP_REC_INSERT, page_id);
+      WriteIndex(log.rec_);
+      uint32_t pos = rng() % 2 == 0 ? static_cast<uint32_t>(recs.size()) : rng() % (recs.size() + 1);
+      Write2(log.rec_, pos == 0 ? PAGE_NEW_INFIMUM : recs[pos - 1]);
+      WriteCompressed(log.rec_, (17 << 1) | 1);
+      log.rec_.push_back(0);
+      WriteCompressed(log.rec_, 5);
+      WriteCompressed(log.rec_, 0);
+      log.rec_.insert(log.rec_.end(), 5, 0);
+      Write4(log.rec_, page_id * 1000 + op);
+      Write4(log.rec_, rng());
+      Write4(log.rec_, rng());
+      if (!ApplyToScratch(log, &page)) {
+        break;
+      }
+      recs.insert(recs.begin() + pos, mach_read_from_2(scratch + PAGE_HEADER + PAGE_LAST_INSERT));
+    } else if (kind < 8) {
+      // 删除：[index][offset]
+      log = MakeLog(MLOG_COMP_REC_DELETE, page_id);
+      WriteIndex(log.rec_);
+      uint32_t pos = rng() % recs.size();
+      Write2(log.rec_, recs[pos]);
+      ApplyToScratch(log, &page);
+      recs.erase(recs.begin() + pos);
+    } else if (kind < 9) {
+      // MLOG_4BYTES：[offset][compressed value]，改FIL_PAGE_PREV
+      log = MakeLog(MLOG_4BYTES, page_id);
+      Write2(log.rec_, FIL_PAGE_PREV);
+      WriteCompressed(log.rec_, rng() % 0x4000);
+      ApplyToScratch(log, &page);
+    } else {
+      // MLOG_WRITE_STRING：[offset][len][data]，改叶子段的fseg header
+      log = MakeLog(MLOG_WRITE_STRING, page_id);
+      Write2(log.rec_, PAGE_HEADER + PAGE_BTR_SEG_LEAF);
+      Write2(log.rec_, 10);
+      for (int i = 0; i < 10; ++i) {
+        log.rec_.push_back(static_cast<byte>(rng()));
+      }
+      ApplyToScratch(log, &page);
+    }
+    logs.push_back(std::move(log));
+  }
+}
+
+// 每个page的日志保持原来的顺序，不同page的日志随机交错，依次分配LSN
+static lsn_t GenerateLogs(std::deque<TestLog> &logs) {
+  std::mt19937 rng(20240601);
+  std::vector<byte> scratch(TEST_PAGE_SIZE);
+  std::vector<std::vector<TestLog>> page_logs(N_PAGES);
+  // page 0是FSP header，不修改它，启动时从它读出page大小
+  for (page_id_t page_id = 1; page_id < N_PAGES; ++page_id) {
+    GeneratePageLogs(page_id, rng, scratch.data(), page_logs[page_id]);
+  }
+  std::vector<page_id_t> pending;
+  std::vector<size_t> next(N_PAGES, 0);
+  for (page_id_t page_id = 1; page_id < N_PAGES; ++page_id) {
+    pending.push_back(page_id);
+  }
+  lsn_t lsn = LOG_START_LSN;
+  while (!pending.empty()) {
+    size_t i = rng() % pending.size();
+    page_id_t page_id = pending[i];
+    TestLog &log = page_logs[page_id][next[page_id]++];
+    log.lsn_ = lsn;
+    lsn = recv_calc_lsn_on_data_add(lsn, log.rec_.size());
+    logs.push_back(std::move(log));
+    if (next[page_id] == page_logs[page_id].size()) {
+      pending[i] = pending.back();
+      pending.pop_back();
+    }
+  }
+  return lsn;
+}
+
+static bool WriteZeroFile(const std::string &path, size_t size) {
+  std::ofstream ofs(path, std::ios::out | std::ios::binary | std::ios::trunc);
+  std::vector<char> zeros(TEST_PAGE_SIZE, 0);
+  for (size_t written = 0; written < size; written += zeros.size()) {
+    ofs.write(zeros.data(), static_cast<std::streamsize>(zeros.size()));
+  }
+  return static_cast<bool>(ofs);
+}
+
+static bool ReadFile(const std::string &path, std::vector<byte> &content) {
+  std::ifstream ifs(path, std::ios::in | std::ios::binary);
+  content.assign(static_cast<size_t>(N_PAGES) * TEST_PAGE_SIZE, 0);
+  ifs.read(reinterpret_cast<char *>(content.data()), static_cast<std::streamsize>(content.size()));
+  return static_cast<bool>(ifs);
+}
+
+struct RunConfig {
+  const char *name_;
+  uint32_t apply_threads_;
+  uint32_t prefetch_depth_;
+  uint32_t suspend_window_;
+  uint32_t free_frames_;
+};
+
+// 从全0的表空间开始apply整批日志，写回之后读出整个文件
+static bool Run(ApplySystem &apply_system, const RunConfig &config, const std::string &space_file,
+                std::deque<TestLog> &logs, lsn_t end_lsn, std::vector<byte> &content) {
+  // 上一次运行的page还在buffer pool中，先丢掉，分片也要在buffer pool为空的时候调整
+  buffer_pool.DropSpace(TEST_SPACE_ID, false);
+  if (!WriteZeroFile(space_file, static_cast<size_t>(N_PAGES) * TEST_PAGE_SIZE)) {
+    std::cerr << "create " << space_file << " failed" << std::endl;
+    return false;
+  }
+  apply_system.SetApplyThreads(config.apply_threads_);
+  apply_system.SetPrefetchDepth(config.prefetch_depth_);
+  apply_system.SetSuspendWindow(config.suspend_window_);
+  apply_system.SetFreeFrames(config.free_frames_);
+  if (!ParallelApplyTest::ApplyBatch(apply_system, logs, end_lsn)) {
+    std::cerr << config.name_ << ": apply failed" << std::endl;
+    return false;
+  }
+  apply_system.SetFreeFrames(0);
+  buffer_pool.FlushAll();
+  return ReadFile(space_file, content);
+}
+
+// 逐字节比较，打印第一个不同的位置
+static bool ComparePages(const char *name, const std::vector<byte> &expected, const std::vector<byte> &actual) {
+  for (page_id_t page_id = 0; page_id < N_PAGES; ++page_id) {
+    const byte *a = expected.data() + static_cast<size_t>(page_id) * TEST_PAGE_SIZE;
+    const byte *b = actual.data() + static_cast<size_t>(page_id) * TEST_PAGE_SIZE;
+    if (std::memcmp(a, b, TEST_PAGE_SIZE) == 0) {
+      continue;
+    }
+    size_t offset = 0;
+    while (a[offset] == b[offset]) {
+      offset++;
+    }
+    std::cerr << name << ": page " << page_id << " differs from serial apply at byte " << offset << std::endl;
+    return false;
+  }
+  std::cout << name << ": all " << N_PAGES << " pages are identical to serial apply" << std::endl;
+  return true;
+}
+
+}
+
+using namespace Lemon;
+
+// 同一段日志分成多批，分别用CLOCK和LOG_AWARE apply，结果都要和串行apply相同。
+// page比frame多，每一批都会用到大部分page，LOG_AWARE知道这一批和下一批会用到哪些page，命中率不能比CLOCK低
+static bool ComparePolicies(ApplySystem &apply_system, const std::string &space_file,
+                            std::deque<TestLog> &logs, lsn_t end_lsn, const std::vector<byte> &expected) {
+  static constexpr uint32_t N_BATCHES = 8;
+  const std::pair<const char *, ReplacementPolicy> policies[] = {
+      {"clock", ReplacementPolicy::CLOCK},
+      {"log-aware", ReplacementPolicy::LOG_AWARE},
+  };
+  bool ok = true;
+  std::vector<byte> actual;
+  double hit_ratios[2] = {0, 0};
+  for (uint32_t p = 0; p < 2; ++p) {
+    const auto &policy = policies[p];
+    buffer_pool.DropSpace(TEST_SPACE_ID, false);
+    if (!WriteZeroFile(space_file, static_cast<size_t>(N_PAGES) * TEST_PAGE_SIZE)) {
+      std::cerr << "create " << space_file << " failed" << std::endl;
+      return false;
+    }
+    // 单线程、不预读，两种策略的结果都是确定的
+    apply_system.SetApplyThreads(1);
+    apply_system.SetPrefetchDepth(0);
+    apply_system.SetSuspendWindow(0);
+    apply_system.SetReplacementPolicy(policy.second);
+    uint64_t requests = buffer_pool.GetPageRequests();
+    uint64_t reads = buffer_pool.GetPageReads();
+    if (!ParallelApplyTest::ApplyInBatches(apply_system, logs, end_lsn, N_BATCHES)) {
+      std::cerr << policy.first << ": apply failed" << std::endl;
+      ok = false;
+      continue;
+    }
+    requests = buffer_pool.GetPageRequests() - requests;
+    reads = buffer_pool.GetPageReads() - reads;
+    buffer_pool.FlushAll();
+    ok = ReadFile(space_file, actual) && ComparePages(policy.first, expected, actual) && ok;
+    hit_ratios[p] = 1.0 - static_cast<double>(reads) / requests;
+    std::cout << policy.first << ": " << N_BATCHES << " batches, " << requests << " page requests, "
+              << reads << " page reads, hit_ratio = " << hit_ratios[p] << std::endl;
+  }
+  apply_system.SetReplacementPolicy(ReplacementPolicy::CLOCK);
+  if (hit_ratios[1] < hit_ratios[0]) {
+    std::cerr << "log-aware hit ratio " << hit_ratios[1] << " is lower than clock " << hit_ratios[0] << std::endl;
+    ok = false;
+  }
+  return ok;
+}
+
+int main() {
+  const char *env = std::getenv("LEMON_MYSQL_HOME");
+  if (env == nullptr || env[0] == '\0') {
+    std::cerr << "LEMON_MYSQL_HOME must point to a scratch directory" << std::endl;
+    return 1;
+  }
+  std::string home = MysqlHome();
+  mkdir(home.c_str(), 0755);
+  mkdir((home + "/data").c_str(), 0755);
+  mkdir((home + "/parsed_logs").c_str(), 0755);
+  // ApplySystem在构造时读取redo log的前4个block，全0表示checkpoint_lsn为0
+  if (!WriteZeroFile(home + "/data/ib_logfile0", TEST_PAGE_SIZE)) {
+    std::cerr << "create redo log failed" << std::endl;
+    return 1;
+  }
+  // 默认大小：一个chunk，比N_PAGES少
+  if (!buffer_pool.Init(0)) {
+    std::cerr << "initialize buffer pool failed" << std::endl;
+    return 1;
+  }
+  if (buffer_pool.GetPageSize() != TEST_PAGE_SIZE) {
+    std::cerr << "unexpected page size " << buffer_pool.GetPageSize() << std::endl;
+    return 1;
+  }
+  std::string space_file = home + "/data/parallel_apply_test.ibd";
+  buffer_pool.GetSpaceRegistry().Register(TEST_SPACE_ID, space_file);
+
+  std::deque<TestLog> logs;
+  lsn_t end_lsn = GenerateLogs(logs);
+  std::cout << "generated " << logs.size() << " logs on " << N_PAGES - 1 << " pages" << std::endl;
+
+  ApplySystem apply_system(false);
+  apply_system.SetCheckpointInterval(0);
+  // 淘汰和FlushAll写回的脏page都经过doublewrite文件
+  apply_system.SetDoublewrite(true);
+
+  const RunConfig serial{"serial", 1, 0, 0, 0};
+  const RunConfig configs[] = {
+      {"4 threads", 4, 0, 0, 0},
+      {"16 threads", 16, 0, 0, 0},
+      {"8 threads with prefetch, suspend window and flusher", 8, 4, 16, 64},
+  };
+  std::vector<byte> expected;
+  if (!Run(apply_system, serial, space_file, logs, end_lsn, expected)) {
+    return 1;
+  }
+  // 确认日志真的被apply了，而不是比较两个全0的文件
+  for (page_id_t page_id = 1; page_id < N_PAGES; ++page_id) {
+    if (mach_read_from_8(expected.data() + static_cast<size_t>(page_id) * TEST_PAGE_SIZE + FIL_PAGE_LSN) == 0) {
+      std::cerr << "page " << page_id << " was not modified by serial apply" << std::endl;
+      return 1;
+    }
+  }
+
+  bool ok = true;
+  std::vector<byte> actual;
+  for (const auto &config: configs) {
+    ok = Run(apply_system, config, space_file, logs, end_lsn, actual)
+         && ComparePages(config.name_, expected, actual) && ok;
+  }
+  ok = ComparePolicies(apply_system, space_file, logs, end_lsn, expected) && ok;
+  ok = ParallelApplyTest::DiscardQueuedLogs(apply_system, logs, end_lsn) && ok;
+  std::remove(space_file.c_str());
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include "bean.h"
+
+/**
+ * apply插入和删除日志时每条record都要拷贝RecordInfo、计算一次偏移量，这里测一次“拷贝 + CalculateOffsets + 拷贝”的耗时。
+ * sysbench的sbtest聚簇索引record：id INT、DB_TRX_ID、DB_ROLL_PTR、k INT、c CHAR(120)、pad CHAR(60)，
+ * 列数在SmallArray的内联容量以内；另外测一个64列的record，fields_和offsets_都要用SpillCache中的数组。
+ */
+namespace Lemon {
+
+static constexpr uint32_t ITERATIONS = 2000000;
+
+// 按照COMPACT格式构造一条普通record：没有可以为NULL的列，变长列的长度倒着放在extra bytes前面
+struct TestRecord {
+  std::vector<byte> buf_;
+  byte *rec_ptr_;
+  RecordInfo info_;
+
+  // fixed_lens中0表示变长列，var_lens按顺序给出每一个变长列的实际长度（都小于128）
+  TestRecord(const std::vector<uint32_t> &fixed_lens, const std::vector<uint32_t> &var_lens, uint32_t n_unique) {
+    uint32_t n_fields = static_cast<uint32_t>(fixed_lens.size());
+    uint32_t n_var = static_cast<uint32_t>(var_lens.size());
+    uint32_t data_size = 0;
+    uint32_t var = 0;
+    for (uint32_t len: fixed_lens) {
+      data_size += len != 0 ? len : var_lens[var++];
+    }
+    buf_.assign(n_var + REC_N_NEW_EXTRA_BYTES + data_size, 0);
+    rec_ptr_ = buf_.data() + n_var + REC_N_NEW_EXTRA_BYTES;
+    for (uint32_t i = 0; i < n_var; ++i) {
+      rec_ptr_[-static_cast<int>(REC_N_NEW_EXTRA_BYTES + 1 + i)] = static_cast<byte>(var_lens[i]);
+    }
+    for (uint32_t i = 0; i < data_size; ++i) {
+      rec_ptr_[i] = static_cast<byte>(i);
+    }
+
+    // 和ParseRecInfoFromLog一样从日志中的列长度构造
+    info_.SetNFields(n_fields);
+    info_.SetNUnique(n_unique);
+    info_.SetIndexType(n_unique != n_fields ? DICT_CLUSTERED : 0);
+    for (uint32_t len: fixed_lens) {
+      uint32_t log_len = (len != 0 ? len : 0x7fff) | 0x8000;
+      info_.AddField(((log_len + 1) & 0x7fff) <= 1 ? DATA_BINARY : DATA_FIXBINARY,
+                     log_len & 0x8000 ? DATA_NOT_NULL : 0,
+                     log_len & 0x7fff);
+    }
+    info_.SetRecPtr(rec_ptr_);
+  }
+};
+
+static void Run(const char *name, const TestRecord &record) {
+  uint64_t checksum = 0;
+  auto t1 = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < ITERATIONS; ++i) {
+    RecordInfo info = record.info_;
+    info.CalculateOffsets(ULINT_UNDEFINED);
+    RecordInfo copy = info;
+    checksum += copy.GetDataSize() + copy.GetExtraSize();
+  }
+  auto t2 = std::chrono::steady_clock::now();
+  double ns = std::chrono::duration<double, std::nano>(t2 - t1).count() / ITERATIONS;
+  std::cout << name << ": " << ns << " ns/iter (checksum " << checksum << ")" << std::endl;
+}
+
+}
+
+using namespace Lemon;
+
+int main() {
+  std::cout << "sizeof(RecordInfo): " << sizeof(RecordInfo) << std::endl;
+
+  // id, DB_TRX_ID, DB_ROLL_PTR, k, c, pad
+  TestRecord sbtest({4, DATA_TRX_ID_LEN, DATA_ROLL_PTR_LEN, 4, 0, 0}, {120, 60}, 1);
+  Run("sbtest (6 fields)", sbtest);
+
+  // 主键 + 两个系统列 + 61个INT
+  std::vector<uint32_t> wide_lens = {4, DATA_TRX_ID_LEN, DATA_ROLL_PTR_LEN};
+  wide_lens.resize(64, 4);
+  TestRecord wide(wide_lens, {}, 1);
+  Run("wide (64 fields)", wide);
+  return 0;
+}